@@ -0,0 +1,306 @@
+#include "AssetLoader.h"
+#include "GLState.h"
+#include "Model.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "hdr.h"
+
+#include <algorithm>
+#include <cstring>
+#include <imgui.h>
+#include <iostream>
+#include <limits>
+#include <stb_image.h>
+
+namespace labhelper
+{
+namespace
+{
+	// Upper bound of one glTexSubImage2D, so a large image takes several frames
+	const size_t BAND_BYTES = 4 * 1024 * 1024;
+
+	float milliseconds(std::chrono::steady_clock::duration duration)
+	{
+		return std::chrono::duration<float, std::milli>(duration).count();
+	}
+} // namespace
+
+struct AssetLoader::HdrImage
+{
+	std::string filename;
+	int width = 0, height = 0;
+	float* data = nullptr;
+
+	// On the thread pool. Failures are reported on the GL thread, as exit()
+	// must not run on a worker.
+	void decode()
+	{
+		TRACE_SCOPE("Decode HDR image");
+		int components;
+		// Flipped vertically, as set up by init_window_SDL()
+		data = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
+	}
+	~HdrImage() { stbi_image_free(data); }
+};
+
+std::shared_ptr<AssetLoader::Asset> AssetLoader::addAsset(const std::string& name)
+{
+	std::shared_ptr<Asset> asset = std::make_shared<Asset>();
+	asset->name = name;
+	asset->requested = Clock::now();
+	m_assets.push_back(asset);
+	return asset;
+}
+
+void AssetLoader::decode(const std::shared_ptr<Asset>& asset, std::function<void()> job)
+{
+	getThreadPool().submit([this, asset, job]() {
+		Clock::time_point start = Clock::now();
+		job();
+		asset->decode_ms = milliseconds(Clock::now() - start);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			asset->decoded = true;
+		}
+		m_decoded.notify_all();
+	});
+}
+
+GLuint AssetLoader::placeholder()
+{
+	if(m_placeholder == 0)
+	{
+		const float black[3] = { 0.0f, 0.0f, 0.0f };
+		m_placeholder = createHdrTexture();
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 1, 1, 0, GL_RGB, GL_FLOAT, black);
+	}
+	return m_placeholder;
+}
+
+void AssetLoader::loadModel(Model** target, const std::string& filename, bool packVertices)
+{
+	struct Result
+	{
+		Model* model = nullptr;
+		std::string log;
+	};
+	std::shared_ptr<Result> result = std::make_shared<Result>();
+	*target = nullptr;
+
+	std::shared_ptr<Asset> asset = addAsset(filename);
+	asset->uploads.push_back([result]() {
+		// Printed here rather than by the job, so logs of different models don't interleave
+		std::cout << result->log << std::flush;
+		if(result->model == nullptr)
+		{
+			// As loadModelFromOBJ(), and so headless and benchmark runs never go without it
+			exit(1);
+		}
+		uploadModel(result->model);
+		return true;
+	});
+	asset->complete = [result, target]() { *target = result->model; };
+	asset->discard = [result]() { freeModel(result->model); };
+	decode(asset, [result, filename, packVertices]() {
+		result->model = readModelFromOBJ(filename, packVertices, &result->log);
+	});
+}
+
+void AssetLoader::loadHdrTexture(GLuint* target, const std::string& filename)
+{
+	*target = placeholder();
+	GLuint texture = createHdrTexture();
+	std::shared_ptr<HdrImage> image = std::make_shared<HdrImage>();
+	image->filename = filename;
+
+	std::shared_ptr<Asset> asset = addAsset(filename);
+	addImageUploads(*asset, texture, 0, image);
+	asset->complete = [target, texture]() { *target = texture; };
+	asset->discard = [texture]() { getGLState().deleteTextures(1, &texture); };
+	decode(asset, [image]() { image->decode(); });
+}
+
+void AssetLoader::loadHdrMipmapTexture(GLuint* target, const std::vector<std::string>& filenames)
+{
+	*target = placeholder();
+	GLuint texture = createHdrMipmapTexture();
+	std::vector<std::shared_ptr<HdrImage>> images;
+	for(size_t i = 0; i < filenames.size(); i++)
+	{
+		images.push_back(std::make_shared<HdrImage>());
+		images.back()->filename = filenames[i];
+	}
+
+	std::shared_ptr<Asset> asset = addAsset(filenames[0] + " (" + std::to_string(filenames.size()) + " levels)");
+	addImageUploads(*asset, texture, 0, images[0]);
+	asset->uploads.push_back([texture]() {
+		getGLState().bindTexture(GL_TEXTURE_2D, texture);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		return true;
+	});
+	// Again, because AMD drivers have some weird issue in the GenerateMipmap
+	// function that breaks the first level of the image (see loadHdrMipmapTexture()).
+	addImageUploads(*asset, texture, 0, images[0]);
+	for(size_t i = 1; i < images.size(); i++)
+	{
+		addImageUploads(*asset, texture, int(i), images[i]);
+	}
+	asset->complete = [target, texture]() { *target = texture; };
+	asset->discard = [texture]() { getGLState().deleteTextures(1, &texture); };
+	decode(asset, [images]() { getThreadPool().parallelFor(images.size(), [&](size_t i) { images[i]->decode(); }); });
+}
+
+void AssetLoader::addImageUploads(Asset& asset, GLuint texture, int level, const std::shared_ptr<HdrImage>& image)
+{
+	asset.uploads.push_back([texture, level, image]() {
+		if(image->data == nullptr)
+		{
+			std::cout << "Failed to load image: " << image->filename << ".\n";
+			exit(1);
+		}
+		getGLState().bindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGB32F, image->width, image->height, 0, GL_RGB, GL_FLOAT, nullptr);
+		return true;
+	});
+	std::shared_ptr<int> next_row = std::make_shared<int>(0);
+	asset.uploads.push_back([this, texture, level, image, next_row]() {
+		size_t row_bytes = size_t(image->width) * 3 * sizeof(float);
+		int rows = std::min(image->height - *next_row, std::max(1, int(BAND_BYTES / row_bytes)));
+		uploadRows(texture, level, *image, *next_row, rows);
+		*next_row += rows;
+		return *next_row >= image->height;
+	});
+}
+
+void AssetLoader::uploadRows(GLuint texture, int level, const HdrImage& image, int first_row, int rows)
+{
+	TRACE_SCOPE("Upload HDR rows");
+	size_t row_floats = size_t(image.width) * 3;
+	size_t bytes = row_floats * rows * sizeof(float);
+	if(m_unpack_buffer == 0)
+	{
+		glGenBuffers(1, &m_unpack_buffer);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_unpack_buffer);
+	// Orphaned, so the copy doesn't wait for the GPU to read the previous band
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+	void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	memcpy(mapped, image.data + row_floats * first_row, bytes);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	getGLState().bindTexture(GL_TEXTURE_2D, texture);
+	glTexSubImage2D(GL_TEXTURE_2D, level, 0, first_row, image.width, rows, GL_RGB, GL_FLOAT, nullptr);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void AssetLoader::update(float budget_ms)
+{
+	TRACE_FUNCTION();
+	Clock::time_point start = Clock::now();
+	bool stepped = false;
+	for(size_t i = 0; i < m_assets.size();)
+	{
+		Asset& asset = *m_assets[i];
+		if(!asset.decoded)
+		{
+			i++;
+			continue;
+		}
+		while(asset.next_upload < asset.uploads.size())
+		{
+			if(stepped && milliseconds(Clock::now() - start) >= budget_ms)
+			{
+				return;
+			}
+			Clock::time_point step_start = Clock::now();
+			if(asset.uploads[asset.next_upload]())
+			{
+				asset.next_upload++;
+			}
+			asset.upload_ms += milliseconds(Clock::now() - step_start);
+			stepped = true;
+		}
+		asset.complete();
+		m_loaded.push_back({ asset.name, asset.decode_ms, asset.upload_ms, milliseconds(Clock::now() - asset.requested) });
+		m_assets.erase(m_assets.begin() + i);
+	}
+}
+
+void AssetLoader::finish()
+{
+	TRACE_FUNCTION();
+	for(;;)
+	{
+		update(std::numeric_limits<float>::infinity());
+		if(idle())
+		{
+			return;
+		}
+		// Everything left is still decoding
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_decoded.wait(lock, [this]() {
+			for(const std::shared_ptr<Asset>& asset : m_assets)
+			{
+				if(asset->decoded)
+				{
+					return true;
+				}
+			}
+			return false;
+		});
+	}
+}
+
+void AssetLoader::drawGui()
+{
+	for(const std::shared_ptr<Asset>& asset : m_assets)
+	{
+		ImGui::BulletText("%s: %s", asset->name.c_str(), asset->decoded ? "uploading" : "decoding");
+	}
+	for(const Loaded& loaded : m_loaded)
+	{
+		ImGui::BulletText("%s: %.1f ms (decode %.1f, upload %.1f)", loaded.name.c_str(), loaded.total_ms,
+		                  loaded.decode_ms, loaded.upload_ms);
+	}
+}
+
+void AssetLoader::free()
+{
+	{
+		// The jobs write into the assets
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_decoded.wait(lock, [this]() {
+			for(const std::shared_ptr<Asset>& asset : m_assets)
+			{
+				if(!asset->decoded)
+				{
+					return false;
+				}
+			}
+			return true;
+		});
+	}
+	for(const std::shared_ptr<Asset>& asset : m_assets)
+	{
+		asset->discard();
+	}
+	m_assets.clear();
+	m_loaded.clear();
+	if(m_placeholder != 0)
+	{
+		getGLState().deleteTextures(1, &m_placeholder);
+		m_placeholder = 0;
+	}
+	if(m_unpack_buffer != 0)
+	{
+		glDeleteBuffers(1, &m_unpack_buffer);
+		m_unpack_buffer = 0;
+	}
+}
+
+AssetLoader& getAssetLoader()
+{
+	static AssetLoader loader;
+	return loader;
+}
+} // namespace labhelper
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace labhelper
+{
+class Model;
+
+///////////////////////////////////////////////////////////////////////////
+/// Loads models and HDR textures in the background, so the first frame
+/// does not wait for them.
+///
+/// Files are read and decoded on the thread pool. update(), called once
+/// per frame on the GL thread, then uploads what is decoded in small steps
+/// until its time budget is spent: vertex buffers and material textures
+/// one model at a time, HDR images in bands of rows through a pixel unpack
+/// buffer. Only when an asset is complete is it written to the variable
+/// given when it was requested. Until then a model stays nullptr (so is
+/// not drawn) and a texture is a shared black 1x1 placeholder.
+///
+/// Usage:
+///	getAssetLoader().loadModel(&model, "../scenes/space-ship.obj", false);
+///	getAssetLoader().loadHdrTexture(&texture, "../scenes/envmaps/001.hdr");
+///	while(running) { getAssetLoader().update(2.0f); render(); }
+///	getAssetLoader().finish(); // instead, where every frame must be complete
+///////////////////////////////////////////////////////////////////////////
+class AssetLoader
+{
+public:
+	AssetLoader() = default;
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	///////////////////////////////////////////////////////////////////////
+	/// Requests, to be called on the GL thread. `*target` must stay valid
+	/// until the asset is loaded. A model or image that fails to load is
+	/// reported and fatal, when it would be uploaded, as with the
+	/// synchronous loadModelFromOBJ() and loadHdrTexture().
+	///////////////////////////////////////////////////////////////////////
+	void loadModel(Model** target, const std::string& filename, bool packVertices);
+	void loadHdrTexture(GLuint* target, const std::string& filename);
+	// The first file is level 0, the rest replace the generated mipmap levels
+	void loadHdrMipmapTexture(GLuint* target, const std::vector<std::string>& filenames);
+
+	///////////////////////////////////////////////////////////////////////
+	/// Uploads decoded assets until `budget_ms` is spent. At least one step
+	/// is taken whenever one is ready, so loading always progresses.
+	///////////////////////////////////////////////////////////////////////
+	void update(float budget_ms);
+
+	// Blocks until every requested asset is loaded
+	void finish();
+	bool idle() const { return m_assets.empty(); }
+
+	void drawGui();
+
+	// Frees the placeholder and unpack buffer, and drops assets still loading
+	void free();
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Asset
+	{
+		std::string name;
+		// Set by the decode job once the asset is ready to upload
+		std::atomic<bool> decoded{ false };
+		// Each returns whether it is done; called again next time otherwise
+		std::vector<std::function<bool()>> uploads;
+		size_t next_upload = 0;
+		// Run once the last upload is done
+		std::function<void()> complete;
+		// Run instead of the uploads when the asset is dropped by free()
+		std::function<void()> discard;
+		Clock::time_point requested;
+		float decode_ms = 0.0f;
+		float upload_ms = 0.0f;
+	};
+	struct Loaded
+	{
+		std::string name;
+		float decode_ms, upload_ms, total_ms;
+	};
+	struct HdrImage;
+
+	std::shared_ptr<Asset> addAsset(const std::string& name);
+	void decode(const std::shared_ptr<Asset>& asset, std::function<void()> job);
+	GLuint placeholder();
+	void addImageUploads(Asset& asset, GLuint texture, int level, const std::shared_ptr<HdrImage>& image);
+	void uploadRows(GLuint texture, int level, const HdrImage& image, int first_row, int rows);
+
+	std::vector<std::shared_ptr<Asset>> m_assets;
+	std::vector<Loaded> m_loaded;
+	std::mutex m_mutex;
+	std::condition_variable m_decoded;
+	GLuint m_placeholder = 0;
+	GLuint m_unpack_buffer = 0;
+};
+
+AssetLoader& getAssetLoader();
+} // namespace labhelper
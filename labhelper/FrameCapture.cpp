@@ -0,0 +1,359 @@
+#include "FrameCapture.h"
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace labhelper
+{
+namespace
+{
+	void writeAttribute(std::ofstream& out, const char* name, const char* type, const void* data, int32_t size)
+	{
+		out.write(name, strlen(name) + 1);
+		out.write(type, strlen(type) + 1);
+		out.write((const char*)&size, 4);
+		out.write((const char*)data, size);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	/// Minimal OpenEXR writer: scanline image, no compression, half float
+	/// B, G and R channels (channels are stored in alphabetical order).
+	/// Assumes a little-endian machine, like EXR itself.
+	///////////////////////////////////////////////////////////////////////
+	bool writeExr(const std::string& filename, int width, int height, const uint16_t* rgb)
+	{
+		std::ofstream out(filename, std::ios::binary);
+		if(!out)
+		{
+			return false;
+		}
+		const int32_t magic = 20000630;
+		const int32_t version = 2;
+		out.write((const char*)&magic, 4);
+		out.write((const char*)&version, 4);
+
+		std::vector<char> channels;
+		for(const char* name : { "B", "G", "R" })
+		{
+			const int32_t half_type = 1;
+			const int32_t sampling = 1;
+			const char linear_and_reserved[4] = { 0, 0, 0, 0 };
+			channels.push_back(name[0]);
+			channels.push_back(0);
+			channels.insert(channels.end(), (const char*)&half_type, (const char*)&half_type + 4);
+			channels.insert(channels.end(), linear_and_reserved, linear_and_reserved + 4);
+			channels.insert(channels.end(), (const char*)&sampling, (const char*)&sampling + 4);
+			channels.insert(channels.end(), (const char*)&sampling, (const char*)&sampling + 4);
+		}
+		channels.push_back(0);
+		writeAttribute(out, "channels", "chlist", channels.data(), int32_t(channels.size()));
+
+		const uint8_t no_compression = 0;
+		writeAttribute(out, "compression", "compression", &no_compression, 1);
+		const int32_t window[4] = { 0, 0, width - 1, height - 1 };
+		writeAttribute(out, "dataWindow", "box2i", window, 16);
+		writeAttribute(out, "displayWindow", "box2i", window, 16);
+		const uint8_t increasing_y = 0;
+		writeAttribute(out, "lineOrder", "lineOrder", &increasing_y, 1);
+		const float aspect = 1.0f;
+		writeAttribute(out, "pixelAspectRatio", "float", &aspect, 4);
+		const float center[2] = { 0.0f, 0.0f };
+		writeAttribute(out, "screenWindowCenter", "v2f", center, 8);
+		const float screen_width = 1.0f;
+		writeAttribute(out, "screenWindowWidth", "float", &screen_width, 4);
+		out.put(0);
+
+		// Offset table, one block per scanline
+		const int32_t line_bytes = width * 3 * 2;
+		uint64_t offset = uint64_t(out.tellp()) + uint64_t(height) * 8;
+		for(int y = 0; y < height; y++)
+		{
+			out.write((const char*)&offset, 8);
+			offset += 8 + line_bytes;
+		}
+
+		std::vector<uint16_t> line(width * 3);
+		for(int32_t y = 0; y < height; y++)
+		{
+			const uint16_t* row = rgb + size_t(y) * width * 3;
+			for(int x = 0; x < width; x++)
+			{
+				line[x] = row[x * 3 + 2];
+				line[width + x] = row[x * 3 + 1];
+				line[2 * width + x] = row[x * 3 + 0];
+			}
+			out.write((const char*)&y, 4);
+			out.write((const char*)&line_bytes, 4);
+			out.write((const char*)line.data(), line_bytes);
+		}
+		return bool(out);
+	}
+
+	bool writePpm(const std::string& filename, int width, int height, const uint8_t* rgb)
+	{
+		std::ofstream out(filename, std::ios::binary);
+		out << "P6\n" << width << " " << height << "\n255\n";
+		out.write((const char*)rgb, size_t(width) * height * 3);
+		return bool(out);
+	}
+
+	size_t bytesPerPixel(FrameCapture::Format format)
+	{
+		return format == FrameCapture::EXR ? 3 * 2 : 3;
+	}
+} // namespace
+
+FrameCapture::FrameCapture() {}
+
+FrameCapture::~FrameCapture()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_work_available.notify_all();
+	for(auto& encoder : m_encoders)
+	{
+		encoder.join();
+	}
+}
+
+const char* FrameCapture::extension(Format format)
+{
+	switch(format)
+	{
+	case EXR:
+		return ".exr";
+	case RAW:
+		return ".ppm";
+	default:
+		return ".png";
+	}
+}
+
+void FrameCapture::capture(GLuint framebuffer, int width, int height, const std::string& basename, Format format)
+{
+	if(m_encoders.empty())
+	{
+		int count = std::max(1, std::min(4, int(std::thread::hardware_concurrency()) - 1));
+		for(int i = 0; i < count; i++)
+		{
+			m_encoders.push_back(std::thread(&FrameCapture::encoderLoop, this));
+		}
+	}
+
+	Slot& slot = m_slots[m_next_slot];
+	m_next_slot = (m_next_slot + 1) % RING_SIZE;
+	if(slot.fence != nullptr)
+	{
+		// The whole ring is in flight
+		m_stalls++;
+		finish(slot, true);
+	}
+
+	size_t size = size_t(width) * height * bytesPerPixel(format);
+	if(slot.pbo == 0)
+	{
+		glGenBuffers(1, &slot.pbo);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	if(slot.pbo_size != size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+		slot.pbo_size = size;
+	}
+
+	GLint previous_framebuffer;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_framebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, format == EXR ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, nullptr);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_framebuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot.width = width;
+	slot.height = height;
+	slot.format = format;
+	slot.filename = basename + extension(format);
+}
+
+void FrameCapture::update()
+{
+	// Oldest first, so files are handed on in capture order
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		Slot& slot = m_slots[(m_next_slot + i) % RING_SIZE];
+		if(slot.fence != nullptr)
+		{
+			finish(slot, false);
+		}
+	}
+}
+
+void FrameCapture::finish(Slot& slot, bool wait)
+{
+	GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GLuint64(-1) : 0);
+	if(status == GL_TIMEOUT_EXPIRED)
+	{
+		return;
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = nullptr;
+
+	Job job;
+	job.filename = slot.filename;
+	job.format = slot.format;
+	job.width = slot.width;
+	job.height = slot.height;
+	job.pixels.resize(slot.pbo_size);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.pbo_size, GL_MAP_READ_BIT);
+	if(data != nullptr)
+	{
+		memcpy(job.pixels.data(), data, slot.pbo_size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if(data == nullptr)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(m_jobs.size() >= MAX_QUEUED_ENCODES)
+	{
+		m_stalls++;
+		m_work_done.wait(lock, [this] { return m_jobs.size() < MAX_QUEUED_ENCODES; });
+	}
+	m_jobs.push_back(std::move(job));
+	lock.unlock();
+	m_work_available.notify_one();
+}
+
+void FrameCapture::encoderLoop()
+{
+	for(;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_available.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+			if(m_jobs.empty())
+			{
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			m_busy_encoders++;
+		}
+		m_work_done.notify_all();
+
+		encode(job);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_busy_encoders--;
+		}
+		m_work_done.notify_all();
+	}
+}
+
+void FrameCapture::encode(Job& job)
+{
+	// GL rows are bottom-up
+	size_t row_bytes = job.pixels.size() / job.height;
+	for(int r = 0; r < job.height / 2; r++)
+	{
+		std::swap_ranges(job.pixels.begin() + r * row_bytes, job.pixels.begin() + (r + 1) * row_bytes,
+		                 job.pixels.begin() + (job.height - 1 - r) * row_bytes);
+	}
+
+	bool ok = false;
+	switch(job.format)
+	{
+	case EXR:
+		ok = writeExr(job.filename, job.width, job.height, (const uint16_t*)job.pixels.data());
+		break;
+	case RAW:
+		ok = writePpm(job.filename, job.width, job.height, job.pixels.data());
+		break;
+	default:
+		ok = stbi_write_png(job.filename.c_str(), job.width, job.height, 3, job.pixels.data(), 0) != 0;
+		break;
+	}
+	if(!ok)
+	{
+		fprintf(stderr, "Could not write %s\n", job.filename.c_str());
+	}
+}
+
+void FrameCapture::flush()
+{
+	for(int i = 0; i < RING_SIZE; i++)
+	{
+		Slot& slot = m_slots[(m_next_slot + i) % RING_SIZE];
+		if(slot.fence != nullptr)
+		{
+			finish(slot, true);
+		}
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_work_done.wait(lock, [this] { return m_jobs.empty() && m_busy_encoders == 0; });
+}
+
+void FrameCapture::free()
+{
+	flush();
+	for(Slot& slot : m_slots)
+	{
+		if(slot.pbo != 0)
+		{
+			glDeleteBuffers(1, &slot.pbo);
+		}
+		slot.pbo = 0;
+		slot.pbo_size = 0;
+	}
+}
+
+size_t FrameCapture::pendingEncodes()
+{
+	size_t in_flight = 0;
+	for(const Slot& slot : m_slots)
+	{
+		in_flight += slot.fence != nullptr ? 1 : 0;
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return in_flight + m_jobs.size() + m_busy_encoders;
+}
+
+void FrameCapture::startSequence(const std::string& prefix, Format format)
+{
+	m_sequence_prefix = prefix;
+	m_sequence_format = format;
+	m_sequence_frame = 0;
+	m_recording = true;
+}
+
+void FrameCapture::captureSequenceFrame(GLuint framebuffer, int width, int height)
+{
+	if(!m_recording)
+	{
+		return;
+	}
+	char number[16];
+	snprintf(number, sizeof(number), "_%05d", m_sequence_frame++);
+	capture(framebuffer, width, height, m_sequence_prefix + number, m_sequence_format);
+}
+
+FrameCapture& getFrameCapture()
+{
+	static FrameCapture capture;
+	return capture;
+}
+} // namespace labhelper
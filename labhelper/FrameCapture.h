@@ -0,0 +1,122 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Saves framebuffers to disk without stalling the render thread.
+///
+/// capture() starts an asynchronous glReadPixels into one of a ring of
+/// pixel pack buffers and puts a fence behind it. update() (call once per
+/// frame) maps the buffers whose fence has signalled and hands the pixels
+/// to background threads that flip and encode them. Only when all buffers
+/// of the ring are still in flight does capture() wait for the oldest.
+///
+/// Formats: PNG (8 bit), EXR (uncompressed half float) and RAW (binary PPM,
+/// fastest to write, e.g. for ffmpeg).
+///////////////////////////////////////////////////////////////////////////
+class FrameCapture
+{
+public:
+	enum Format
+	{
+		PNG = 0,
+		EXR,
+		RAW,
+		FORMAT_COUNT
+	};
+	static const int RING_SIZE = 4;
+	// Encodes waiting beyond this make capture() block until the encoders catch up
+	static const size_t MAX_QUEUED_ENCODES = 32;
+
+	FrameCapture();
+	~FrameCapture();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Queues a readback of the first color attachment of `framebuffer`.
+	/// The file extension is added according to the format.
+	///////////////////////////////////////////////////////////////////////
+	void capture(GLuint framebuffer, int width, int height, const std::string& basename, Format format);
+
+	/// Hands finished readbacks to the encoders, never waits for the GPU
+	void update();
+
+	/// Waits for all readbacks and encodes to finish
+	void flush();
+
+	/// Deletes the buffers, call while the context is still alive
+	void free();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Frame sequences: while recording, captureSequenceFrame() saves every
+	/// call as <prefix>_NNNNN in the given format.
+	///////////////////////////////////////////////////////////////////////
+	void startSequence(const std::string& prefix, Format format);
+	void stopSequence() { m_recording = false; }
+	bool isRecording() const { return m_recording; }
+	void captureSequenceFrame(GLuint framebuffer, int width, int height);
+	int sequenceFrames() const { return m_sequence_frame; }
+
+	size_t pendingEncodes();
+	// Times capture() had to wait for a readback or for the encoders
+	uint64_t stalls() const { return m_stalls; }
+
+	static const char* extension(Format format);
+
+private:
+	struct Slot
+	{
+		GLuint pbo = 0;
+		size_t pbo_size = 0;
+		GLsync fence = nullptr;
+		int width = 0;
+		int height = 0;
+		Format format = PNG;
+		std::string filename;
+	};
+	struct Job
+	{
+		std::string filename;
+		Format format;
+		int width;
+		int height;
+		std::vector<uint8_t> pixels;
+	};
+
+	void finish(Slot& slot, bool wait);
+	void encoderLoop();
+	static void encode(Job& job);
+
+	Slot m_slots[RING_SIZE];
+	int m_next_slot = 0;
+	uint64_t m_stalls = 0;
+
+	std::vector<std::thread> m_encoders;
+	std::mutex m_mutex;
+	std::condition_variable m_work_available;
+	std::condition_variable m_work_done;
+	std::deque<Job> m_jobs;
+	size_t m_busy_encoders = 0;
+	bool m_quit = false;
+
+	bool m_recording = false;
+	std::string m_sequence_prefix;
+	Format m_sequence_format = PNG;
+	int m_sequence_frame = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// The capture used by saveScreenshot(). Call update() on it once per frame
+/// so screenshots are written as soon as they are read back.
+///////////////////////////////////////////////////////////////////////////
+FrameCapture& getFrameCapture();
+} // namespace labhelper
@@ -0,0 +1,176 @@
+#include "FramePacer.h"
+#include "Trace.h"
+#include "labhelper.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace labhelper
+{
+void FramePacer::waitFor(int slot)
+{
+	GLsync& fence = m_fences[slot];
+	if(fence == nullptr)
+	{
+		return;
+	}
+	// Cheap check first, a frame that is already done should not count as a stall
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if(status == GL_TIMEOUT_EXPIRED)
+	{
+		TRACE_SCOPE("Wait for GPU");
+		uint64_t start = traceNow();
+		do
+		{
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		} while(status == GL_TIMEOUT_EXPIRED);
+		m_last_wait_ms += float(double(traceNow() - start) * 1e-6);
+		m_stalls++;
+	}
+	if(status == GL_WAIT_FAILED)
+	{
+		non_fatal_error("glClientWaitSync failed", "FramePacer");
+	}
+	glDeleteSync(fence);
+	fence = nullptr;
+}
+
+void FramePacer::beginFrame()
+{
+	m_slot = int(m_frame % uint64_t(m_max_queued));
+	m_last_wait_ms = 0.0f;
+	waitFor(m_slot);
+}
+
+void FramePacer::endFrame()
+{
+	m_fences[m_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_frame++;
+}
+
+void FramePacer::flush()
+{
+	for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	{
+		waitFor(i);
+	}
+}
+
+void FramePacer::setMaxQueuedFrames(int frames)
+{
+	frames = std::min(std::max(frames, 1), int(MAX_FRAMES_IN_FLIGHT));
+	if(frames == m_max_queued)
+	{
+		return;
+	}
+	flush();
+	m_max_queued = frames;
+}
+
+void FramePacer::setSwapMode(SwapMode mode)
+{
+	m_swap_mode = mode;
+	if(isHeadless())
+	{
+		return;
+	}
+	int interval = mode == VSYNC_OFF ? 0 : mode == VSYNC_ON ? 1 : -1;
+	if(SDL_GL_SetSwapInterval(interval) != 0 && mode == VSYNC_ADAPTIVE)
+	{
+		non_fatal_error("Adaptive vsync is not supported, using vsync instead", "FramePacer");
+		m_swap_mode = VSYNC_ON;
+		SDL_GL_SetSwapInterval(1);
+	}
+}
+
+void FramePacer::drawGui()
+{
+	int mode = m_swap_mode;
+	if(ImGui::Combo("VSync", &mode, "Off\0On\0Adaptive\0\0"))
+	{
+		setSwapMode(SwapMode(mode));
+	}
+	int queued = m_max_queued;
+	if(ImGui::SliderInt("Max Queued Frames", &queued, 1, MAX_FRAMES_IN_FLIGHT))
+	{
+		setMaxQueuedFrames(queued);
+	}
+	ImGui::Text("Waited %.3f ms for the GPU, %llu stalls", m_last_wait_ms, (unsigned long long)m_stalls);
+}
+
+void FramePacer::free()
+{
+	flush();
+}
+
+FramePacer& getFramePacer()
+{
+	static FramePacer pacer;
+	return pacer;
+}
+
+void StreamBuffer::init(size_t bytes_per_frame)
+{
+	m_bytes_per_frame = bytes_per_frame;
+	const size_t size = bytes_per_frame * FramePacer::MAX_FRAMES_IN_FLIGHT;
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+	if(GLEW_ARB_buffer_storage)
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+		m_mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+	}
+	else
+	{
+		glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GLintptr StreamBuffer::write(const void* data, size_t size, size_t alignment)
+{
+	const FramePacer& pacer = getFramePacer();
+	if(m_frame != pacer.frameNumber())
+	{
+		m_frame = pacer.frameNumber();
+		m_head = 0;
+	}
+	// Aligned in the whole buffer, the slots need not be a multiple of `alignment`
+	const size_t slot_start = size_t(pacer.slot()) * m_bytes_per_frame;
+	size_t offset = (slot_start + m_head + alignment - 1) / alignment * alignment;
+	if(offset + size > slot_start + m_bytes_per_frame)
+	{
+		m_overflows++;
+		return -1;
+	}
+	m_head = offset + size - slot_start;
+
+	if(m_mapped != nullptr)
+	{
+		std::memcpy(m_mapped + offset, data, size);
+	}
+	else
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, GLintptr(offset), GLsizeiptr(size), data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	return GLintptr(offset);
+}
+
+void StreamBuffer::free()
+{
+	if(m_mapped != nullptr)
+	{
+		glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		m_mapped = nullptr;
+	}
+	glDeleteBuffers(1, &m_buffer);
+	m_buffer = 0;
+}
+} // namespace labhelper
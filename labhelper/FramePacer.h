@@ -0,0 +1,126 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Bounds how far the CPU may run ahead of the GPU.
+///
+/// Every frame ends with a fence. beginFrame() waits for the fence of the
+/// frame that last used the same slot, so at most maxQueuedFrames() frames
+/// are in flight. Data written per frame through a StreamBuffer goes into the
+/// slot's part of the ring, which the GPU is done with once beginFrame()
+/// returns. Fewer queued frames means less input latency, more means the
+/// CPU and GPU overlap better.
+///
+/// Usage:
+///	pacer.beginFrame();
+///	render();
+///	SDL_GL_SwapWindow(window);
+///	pacer.endFrame();
+///////////////////////////////////////////////////////////////////////////
+class FramePacer
+{
+public:
+	static const int MAX_FRAMES_IN_FLIGHT = 4;
+
+	enum SwapMode
+	{
+		VSYNC_OFF = 0,
+		VSYNC_ON,
+		// Late frames are swapped immediately instead of waiting a whole refresh
+		VSYNC_ADAPTIVE
+	};
+
+	void beginFrame();
+	void endFrame();
+
+	// Part of the stream buffers the current frame writes, 0 to maxQueuedFrames() - 1
+	int slot() const { return m_slot; }
+	uint64_t frameNumber() const { return m_frame; }
+
+	///////////////////////////////////////////////////////////////////////
+	/// 1 to MAX_FRAMES_IN_FLIGHT. Waits for every queued frame, since the
+	/// slots of the stream buffers change.
+	///////////////////////////////////////////////////////////////////////
+	void setMaxQueuedFrames(int frames);
+	int maxQueuedFrames() const { return m_max_queued; }
+
+	///////////////////////////////////////////////////////////////////////
+	/// Sets the swap interval of the window's context. Falls back to
+	/// VSYNC_ON if adaptive vsync is not supported. No-op when headless.
+	///////////////////////////////////////////////////////////////////////
+	void setSwapMode(SwapMode mode);
+	SwapMode swapMode() const { return m_swap_mode; }
+
+	// Time beginFrame() spent waiting for the GPU, and how often it waited at all
+	float lastWaitMs() const { return m_last_wait_ms; }
+	uint64_t stalls() const { return m_stalls; }
+
+	// Waits for every frame in flight
+	void flush();
+
+	void drawGui();
+	void free();
+
+private:
+	void waitFor(int slot);
+
+	GLsync m_fences[MAX_FRAMES_IN_FLIGHT] = {};
+	int m_max_queued = 2;
+	int m_slot = 0;
+	uint64_t m_frame = 0;
+	SwapMode m_swap_mode = VSYNC_ON;
+	float m_last_wait_ms = 0.0f;
+	uint64_t m_stalls = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// The pacer shared by the application, labhelper's stream buffers and ImGui
+///////////////////////////////////////////////////////////////////////////
+FramePacer& getFramePacer();
+
+///////////////////////////////////////////////////////////////////////////
+/// A buffer written by the CPU every frame (uniforms, streamed vertices).
+///
+/// Holds MAX_FRAMES_IN_FLIGHT regions of `bytes_per_frame` and writes go into
+/// the region of the pacer's current slot, so the CPU never touches data a
+/// queued frame still reads, and neither needs to orphan the buffer nor wait.
+/// With GL_ARB_buffer_storage the buffer is mapped once, persistently and
+/// coherently, and writes are plain memcpys. Otherwise each write is a
+/// glBufferSubData into a range the GPU is done with.
+///////////////////////////////////////////////////////////////////////////
+class StreamBuffer
+{
+public:
+	void init(size_t bytes_per_frame);
+
+	///////////////////////////////////////////////////////////////////////
+	/// Copies `size` bytes into this frame's region and returns their byte
+	/// offset in buffer(), a multiple of `alignment`, or -1 if the region
+	/// is full (the caller must then use some other buffer).
+	///////////////////////////////////////////////////////////////////////
+	GLintptr write(const void* data, size_t size, size_t alignment = 4);
+
+	GLuint buffer() const { return m_buffer; }
+	bool isPersistent() const { return m_mapped != nullptr; }
+	size_t bytesPerFrame() const { return m_bytes_per_frame; }
+	// Bytes written this frame, and writes that did not fit
+	size_t used() const { return m_head; }
+	uint64_t overflows() const { return m_overflows; }
+
+	void free();
+
+private:
+	GLuint m_buffer = 0;
+	uint8_t* m_mapped = nullptr;
+	size_t m_bytes_per_frame = 0;
+	size_t m_head = 0;
+	uint64_t m_frame = ~uint64_t(0);
+	uint64_t m_overflows = 0;
+};
+} // namespace labhelper
@@ -0,0 +1,285 @@
+#include "GLState.h"
+
+#include <imgui.h>
+
+namespace labhelper
+{
+bool GLStateCache::change(uint32_t known)
+{
+	if(m_known & known)
+	{
+		m_filtered++;
+		return false;
+	}
+	m_known |= known;
+	m_changes++;
+	return true;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+	if(m_program != program)
+	{
+		m_known &= ~KNOWN_PROGRAM;
+	}
+	if(change(KNOWN_PROGRAM))
+	{
+		m_program = program;
+		glUseProgram(program);
+	}
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+	if(m_vao != vao)
+	{
+		m_known &= ~KNOWN_VAO;
+	}
+	if(change(KNOWN_VAO))
+	{
+		m_vao = vao;
+		glBindVertexArray(vao);
+	}
+}
+
+void GLStateCache::activeTexture(GLuint unit)
+{
+	if(m_active_texture != unit)
+	{
+		m_known &= ~KNOWN_ACTIVE_TEXTURE;
+	}
+	if(change(KNOWN_ACTIVE_TEXTURE))
+	{
+		m_active_texture = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	if(unit >= GLuint(MAX_TEXTURE_UNITS))
+	{
+		activeTexture(unit);
+		glBindTexture(target, texture);
+		m_changes++;
+		return;
+	}
+	TextureBinding& binding = m_textures[unit];
+	if(binding.known && binding.target == target && binding.texture == texture)
+	{
+		m_filtered++;
+		return;
+	}
+	activeTexture(unit);
+	glBindTexture(target, texture);
+	binding.target = target;
+	binding.texture = texture;
+	binding.known = true;
+	m_changes++;
+}
+
+void GLStateCache::bindTexture(GLenum target, GLuint texture)
+{
+	if((m_known & KNOWN_ACTIVE_TEXTURE) == 0)
+	{
+		GLint active = GL_TEXTURE0;
+		glGetIntegerv(GL_ACTIVE_TEXTURE, &active);
+		m_active_texture = GLuint(active - GL_TEXTURE0);
+		m_known |= KNOWN_ACTIVE_TEXTURE;
+	}
+	bindTexture(m_active_texture, target, texture);
+}
+
+void GLStateCache::bindFramebuffer(GLuint framebuffer)
+{
+	if(m_framebuffer != framebuffer)
+	{
+		m_known &= ~KNOWN_FRAMEBUFFER;
+	}
+	if(change(KNOWN_FRAMEBUFFER))
+	{
+		m_framebuffer = framebuffer;
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+}
+
+void GLStateCache::setViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	if(m_viewport[0] != x || m_viewport[1] != y || m_viewport[2] != width || m_viewport[3] != height)
+	{
+		m_known &= ~KNOWN_VIEWPORT;
+	}
+	if(change(KNOWN_VIEWPORT))
+	{
+		m_viewport[0] = x;
+		m_viewport[1] = y;
+		m_viewport[2] = width;
+		m_viewport[3] = height;
+		glViewport(x, y, width, height);
+	}
+}
+
+void GLStateCache::setCapability(GLenum cap, bool enable, bool& shadow, uint32_t known)
+{
+	if(shadow != enable)
+	{
+		m_known &= ~known;
+	}
+	if(change(known))
+	{
+		shadow = enable;
+		if(enable)
+			glEnable(cap);
+		else
+			glDisable(cap);
+	}
+}
+
+void GLStateCache::setDepthTest(bool enable)
+{
+	setCapability(GL_DEPTH_TEST, enable, m_depth_test, KNOWN_DEPTH_TEST);
+}
+
+void GLStateCache::setBlend(bool enable)
+{
+	setCapability(GL_BLEND, enable, m_blend, KNOWN_BLEND);
+}
+
+void GLStateCache::setCullFace(bool enable)
+{
+	setCapability(GL_CULL_FACE, enable, m_cull_face, KNOWN_CULL_FACE);
+}
+
+void GLStateCache::setDepthWrite(bool enable)
+{
+	if(m_depth_write != enable)
+	{
+		m_known &= ~KNOWN_DEPTH_WRITE;
+	}
+	if(change(KNOWN_DEPTH_WRITE))
+	{
+		m_depth_write = enable;
+		glDepthMask(enable ? GL_TRUE : GL_FALSE);
+	}
+}
+
+void GLStateCache::setDepthFunc(GLenum func)
+{
+	if(m_depth_func != func)
+	{
+		m_known &= ~KNOWN_DEPTH_FUNC;
+	}
+	if(change(KNOWN_DEPTH_FUNC))
+	{
+		m_depth_func = func;
+		glDepthFunc(func);
+	}
+}
+
+void GLStateCache::setBlendFunc(GLenum src, GLenum dst)
+{
+	if(m_blend_src != src || m_blend_dst != dst)
+	{
+		m_known &= ~KNOWN_BLEND_FUNC;
+	}
+	if(change(KNOWN_BLEND_FUNC))
+	{
+		m_blend_src = src;
+		m_blend_dst = dst;
+		glBlendFunc(src, dst);
+	}
+}
+
+void GLStateCache::setColorWrite(bool enable)
+{
+	if(m_color_write != enable)
+	{
+		m_known &= ~KNOWN_COLOR_WRITE;
+	}
+	if(change(KNOWN_COLOR_WRITE))
+	{
+		m_color_write = enable;
+		GLboolean mask = enable ? GL_TRUE : GL_FALSE;
+		glColorMask(mask, mask, mask, mask);
+	}
+}
+
+void GLStateCache::deleteTextures(GLsizei n, const GLuint* textures)
+{
+	for(GLsizei i = 0; i < n; i++)
+	{
+		for(TextureBinding& binding : m_textures)
+		{
+			if(binding.texture == textures[i])
+			{
+				binding.texture = 0;
+			}
+		}
+	}
+	glDeleteTextures(n, textures);
+}
+
+void GLStateCache::deleteFramebuffers(GLsizei n, const GLuint* framebuffers)
+{
+	for(GLsizei i = 0; i < n; i++)
+	{
+		if(m_framebuffer == framebuffers[i])
+		{
+			m_framebuffer = 0;
+		}
+	}
+	glDeleteFramebuffers(n, framebuffers);
+}
+
+GLuint GLStateCache::program()
+{
+	if((m_known & KNOWN_PROGRAM) == 0)
+	{
+		GLint program = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		m_program = GLuint(program);
+		m_known |= KNOWN_PROGRAM;
+	}
+	return m_program;
+}
+
+bool GLStateCache::depthTest()
+{
+	if((m_known & KNOWN_DEPTH_TEST) == 0)
+	{
+		m_depth_test = glIsEnabled(GL_DEPTH_TEST) == GL_TRUE;
+		m_known |= KNOWN_DEPTH_TEST;
+	}
+	return m_depth_test;
+}
+
+void GLStateCache::invalidate()
+{
+	m_known = 0;
+	for(TextureBinding& binding : m_textures)
+	{
+		binding.known = false;
+	}
+}
+
+void GLStateCache::beginFrame()
+{
+	m_last_changes = m_changes;
+	m_last_filtered = m_filtered;
+	m_changes = 0;
+	m_filtered = 0;
+}
+
+void GLStateCache::drawGui()
+{
+	uint64_t total = m_last_changes + m_last_filtered;
+	ImGui::Text("State changes: %llu, %llu redundant filtered (%.0f%%)", (unsigned long long)m_last_changes,
+	            (unsigned long long)m_last_filtered, total > 0 ? 100.0 * double(m_last_filtered) / double(total) : 0.0);
+}
+
+GLStateCache& getGLState()
+{
+	static GLStateCache cache;
+	return cache;
+}
+} // namespace labhelper
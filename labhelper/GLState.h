@@ -0,0 +1,131 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Shadows the GL state that changes all the time during a frame and only
+/// forwards calls that actually change it: program, vertex array, texture
+/// bindings, draw framebuffer, depth/blend/cull/colour-mask switches and the
+/// viewport. It also answers queries about that state without the
+/// synchronous glGet* round trip.
+///
+/// The shadow is only right if every change of this state goes through the
+/// cache. Code that changes it directly (third party code, one-off setup)
+/// must call invalidate() afterwards; the next call of each kind is then
+/// forwarded unconditionally. ImGui restores everything it touches, so it
+/// needs no invalidate().
+///
+/// Usage:
+///	GLStateCache& gl = getGLState();
+///	gl.useProgram(program);
+///	gl.bindTexture(6, GL_TEXTURE_2D, environmentMap);
+///	gl.setDepthTest(false);
+///////////////////////////////////////////////////////////////////////////
+class GLStateCache
+{
+public:
+	static const int MAX_TEXTURE_UNITS = 32;
+
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	// Binds to `unit`, leaves the active texture at `unit`
+	void bindTexture(GLuint unit, GLenum target, GLuint texture);
+	// Binds to the currently active unit, e.g. to upload to a texture
+	void bindTexture(GLenum target, GLuint texture);
+	void activeTexture(GLuint unit);
+	// As glBindFramebuffer(GL_FRAMEBUFFER, ...), i.e. draw and read
+	void bindFramebuffer(GLuint framebuffer);
+	void setViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+	void setDepthTest(bool enable);
+	void setDepthWrite(bool enable);
+	void setDepthFunc(GLenum func);
+	void setBlend(bool enable);
+	void setBlendFunc(GLenum src, GLenum dst);
+	void setCullFace(bool enable);
+	void setColorWrite(bool enable);
+
+	///////////////////////////////////////////////////////////////////////
+	/// Deleting a bound object unbinds it, and GL may hand out its name
+	/// again. Delete textures and framebuffers through these so the shadow
+	/// does not keep a stale binding that would filter out a real one.
+	///////////////////////////////////////////////////////////////////////
+	void deleteTextures(GLsizei n, const GLuint* textures);
+	void deleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+
+	// Current values; queried from GL (and then known) if not known yet
+	GLuint program();
+	bool depthTest();
+
+	// Forgets everything, call after changing state behind the cache's back
+	void invalidate();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Starts counting a new frame. lastFrameChanges() and
+	/// lastFrameFiltered() then hold the counts of the frame before.
+	///////////////////////////////////////////////////////////////////////
+	void beginFrame();
+	uint64_t lastFrameChanges() const { return m_last_changes; }
+	uint64_t lastFrameFiltered() const { return m_last_filtered; }
+
+	void drawGui();
+
+private:
+	// One bit per piece of state, set when the shadow is known to be right
+	enum Known : uint32_t
+	{
+		KNOWN_PROGRAM = 1 << 0,
+		KNOWN_VAO = 1 << 1,
+		KNOWN_ACTIVE_TEXTURE = 1 << 2,
+		KNOWN_FRAMEBUFFER = 1 << 3,
+		KNOWN_VIEWPORT = 1 << 4,
+		KNOWN_DEPTH_TEST = 1 << 5,
+		KNOWN_DEPTH_WRITE = 1 << 6,
+		KNOWN_DEPTH_FUNC = 1 << 7,
+		KNOWN_BLEND = 1 << 8,
+		KNOWN_BLEND_FUNC = 1 << 9,
+		KNOWN_CULL_FACE = 1 << 10,
+		KNOWN_COLOR_WRITE = 1 << 11,
+	};
+
+	// True if the call must be forwarded, and counts it either way
+	bool change(uint32_t known);
+	void setCapability(GLenum cap, bool enable, bool& shadow, uint32_t known);
+
+	uint32_t m_known = 0;
+	GLuint m_program = 0;
+	GLuint m_vao = 0;
+	GLuint m_active_texture = 0;
+	struct TextureBinding
+	{
+		GLenum target;
+		GLuint texture;
+		bool known;
+	};
+	TextureBinding m_textures[MAX_TEXTURE_UNITS] = {};
+	GLuint m_framebuffer = 0;
+	GLint m_viewport[4] = {};
+	bool m_depth_test = false;
+	bool m_depth_write = true;
+	GLenum m_depth_func = GL_LESS;
+	bool m_blend = false;
+	GLenum m_blend_src = GL_ONE;
+	GLenum m_blend_dst = GL_ZERO;
+	bool m_cull_face = false;
+	bool m_color_write = true;
+
+	uint64_t m_changes = 0;
+	uint64_t m_filtered = 0;
+	uint64_t m_last_changes = 0;
+	uint64_t m_last_filtered = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// The cache for the (single) GL context
+///////////////////////////////////////////////////////////////////////////
+GLStateCache& getGLState();
+} // namespace labhelper
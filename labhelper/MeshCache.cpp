@@ -0,0 +1,443 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "MeshCache.h"
+#include "Model.h"
+#include "labhelper.h"
+#include "Trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+// MappedFile
+///////////////////////////////////////////////////////////////////////////
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const std::string& filename)
+{
+	close();
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                          FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+	m_file = file;
+	m_mapping = mapping;
+	m_data = (const uint8_t*)data;
+	m_size = size_t(size.QuadPart);
+#else
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file alive
+	::close(fd);
+	if(data == MAP_FAILED)
+	{
+		return false;
+	}
+	m_data = (const uint8_t*)data;
+	m_size = size_t(info.st_size);
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if(m_data == nullptr)
+	{
+		return;
+	}
+#if defined(_WIN32)
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	munmap((void*)m_data, m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+namespace
+{
+	const char MAGIC[4] = { 'L', 'H', 'M', 'C' };
+	const size_t ARRAY_ALIGNMENT = 16;
+
+	enum Source
+	{
+		SOURCE_OBJ = 0,
+		SOURCE_MTL,
+		NUMBER_OF_SOURCES
+	};
+
+	// A missing source is all zeros. The time is in nanoseconds where the OS has them.
+	struct SourceStamp
+	{
+		uint64_t size;
+		int64_t mtime;
+		uint64_t hash;
+	};
+
+	struct CacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		SourceStamp sources[NUMBER_OF_SOURCES];
+		uint32_t number_of_vertices;
+		uint32_t number_of_indices;
+		uint32_t number_of_meshes;
+		uint32_t number_of_materials;
+		uint64_t tables_offset;
+		uint64_t positions_offset;
+		uint64_t normals_offset;
+		uint64_t texture_coordinates_offset;
+		uint64_t indices_offset;
+		uint64_t file_size;
+	};
+
+	std::string sourcePath(const std::string& obj_path, Source source)
+	{
+		return source == SOURCE_OBJ ? obj_path : file::change_extension(obj_path, ".mtl");
+	}
+
+	// FNV-1a
+	uint64_t hashFile(const std::string& filename)
+	{
+		TRACE_FUNCTION();
+		uint64_t hash = 14695981039346656037ull;
+		MappedFile file;
+		if(!file.open(filename))
+		{
+			return hash;
+		}
+		for(size_t i = 0; i < file.size(); i++)
+		{
+			hash = (hash ^ file.data()[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	SourceStamp stampOf(const std::string& filename)
+	{
+		SourceStamp stamp = {};
+		struct stat info;
+		if(stat(filename.c_str(), &info) == 0)
+		{
+			stamp.size = uint64_t(info.st_size);
+#if defined(__APPLE__)
+			stamp.mtime = int64_t(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+			stamp.mtime = int64_t(info.st_mtime) * 1000000000;
+#else
+			stamp.mtime = int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+		}
+		return stamp;
+	}
+
+	bool isCurrent(const std::string& filename, const SourceStamp& recorded)
+	{
+		SourceStamp current = stampOf(filename);
+		if(current.size != recorded.size)
+		{
+			return false;
+		}
+		if(current.mtime == recorded.mtime)
+		{
+			return true;
+		}
+		return current.size == 0 || hashFile(filename) == recorded.hash;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// The mesh and material tables, strings prefixed by their length
+	///////////////////////////////////////////////////////////////////////
+	class TableWriter
+	{
+	public:
+		template<typename T>
+		void put(const T& value)
+		{
+			m_bytes.append((const char*)&value, sizeof(T));
+		}
+		void putString(const std::string& value)
+		{
+			put(uint32_t(value.size()));
+			m_bytes.append(value);
+		}
+		const std::string& bytes() const { return m_bytes; }
+
+	private:
+		std::string m_bytes;
+	};
+
+	class TableReader
+	{
+	public:
+		TableReader(const uint8_t* begin, const uint8_t* end) : m_cursor(begin), m_end(end) {}
+
+		template<typename T>
+		bool get(T& value)
+		{
+			if(size_t(m_end - m_cursor) < sizeof(T))
+			{
+				return false;
+			}
+			std::memcpy(&value, m_cursor, sizeof(T));
+			m_cursor += sizeof(T);
+			return true;
+		}
+		bool getString(std::string& value)
+		{
+			uint32_t length;
+			if(!get(length) || size_t(m_end - m_cursor) < length)
+			{
+				return false;
+			}
+			value.assign((const char*)m_cursor, length);
+			m_cursor += length;
+			return true;
+		}
+
+	private:
+		const uint8_t* m_cursor;
+		const uint8_t* m_end;
+	};
+
+	Texture Material::*const MATERIAL_TEXTURES[] = { &Material::m_color_texture, &Material::m_shininess_texture,
+		                                              &Material::m_metalness_texture, &Material::m_fresnel_texture,
+		                                              &Material::m_emission_texture };
+
+	uint64_t align(uint64_t offset)
+	{
+		return (offset + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT;
+	}
+
+	bool inFile(uint64_t offset, uint64_t bytes, uint64_t file_size)
+	{
+		return offset % ARRAY_ALIGNMENT == 0 && offset <= file_size && bytes <= file_size - offset;
+	}
+} // namespace
+
+std::string modelCachePath(const std::string& obj_path)
+{
+	return obj_path + ".cache";
+}
+
+bool readModelCache(const std::string& obj_path, MappedFile& file, Model* model, ModelGeometry* geometry)
+{
+	TRACE_FUNCTION();
+	if(!file.open(modelCachePath(obj_path)) || file.size() < sizeof(CacheHeader))
+	{
+		return false;
+	}
+	CacheHeader header;
+	std::memcpy(&header, file.data(), sizeof(header));
+	if(std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != MODEL_CACHE_VERSION
+	   || header.file_size != file.size())
+	{
+		return false;
+	}
+	for(int s = 0; s < NUMBER_OF_SOURCES; s++)
+	{
+		if(!isCurrent(sourcePath(obj_path, Source(s)), header.sources[s]))
+		{
+			return false;
+		}
+	}
+
+	const uint64_t n = header.number_of_vertices;
+	if(!inFile(header.positions_offset, n * sizeof(glm::vec3), file.size())
+	   || !inFile(header.normals_offset, n * sizeof(glm::vec3), file.size())
+	   || !inFile(header.texture_coordinates_offset, n * sizeof(glm::vec2), file.size())
+	   || !inFile(header.indices_offset, uint64_t(header.number_of_indices) * sizeof(uint32_t), file.size())
+	   || header.tables_offset > header.positions_offset)
+	{
+		return false;
+	}
+
+	TableReader reader(file.data() + header.tables_offset, file.data() + header.positions_offset);
+	model->m_materials.resize(header.number_of_materials);
+	for(Material& material : model->m_materials)
+	{
+		bool ok = reader.getString(material.m_name) && reader.get(material.m_color)
+		          && reader.get(material.m_shininess) && reader.get(material.m_metalness)
+		          && reader.get(material.m_fresnel) && reader.get(material.m_emission)
+		          && reader.get(material.m_transparency) && reader.get(material.m_ior);
+		for(Texture Material::*texture : MATERIAL_TEXTURES)
+		{
+			ok = ok && reader.getString((material.*texture).filename);
+		}
+		if(!ok)
+		{
+			model->m_materials.clear();
+			return false;
+		}
+	}
+	model->m_meshes.resize(header.number_of_meshes);
+	for(Mesh& mesh : model->m_meshes)
+	{
+		if(!reader.getString(mesh.m_name) || !reader.get(mesh.m_material_idx) || !reader.get(mesh.m_start_index)
+		   || !reader.get(mesh.m_number_of_indices) || !reader.get(mesh.m_start_vertex)
+		   || !reader.get(mesh.m_number_of_vertices) || mesh.m_material_idx >= header.number_of_materials
+		   || uint64_t(mesh.m_start_index) + mesh.m_number_of_indices > header.number_of_indices
+		   || uint64_t(mesh.m_start_vertex) + mesh.m_number_of_vertices > n)
+		{
+			model->m_materials.clear();
+			model->m_meshes.clear();
+			return false;
+		}
+	}
+
+	geometry->number_of_vertices = header.number_of_vertices;
+	geometry->positions = (const glm::vec3*)(file.data() + header.positions_offset);
+	geometry->normals = (const glm::vec3*)(file.data() + header.normals_offset);
+	geometry->texture_coordinates = (const glm::vec2*)(file.data() + header.texture_coordinates_offset);
+	geometry->number_of_indices = header.number_of_indices;
+	geometry->indices = (const uint32_t*)(file.data() + header.indices_offset);
+	return true;
+}
+
+bool writeModelCache(const std::string& obj_path, const Model* model)
+{
+	TRACE_FUNCTION();
+	TableWriter tables;
+	for(const Material& material : model->m_materials)
+	{
+		tables.putString(material.m_name);
+		tables.put(material.m_color);
+		tables.put(material.m_shininess);
+		tables.put(material.m_metalness);
+		tables.put(material.m_fresnel);
+		tables.put(material.m_emission);
+		tables.put(material.m_transparency);
+		tables.put(material.m_ior);
+		for(Texture Material::*texture : MATERIAL_TEXTURES)
+		{
+			tables.putString((material.*texture).filename);
+		}
+	}
+	for(const Mesh& mesh : model->m_meshes)
+	{
+		tables.putString(mesh.m_name);
+		tables.put(mesh.m_material_idx);
+		tables.put(mesh.m_start_index);
+		tables.put(mesh.m_number_of_indices);
+		tables.put(mesh.m_start_vertex);
+		tables.put(mesh.m_number_of_vertices);
+	}
+
+	const uint64_t n = model->m_positions.size();
+	CacheHeader header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = MODEL_CACHE_VERSION;
+	for(int s = 0; s < NUMBER_OF_SOURCES; s++)
+	{
+		std::string source = sourcePath(obj_path, Source(s));
+		header.sources[s] = stampOf(source);
+		if(header.sources[s].size != 0)
+		{
+			header.sources[s].hash = hashFile(source);
+		}
+	}
+	header.number_of_vertices = uint32_t(n);
+	header.number_of_indices = uint32_t(model->m_indices.size());
+	header.number_of_meshes = uint32_t(model->m_meshes.size());
+	header.number_of_materials = uint32_t(model->m_materials.size());
+	header.tables_offset = sizeof(CacheHeader);
+	header.positions_offset = align(header.tables_offset + tables.bytes().size());
+	header.normals_offset = align(header.positions_offset + n * sizeof(glm::vec3));
+	header.texture_coordinates_offset = align(header.normals_offset + n * sizeof(glm::vec3));
+	header.indices_offset = align(header.texture_coordinates_offset + n * sizeof(glm::vec2));
+	header.file_size = header.indices_offset + model->m_indices.size() * sizeof(uint32_t);
+
+	// Written aside and renamed, so a crash never leaves a truncated cache behind
+	const std::string cache_path = modelCachePath(obj_path);
+	const std::string temp_path = cache_path + ".tmp";
+	{
+		std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+		if(!out.is_open())
+		{
+			std::cout << "Could not write model cache " << cache_path << "\n";
+			return false;
+		}
+		const char padding[ARRAY_ALIGNMENT] = {};
+		auto pad_to = [&](uint64_t offset) { out.write(padding, std::streamsize(offset - uint64_t(out.tellp()))); };
+		out.write((const char*)&header, sizeof(header));
+		out.write(tables.bytes().data(), std::streamsize(tables.bytes().size()));
+		pad_to(header.positions_offset);
+		out.write((const char*)model->m_positions.data(), std::streamsize(n * sizeof(glm::vec3)));
+		pad_to(header.normals_offset);
+		out.write((const char*)model->m_normals.data(), std::streamsize(n * sizeof(glm::vec3)));
+		pad_to(header.texture_coordinates_offset);
+		out.write((const char*)model->m_texture_coordinates.data(), std::streamsize(n * sizeof(glm::vec2)));
+		pad_to(header.indices_offset);
+		out.write((const char*)model->m_indices.data(),
+		          std::streamsize(model->m_indices.size() * sizeof(uint32_t)));
+		if(!out.good())
+		{
+			std::cout << "Could not write model cache " << cache_path << "\n";
+			out.close();
+			std::remove(temp_path.c_str());
+			return false;
+		}
+	}
+	std::remove(cache_path.c_str());
+	if(std::rename(temp_path.c_str(), cache_path.c_str()) != 0)
+	{
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+} // namespace labhelper
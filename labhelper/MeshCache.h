@@ -0,0 +1,86 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace labhelper
+{
+class Model;
+
+///////////////////////////////////////////////////////////////////////////
+/// A file mapped read-only into memory. The pages are read by the OS on
+/// first access, so mapping a file costs nothing until it is touched.
+///////////////////////////////////////////////////////////////////////////
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	// Maps the whole file, false if it is missing, empty or can't be mapped
+	bool open(const std::string& filename);
+	void close();
+
+	const uint8_t* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+private:
+	const uint8_t* m_data = nullptr;
+	size_t m_size = 0;
+#if defined(_WIN32)
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Vertex arrays of a model, pointing into its mapped cache or its vectors,
+/// see Model::m_geometry
+///////////////////////////////////////////////////////////////////////////
+struct ModelGeometry
+{
+	uint32_t number_of_vertices = 0;
+	const glm::vec3* positions = nullptr;
+	const glm::vec3* normals = nullptr;
+	const glm::vec2* texture_coordinates = nullptr;
+	uint32_t number_of_indices = 0;
+	const uint32_t* indices = nullptr;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Binary cache of a loaded OBJ, written next to it as "<name>.obj.cache".
+///
+/// It holds the final vertex streams and indices, the meshes and the
+/// material table, so loading it skips parsing, normal generation,
+/// material splitting, welding and the reordering by MeshOptimizer. The
+/// vertex streams and indices are 16 byte aligned in the file and go from
+/// the mapping straight to glBufferData.
+///
+/// A cache is used only if magic and version match and the OBJ and its
+/// same-named MTL have the size and modification time recorded in it. If
+/// just the time changed (a fresh checkout, a touch) the contents are
+/// hashed and compared instead. Bump MODEL_CACHE_VERSION whenever the
+/// layout or the processing of the loaded data changes.
+///////////////////////////////////////////////////////////////////////////
+const uint32_t MODEL_CACHE_VERSION = 6;
+
+std::string modelCachePath(const std::string& obj_path);
+
+///////////////////////////////////////////////////////////////////////////
+/// Maps the cache of `obj_path` into `file` and, if it is valid, fills in
+/// the name, meshes and materials of `model` and points `geometry` into the
+/// mapping. Texture filenames are set, but the textures are not loaded.
+///////////////////////////////////////////////////////////////////////////
+bool readModelCache(const std::string& obj_path, MappedFile& file, Model* model, ModelGeometry* geometry);
+
+///////////////////////////////////////////////////////////////////////////
+/// Writes the cache of a model just loaded from `obj_path`. Failing to
+/// write (e.g. a read-only directory) only means the next load parses again.
+///////////////////////////////////////////////////////////////////////////
+bool writeModelCache(const std::string& obj_path, const Model* model);
+} // namespace labhelper
@@ -0,0 +1,249 @@
+#include "MeshOptimizer.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+namespace labhelper
+{
+VertexCacheStats& VertexCacheStats::operator+=(const VertexCacheStats& other)
+{
+	transformed += other.transformed;
+	triangles += other.triangles;
+	vertices += other.vertices;
+	return *this;
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t number_of_indices, size_t number_of_vertices)
+{
+	VertexCacheStats stats;
+	stats.triangles = number_of_indices / 3;
+	stats.vertices = number_of_vertices;
+
+	// A vertex is cached if fewer than VERTEX_CACHE_SIZE misses happened since its own
+	std::vector<uint32_t> cache_time(number_of_vertices, 0);
+	uint32_t time = VERTEX_CACHE_SIZE + 1;
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		uint32_t v = indices[i];
+		if(time - cache_time[v] > uint32_t(VERTEX_CACHE_SIZE))
+		{
+			cache_time[v] = time++;
+			stats.transformed++;
+		}
+	}
+	return stats;
+}
+
+std::vector<uint32_t> optimizeVertexCache(uint32_t* indices, size_t number_of_indices, size_t number_of_vertices)
+{
+	TRACE_FUNCTION();
+	const uint32_t k = VERTEX_CACHE_SIZE;
+	const size_t number_of_triangles = number_of_indices / 3;
+
+	// Triangles around every vertex, and how many of them are not emitted yet
+	std::vector<uint32_t> live(number_of_vertices, 0);
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		live[indices[i]]++;
+	}
+	std::vector<uint32_t> first_triangle(number_of_vertices + 1, 0);
+	for(size_t v = 0; v < number_of_vertices; v++)
+	{
+		first_triangle[v + 1] = first_triangle[v] + live[v];
+	}
+	std::vector<uint32_t> adjacency(number_of_indices);
+	{
+		std::vector<uint32_t> fill(first_triangle.begin(), first_triangle.end() - 1);
+		for(size_t i = 0; i < number_of_indices; i++)
+		{
+			adjacency[fill[indices[i]]++] = uint32_t(i / 3);
+		}
+	}
+
+	std::vector<uint32_t> cache_time(number_of_vertices, 0);
+	std::vector<bool> emitted(number_of_triangles, false);
+	std::vector<uint32_t> dead_ends;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(number_of_indices);
+	std::vector<uint32_t> clusters;
+
+	uint32_t time = k + 1;
+	size_t cursor = 0;
+	// A vertex with triangles left: recently emitted ones first, then in input order
+	auto skip_dead_end = [&]() -> int64_t {
+		while(!dead_ends.empty())
+		{
+			uint32_t d = dead_ends.back();
+			dead_ends.pop_back();
+			if(live[d] > 0)
+			{
+				return d;
+			}
+		}
+		for(; cursor < number_of_vertices; cursor++)
+		{
+			if(live[cursor] > 0)
+			{
+				return int64_t(cursor);
+			}
+		}
+		return -1;
+	};
+
+	int64_t fan = skip_dead_end();
+	bool restart = true;
+	while(fan >= 0)
+	{
+		if(restart)
+		{
+			clusters.push_back(uint32_t(output.size() / 3));
+		}
+		candidates.clear();
+		for(uint32_t a = first_triangle[fan]; a < first_triangle[fan + 1]; a++)
+		{
+			uint32_t t = adjacency[a];
+			if(emitted[t])
+			{
+				continue;
+			}
+			for(int j = 0; j < 3; j++)
+			{
+				uint32_t v = indices[t * 3 + j];
+				output.push_back(v);
+				dead_ends.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if(time - cache_time[v] > k)
+				{
+					cache_time[v] = time++;
+				}
+			}
+			emitted[t] = true;
+		}
+
+		// The candidate that stays in the cache while all its triangles are fanned, oldest first
+		int64_t next = -1;
+		int64_t best = -1;
+		for(uint32_t v : candidates)
+		{
+			if(live[v] == 0)
+			{
+				continue;
+			}
+			int64_t priority = 0;
+			if(time - cache_time[v] + 2 * live[v] <= k)
+			{
+				priority = time - cache_time[v];
+			}
+			if(priority > best)
+			{
+				best = priority;
+				next = v;
+			}
+		}
+		if(next < 0)
+		{
+			next = skip_dead_end();
+		}
+		restart = next >= 0 && time - cache_time[next] > k;
+		fan = next;
+	}
+
+	std::copy(output.begin(), output.end(), indices);
+	return clusters;
+}
+
+void optimizeOverdraw(uint32_t* indices,
+                      size_t number_of_indices,
+                      const glm::vec3* positions,
+                      const std::vector<uint32_t>& clusters)
+{
+	TRACE_FUNCTION();
+	const size_t number_of_triangles = number_of_indices / 3;
+	if(clusters.size() < 2)
+	{
+		return;
+	}
+
+	// Area weighted centroids and normals, of the mesh and of each cluster
+	struct Cluster
+	{
+		uint32_t begin, end;
+		glm::vec3 centroid;
+		glm::vec3 normal;
+		float sort_key;
+	};
+	std::vector<Cluster> sorted(clusters.size());
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for(size_t c = 0; c < clusters.size(); c++)
+	{
+		Cluster& cluster = sorted[c];
+		cluster.begin = clusters[c];
+		cluster.end = c + 1 < clusters.size() ? clusters[c + 1] : uint32_t(number_of_triangles);
+		cluster.centroid = glm::vec3(0.0f);
+		cluster.normal = glm::vec3(0.0f);
+		float area = 0.0f;
+		for(uint32_t t = cluster.begin; t < cluster.end; t++)
+		{
+			const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+			const glm::vec3& p1 = positions[indices[t * 3 + 1]];
+			const glm::vec3& p2 = positions[indices[t * 3 + 2]];
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			cluster.centroid += a * (p0 + p1 + p2) / 3.0f;
+			cluster.normal += n;
+			area += a;
+		}
+		mesh_centroid += cluster.centroid;
+		mesh_area += area;
+		cluster.centroid = area > 0.0f ? cluster.centroid / area : positions[indices[cluster.begin * 3]];
+	}
+	if(mesh_area > 0.0f)
+	{
+		mesh_centroid /= mesh_area;
+	}
+	for(Cluster& cluster : sorted)
+	{
+		float length = glm::length(cluster.normal);
+		cluster.sort_key = length > 0.0f ? glm::dot(cluster.centroid - mesh_centroid, cluster.normal / length) : 0.0f;
+	}
+	std::stable_sort(sorted.begin(), sorted.end(),
+	                 [](const Cluster& a, const Cluster& b) { return a.sort_key > b.sort_key; });
+
+	std::vector<uint32_t> output;
+	output.reserve(number_of_indices);
+	for(const Cluster& cluster : sorted)
+	{
+		output.insert(output.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+	}
+	std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(uint32_t* indices, size_t number_of_indices, size_t number_of_vertices)
+{
+	TRACE_FUNCTION();
+	const uint32_t unused = ~0u;
+	std::vector<uint32_t> remap(number_of_vertices, unused);
+	uint32_t next = 0;
+	for(size_t i = 0; i < number_of_indices; i++)
+	{
+		uint32_t& v = remap[indices[i]];
+		if(v == unused)
+		{
+			v = next++;
+		}
+		indices[i] = v;
+	}
+	// Vertices no triangle uses go last
+	for(uint32_t& v : remap)
+	{
+		if(v == unused)
+		{
+			v = next++;
+		}
+	}
+	return remap;
+}
+} // namespace labhelper
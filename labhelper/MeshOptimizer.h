@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Reordering of indexed triangle lists for the GPU, applied to every mesh
+/// when a model is loaded from its OBJ (the model cache stores the result).
+///
+/// All functions work on one mesh whose indices refer to the vertices
+/// 0 to number_of_vertices - 1.
+///////////////////////////////////////////////////////////////////////////
+
+// Entries of the simulated post-transform (FIFO) cache
+const int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats
+{
+	// Cache misses, i.e. vertex shader invocations
+	size_t transformed = 0;
+	size_t triangles = 0;
+	size_t vertices = 0;
+
+	// Average cache miss ratio, transformed vertices per triangle (0.5 to 3)
+	float acmr() const { return triangles > 0 ? float(transformed) / float(triangles) : 0.0f; }
+	// Average transformed to vertex ratio, 1 is ideal
+	float atvr() const { return vertices > 0 ? float(transformed) / float(vertices) : 0.0f; }
+	VertexCacheStats& operator+=(const VertexCacheStats& other);
+};
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t number_of_indices, size_t number_of_vertices);
+
+///////////////////////////////////////////////////////////////////////////
+/// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for
+/// Vertex Locality and Reduced Overdraw", 2007): fans around one vertex at
+/// a time and picks the next vertex among those still in the cache.
+/// Returns the first triangle of every cluster, i.e. every place where the
+/// order restarts from a vertex that is no longer cached. Clusters can be
+/// reordered freely without hurting the cache much.
+///////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> optimizeVertexCache(uint32_t* indices, size_t number_of_indices, size_t number_of_vertices);
+
+///////////////////////////////////////////////////////////////////////////
+/// Sorts the clusters from optimizeVertexCache() so those facing away from
+/// the mesh' centre come first. They tend to occlude the others from most
+/// view directions, so fewer hidden fragments get shaded.
+///////////////////////////////////////////////////////////////////////////
+void optimizeOverdraw(uint32_t* indices,
+                      size_t number_of_indices,
+                      const glm::vec3* positions,
+                      const std::vector<uint32_t>& clusters);
+
+///////////////////////////////////////////////////////////////////////////
+/// Renumbers the vertices in the order the indices first use them, so
+/// vertex fetches walk through memory. Returns the new position of every
+/// old vertex; the caller moves the vertex attributes accordingly.
+///////////////////////////////////////////////////////////////////////////
+std::vector<uint32_t> optimizeVertexFetch(uint32_t* indices, size_t number_of_indices, size_t number_of_vertices);
+} // namespace labhelper
@@ -1,79 +1,47 @@
 #include "Model.h"
 #include "labhelper.h"
+#include "ShaderProgram.h"
+#include "GLState.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "ObjParser.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include <iostream>
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include <tiny_obj_loader.h>
 //#include <experimental/tinyobj_loader_opt.h>
 #include <algorithm>
+#include <array>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <limits>
+#include <cstddef>
 #include <sstream>
 #include <iomanip>
 #include <GL/glew.h>
+#include <glm/gtc/packing.hpp>
 #include <stb_image.h>
 
 namespace labhelper
 {
 void Texture::free()
 {
-	if(data)
+	if(valid)
 	{
-		stbi_image_free(data);
-		data = nullptr;
-	}
-	if(gl_id_internal)
-	{
-		glDeleteTextures(1, &gl_id_internal);
-		gl_id_internal = 0;
+		getTextureCache().release(*this);
 	}
+	valid = false;
+	data = nullptr;
+	gl_id_internal = 0;
+	gl_id = 0;
 }
 
 bool Texture::load(const std::string& _directory, const std::string& _filename, int _components)
 {
-	filename = file::normalise(_filename);
-	directory = file::normalise(_directory);
-	valid = true;
-	int components;
-	data = stbi_load((directory + filename).c_str(), &width, &height, &components, _components);
-	if(data == nullptr)
-	{
-		std::cout << "ERROR: loadModelFromOBJ(): Failed to load texture: " << filename << " in " << directory
-		          << "\n";
-		exit(1);
-	}
-	glGenTextures(1, &gl_id_internal);
-	gl_id = gl_id_internal;
-	glBindTexture(GL_TEXTURE_2D, gl_id_internal);
-	GLenum format, internal_format;
-	n_components = _components;
-	if(_components == 1)
-	{
-		format = GL_R;
-		internal_format = GL_R8;
-	}
-	else if(_components == 3)
-	{
-		format = GL_RGB;
-		internal_format = GL_RGB;
-	}
-	else if(_components == 4)
-	{
-		format = GL_RGBA;
-		internal_format = GL_RGBA;
-	}
-	else
-	{
-		std::cout << "Texture loading not implemented for this number of compenents.\n";
-		exit(1);
-	}
-	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	return true;
+	return getTextureCache().acquire(*this, _directory, _filename, _components);
 }
 
 glm::vec4 Texture::sample(glm::vec2 uv) const
@@ -116,11 +84,598 @@ Model::~Model()
 	glDeleteBuffers(1, &m_positions_bo);
 	glDeleteBuffers(1, &m_normals_bo);
 	glDeleteBuffers(1, &m_texture_coordinates_bo);
+	glDeleteBuffers(1, &m_indices_bo);
+	glDeleteBuffers(1, &m_packed_vertices_bo);
+	glDeleteBuffers(1, &m_materials_bo);
+}
+
+
+namespace
+{
+	// Faces or vertices per task when the loader splits work over the thread pool
+	const size_t LOADER_BATCH_SIZE = 16 * 1024;
+
+	// Runs body(begin, end) over batches of [0, count) on the thread pool
+	void parallelForBatches(size_t count, const std::function<void(size_t, size_t)>& body)
+	{
+		getThreadPool().parallelFor((count + LOADER_BATCH_SIZE - 1) / LOADER_BATCH_SIZE, [&](size_t batch) {
+			body(batch * LOADER_BATCH_SIZE, std::min(count, (batch + 1) * LOADER_BATCH_SIZE));
+		});
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Average of the normals of the faces around every position, used by
+	// vertices that have no normal in the file. The face normals are
+	// computed in parallel, then every position sums those of its faces,
+	// which a counting sort of the corners lists in face order. So there
+	// are no scattered writes to share between threads, and the sums are
+	// the same as adding each face to its three corners one after another.
+	///////////////////////////////////////////////////////////////////////
+	std::vector<glm::vec3> generateNormals(const tinyobj::attrib_t& attrib,
+	                                       const std::vector<tinyobj::shape_t>& shapes)
+	{
+		TRACE_FUNCTION();
+		std::vector<size_t> first_corner_of_shape(shapes.size() + 1, 0);
+		for(size_t s = 0; s < shapes.size(); s++)
+		{
+			first_corner_of_shape[s + 1] = first_corner_of_shape[s] + shapes[s].mesh.indices.size();
+		}
+		const size_t number_of_corners = first_corner_of_shape.back();
+		const size_t number_of_faces = number_of_corners / 3;
+		std::vector<uint32_t> corner_positions(number_of_corners);
+		getThreadPool().parallelFor(shapes.size(), [&](size_t s) {
+			const auto& indices = shapes[s].mesh.indices;
+			for(size_t i = 0; i < indices.size(); i++)
+			{
+				corner_positions[first_corner_of_shape[s] + i] = uint32_t(indices[i].vertex_index);
+			}
+		});
+
+		std::vector<glm::vec3> face_normals(number_of_faces);
+		parallelForBatches(number_of_faces, [&](size_t begin, size_t end) {
+			for(size_t face = begin; face < end; face++)
+			{
+				glm::vec3 v[3];
+				for(int j = 0; j < 3; j++)
+				{
+					const float* p = &attrib.vertices[corner_positions[face * 3 + j] * 3];
+					v[j] = glm::vec3(p[0], p[1], p[2]);
+				}
+				glm::vec3 e0 = glm::normalize(v[1] - v[0]);
+				glm::vec3 e1 = glm::normalize(v[2] - v[0]);
+				face_normals[face] = cross(e0, e1);
+			}
+		});
+
+		const size_t number_of_positions = attrib.vertices.size() / 3;
+		std::vector<uint32_t> first_face(number_of_positions + 1, 0);
+		for(uint32_t p : corner_positions)
+		{
+			first_face[p + 1]++;
+		}
+		for(size_t p = 0; p < number_of_positions; p++)
+		{
+			first_face[p + 1] += first_face[p];
+		}
+		std::vector<uint32_t> faces(number_of_corners);
+		{
+			std::vector<uint32_t> fill(first_face.begin(), first_face.end() - 1);
+			for(size_t c = 0; c < number_of_corners; c++)
+			{
+				faces[fill[corner_positions[c]]++] = uint32_t(c / 3);
+			}
+		}
+
+		std::vector<glm::vec3> normals(number_of_positions);
+		parallelForBatches(number_of_positions, [&](size_t begin, size_t end) {
+			for(size_t p = begin; p < end; p++)
+			{
+				glm::vec4 normal(0.0f);
+				for(uint32_t f = first_face[p]; f < first_face[p + 1]; f++)
+				{
+					normal += glm::vec4(face_normals[faces[f]], 1.0f);
+				}
+				normals[p] = glm::vec3((1.0f / normal.w) * normal);
+			}
+		});
+		return normals;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// A vertex as generated from the OBJ, compared bit by bit
+	///////////////////////////////////////////////////////////////////////
+	struct WeldVertex
+	{
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 texture_coordinate;
+
+		bool operator==(const WeldVertex& other) const { return std::memcmp(this, &other, sizeof(WeldVertex)) == 0; }
+	};
+
+	struct WeldVertexHash
+	{
+		size_t operator()(const WeldVertex& vertex) const
+		{
+			// FNV-1a over the bits
+			const uint8_t* bytes = (const uint8_t*)&vertex;
+			uint64_t hash = 14695981039346656037ull;
+			for(size_t i = 0; i < sizeof(WeldVertex); i++)
+			{
+				hash = (hash ^ bytes[i]) * 1099511628211ull;
+			}
+			return size_t(hash);
+		}
+	};
+
+	///////////////////////////////////////////////////////////////////////
+	// Turns the flat stream of three vertices per triangle into unique
+	// vertices and an index buffer. Welds within each mesh only, so every
+	// mesh keeps a contiguous range of vertices.
+	///////////////////////////////////////////////////////////////////////
+	void weldVertices(Model* model)
+	{
+		TRACE_FUNCTION();
+		std::vector<glm::vec3> positions, normals;
+		std::vector<glm::vec2> texture_coordinates;
+		positions.reserve(model->m_positions.size());
+		normals.reserve(model->m_normals.size());
+		texture_coordinates.reserve(model->m_texture_coordinates.size());
+		model->m_indices.clear();
+		model->m_indices.reserve(model->m_positions.size());
+
+		std::unordered_map<WeldVertex, uint32_t, WeldVertexHash> unique;
+		for(auto& mesh : model->m_meshes)
+		{
+			unique.clear();
+			unique.reserve(mesh.m_number_of_vertices);
+			const uint32_t start_vertex = uint32_t(positions.size());
+			mesh.m_start_index = uint32_t(model->m_indices.size());
+			mesh.m_number_of_indices = mesh.m_number_of_vertices;
+			for(uint32_t i = mesh.m_start_vertex; i < mesh.m_start_vertex + mesh.m_number_of_vertices; i++)
+			{
+				const WeldVertex vertex = { model->m_positions[i], model->m_normals[i],
+					                        model->m_texture_coordinates[i] };
+				auto inserted = unique.insert(std::make_pair(vertex, uint32_t(positions.size())));
+				if(inserted.second)
+				{
+					positions.push_back(vertex.position);
+					normals.push_back(vertex.normal);
+					texture_coordinates.push_back(vertex.texture_coordinate);
+				}
+				model->m_indices.push_back(inserted.first->second);
+			}
+			mesh.m_start_vertex = start_vertex;
+			mesh.m_number_of_vertices = uint32_t(positions.size()) - start_vertex;
+		}
+		model->m_positions.swap(positions);
+		model->m_normals.swap(normals);
+		model->m_texture_coordinates.swap(texture_coordinates);
+	}
+
+	// Moves element v of `attribute` to remap[v]
+	template<typename T>
+	void permute(T* attribute, const std::vector<uint32_t>& remap)
+	{
+		std::vector<T> old(attribute, attribute + remap.size());
+		for(size_t v = 0; v < remap.size(); v++)
+		{
+			attribute[remap[v]] = old[v];
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Reorders the triangles of every mesh for the post-transform cache,
+	// then its clusters for less overdraw, then its vertices in the order
+	// the triangles use them. Adds up the cache statistics before and after.
+	///////////////////////////////////////////////////////////////////////
+	void optimizeMeshes(Model* model, VertexCacheStats& before, VertexCacheStats& after)
+	{
+		TRACE_FUNCTION();
+		for(auto& mesh : model->m_meshes)
+		{
+			uint32_t* indices = model->m_indices.data() + mesh.m_start_index;
+			const size_t number_of_indices = mesh.m_number_of_indices;
+			const size_t number_of_vertices = mesh.m_number_of_vertices;
+			for(size_t i = 0; i < number_of_indices; i++)
+			{
+				indices[i] -= mesh.m_start_vertex;
+			}
+			before += analyzeVertexCache(indices, number_of_indices, number_of_vertices);
+
+			std::vector<uint32_t> clusters = optimizeVertexCache(indices, number_of_indices, number_of_vertices);
+			optimizeOverdraw(indices, number_of_indices, &model->m_positions[mesh.m_start_vertex], clusters);
+			std::vector<uint32_t> remap = optimizeVertexFetch(indices, number_of_indices, number_of_vertices);
+
+			permute(&model->m_positions[mesh.m_start_vertex], remap);
+			permute(&model->m_normals[mesh.m_start_vertex], remap);
+			permute(&model->m_texture_coordinates[mesh.m_start_vertex], remap);
+
+			after += analyzeVertexCache(indices, number_of_indices, number_of_vertices);
+			for(size_t i = 0; i < number_of_indices; i++)
+			{
+				indices[i] += mesh.m_start_vertex;
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Orders the meshes, and their ranges of the index buffer, so meshes
+	// with the same material follow each other and materials with the same
+	// textures do too. Done before the model is cached, so a model read
+	// from its cache is in this order already.
+	///////////////////////////////////////////////////////////////////////
+	void batchMeshesByMaterial(Model* model)
+	{
+		const std::vector<Material>& materials = model->m_materials;
+		std::vector<uint32_t> material_order(materials.size());
+		for(uint32_t i = 0; i < material_order.size(); i++)
+		{
+			material_order[i] = i;
+		}
+		std::stable_sort(material_order.begin(), material_order.end(), [&](uint32_t a, uint32_t b) {
+			const Material& x = materials[a];
+			const Material& y = materials[b];
+			if(x.m_color_texture.filename != y.m_color_texture.filename)
+			{
+				return x.m_color_texture.filename < y.m_color_texture.filename;
+			}
+			return x.m_emission_texture.filename < y.m_emission_texture.filename;
+		});
+		std::vector<uint32_t> rank(materials.size());
+		for(uint32_t i = 0; i < material_order.size(); i++)
+		{
+			rank[material_order[i]] = i;
+		}
+
+		std::vector<Mesh> meshes = model->m_meshes;
+		std::stable_sort(meshes.begin(), meshes.end(), [&](const Mesh& a, const Mesh& b) {
+			return rank[a.m_material_idx] < rank[b.m_material_idx];
+		});
+		std::vector<uint32_t> indices;
+		indices.reserve(model->m_indices.size());
+		for(Mesh& mesh : meshes)
+		{
+			const uint32_t* first = model->m_indices.data() + mesh.m_start_index;
+			mesh.m_start_index = uint32_t(indices.size());
+			indices.insert(indices.end(), first, first + mesh.m_number_of_indices);
+		}
+		model->m_meshes.swap(meshes);
+		model->m_indices.swap(indices);
+	}
+
+	// Records the runs of meshes with the same material, see batchMeshesByMaterial()
+	void recordBatches(Model* model)
+	{
+		model->m_batches.clear();
+		for(uint32_t i = 0; i < model->m_meshes.size(); i++)
+		{
+			const Mesh& mesh = model->m_meshes[i];
+			if(model->m_batches.empty() || model->m_batches.back().m_material_idx != mesh.m_material_idx)
+			{
+				MaterialBatch batch = { mesh.m_material_idx, i, 0, mesh.m_start_index, 0 };
+				model->m_batches.push_back(batch);
+			}
+			model->m_batches.back().m_number_of_meshes++;
+			model->m_batches.back().m_number_of_indices += mesh.m_number_of_indices;
+		}
+	}
+
+	void computeBounds(Model* model)
+	{
+		const glm::vec3* positions = model->m_geometry.positions;
+		for(auto& mesh : model->m_meshes)
+		{
+			mesh.m_bounds_min = glm::vec3(std::numeric_limits<float>::max());
+			mesh.m_bounds_max = glm::vec3(-std::numeric_limits<float>::max());
+			for(uint32_t i = mesh.m_start_vertex; i < mesh.m_start_vertex + mesh.m_number_of_vertices; i++)
+			{
+				mesh.m_bounds_min = glm::min(mesh.m_bounds_min, positions[i]);
+				mesh.m_bounds_max = glm::max(mesh.m_bounds_max, positions[i]);
+			}
+		}
+	}
+
+	static_assert(sizeof(PackedVertex) == 16, "PackedVertex must match the attribute offsets");
+
+	glm::vec2 octahedralEncode(glm::vec3 n)
+	{
+		n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		glm::vec2 e(n.x, n.y);
+		if(n.z < 0.0f)
+		{
+			e = (1.0f - glm::abs(glm::vec2(n.y, n.x)))
+			    * glm::vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.y >= 0.0f ? 1.0f : -1.0f);
+		}
+		return e;
+	}
+
+	glm::vec3 octahedralDecode(glm::vec2 e)
+	{
+		glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+		if(n.z < 0.0f)
+		{
+			n = glm::vec3((1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f),
+			              (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f), n.z);
+		}
+		return glm::normalize(n);
+	}
+
+	// Largest difference between the packed and the original vertices
+	struct PackingError
+	{
+		float position = 0.0f;
+		float normal_degrees = 0.0f;
+		float texture_coordinate = 0.0f;
+	};
+
+	std::vector<PackedVertex> packVertices(const Model* model, PackingError& error)
+	{
+		TRACE_FUNCTION();
+		const ModelGeometry& geometry = model->m_geometry;
+		const glm::vec3* positions = geometry.positions;
+		const glm::vec3* normals = geometry.normals;
+		const glm::vec2* texture_coordinates = geometry.texture_coordinates;
+		std::vector<PackedVertex> packed(geometry.number_of_vertices);
+		for(const auto& mesh : model->m_meshes)
+		{
+			const glm::vec3 extent = mesh.m_bounds_max - mesh.m_bounds_min;
+			for(uint32_t i = mesh.m_start_vertex; i < mesh.m_start_vertex + mesh.m_number_of_vertices; i++)
+			{
+				PackedVertex& vertex = packed[i];
+				glm::vec3 unit = glm::vec3(0.0f);
+				for(int c = 0; c < 3; c++)
+				{
+					unit[c] = extent[c] > 0.0f ? (positions[i][c] - mesh.m_bounds_min[c]) / extent[c] : 0.0f;
+					vertex.position[c] = glm::packUnorm1x16(unit[c]);
+					float decoded = mesh.m_bounds_min[c] + extent[c] * glm::unpackUnorm1x16(vertex.position[c]);
+					error.position = std::max(error.position, std::abs(decoded - positions[i][c]));
+				}
+				vertex.position[3] = 0;
+
+				glm::vec3 normal = glm::normalize(normals[i]);
+				glm::vec2 octahedral = octahedralEncode(normal);
+				for(int c = 0; c < 2; c++)
+				{
+					vertex.normal[c] = int16_t(glm::packSnorm1x16(octahedral[c]));
+				}
+				glm::vec3 decoded = octahedralDecode(glm::vec2(glm::unpackSnorm1x16(uint16_t(vertex.normal[0])),
+				                                               glm::unpackSnorm1x16(uint16_t(vertex.normal[1]))));
+				float angle = std::acos(glm::clamp(glm::dot(decoded, normal), -1.0f, 1.0f));
+				if(angle == angle) // Not NaN from a degenerate normal
+				{
+					error.normal_degrees = std::max(error.normal_degrees, glm::degrees(angle));
+				}
+
+				for(int c = 0; c < 2; c++)
+				{
+					vertex.texture_coordinate[c] = glm::packHalf1x16(texture_coordinates[i][c]);
+					float decoded_uv = glm::unpackHalf1x16(vertex.texture_coordinate[c]);
+					error.texture_coordinate =
+					    std::max(error.texture_coordinate, std::abs(decoded_uv - texture_coordinates[i][c]));
+				}
+			}
+		}
+		return packed;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Creates the vertex array and buffers of a model from its vertex
+	// streams, or from its packed vertices if it packs them
+	///////////////////////////////////////////////////////////////////////
+	void uploadGeometry(Model* model)
+	{
+		TRACE_FUNCTION();
+		const ModelGeometry& geometry = model->m_geometry;
+		const size_t number_of_vertices = geometry.number_of_vertices;
+		glGenVertexArrays(1, &model->m_vaob);
+		getGLState().bindVertexArray(model->m_vaob);
+		if(model->m_packed_vertices)
+		{
+			const std::vector<PackedVertex>& packed = model->m_packed_vertex_data;
+			const GLsizei stride = sizeof(PackedVertex);
+			glGenBuffers(1, &model->m_packed_vertices_bo);
+			glBindBuffer(GL_ARRAY_BUFFER, model->m_packed_vertices_bo);
+			glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, true, stride, (const void*)offsetof(PackedVertex, position));
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(1, 2, GL_SHORT, true, stride, (const void*)offsetof(PackedVertex, normal));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, false, stride,
+			                      (const void*)offsetof(PackedVertex, texture_coordinate));
+			glEnableVertexAttribArray(2);
+			std::vector<PackedVertex>().swap(model->m_packed_vertex_data);
+		}
+		else
+		{
+			glGenBuffers(1, &model->m_positions_bo);
+			glBindBuffer(GL_ARRAY_BUFFER, model->m_positions_bo);
+			glBufferData(GL_ARRAY_BUFFER, number_of_vertices * sizeof(glm::vec3), geometry.positions,
+			             GL_STATIC_DRAW);
+			glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);
+			glEnableVertexAttribArray(0);
+			glGenBuffers(1, &model->m_normals_bo);
+			glBindBuffer(GL_ARRAY_BUFFER, model->m_normals_bo);
+			glBufferData(GL_ARRAY_BUFFER, number_of_vertices * sizeof(glm::vec3), geometry.normals,
+			             GL_STATIC_DRAW);
+			glVertexAttribPointer(1, 3, GL_FLOAT, false, 0, 0);
+			glEnableVertexAttribArray(1);
+			glGenBuffers(1, &model->m_texture_coordinates_bo);
+			glBindBuffer(GL_ARRAY_BUFFER, model->m_texture_coordinates_bo);
+			glBufferData(GL_ARRAY_BUFFER, number_of_vertices * sizeof(glm::vec2), geometry.texture_coordinates,
+			             GL_STATIC_DRAW);
+			glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);
+			glEnableVertexAttribArray(2);
+		}
+		// Part of the vertex array's state, so not unbound below
+		glGenBuffers(1, &model->m_indices_bo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->m_indices_bo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, geometry.number_of_indices * sizeof(uint32_t), geometry.indices,
+		             GL_STATIC_DRAW);
+
+		getGLState().bindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Last step of both ways of reading a model, computes what the
+	// geometry upload needs and adds the packing error to the log
+	///////////////////////////////////////////////////////////////////////
+	void finishGeometry(Model* model, std::ostream& log)
+	{
+		if(!model->m_cache_file)
+		{
+			ModelGeometry& geometry = model->m_geometry;
+			geometry.number_of_vertices = uint32_t(model->m_positions.size());
+			geometry.positions = model->m_positions.data();
+			geometry.normals = model->m_normals.data();
+			geometry.texture_coordinates = model->m_texture_coordinates.data();
+			geometry.number_of_indices = uint32_t(model->m_indices.size());
+			geometry.indices = model->m_indices.data();
+		}
+		recordBatches(model);
+		computeBounds(model);
+		if(!model->m_packed_vertices)
+		{
+			return;
+		}
+		PackingError error;
+		model->m_packed_vertex_data = packVertices(model, error);
+		log << std::setprecision(3) << "  Packed vertices: " << sizeof(PackedVertex) << " bytes (was "
+		    << 2 * sizeof(glm::vec3) + sizeof(glm::vec2) << "), max error: position " << error.position
+		    << ", normal " << error.normal_degrees << " degrees, uv " << error.texture_coordinate << "\n";
+	}
+
+	// The textures of a material and the number of components each is loaded with
+	std::array<std::pair<Texture*, int>, 5> materialTextures(Material& material)
+	{
+		std::array<std::pair<Texture*, int>, 5> textures = { { { &material.m_color_texture, 4 },
+			                                                     { &material.m_metalness_texture, 1 },
+			                                                     { &material.m_fresnel_texture, 1 },
+			                                                     { &material.m_shininess_texture, 1 },
+			                                                     { &material.m_emission_texture, 4 } } };
+		return textures;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Decodes the textures the materials name, all at once on the thread
+	// pool. uploadModel() then finds them in the texture cache.
+	///////////////////////////////////////////////////////////////////////
+	void decodeTextures(Model* model, const std::string& directory)
+	{
+		TRACE_FUNCTION();
+		for(int pass = 0; pass < 2; pass++)
+		{
+			for(auto& material : model->m_materials)
+			{
+				for(const auto& texture : materialTextures(material))
+				{
+					if(texture.first->filename == "")
+					{
+						continue;
+					}
+					texture.first->directory = directory;
+					if(pass == 0)
+					{
+						getTextureCache().prefetch(directory, texture.first->filename, texture.second);
+					}
+					else
+					{
+						getTextureCache().decode(directory, texture.first->filename, texture.second);
+					}
+				}
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Reads the model from its binary cache, nullptr if there is no valid one
+	///////////////////////////////////////////////////////////////////////
+	Model* readModelFromCache(const std::string& path,
+	                          const std::string& directory,
+	                          const std::string& filename,
+	                          bool pack_vertices,
+	                          std::ostream& log)
+	{
+		TRACE_FUNCTION();
+		Model* model = new Model;
+		model->m_cache_file.reset(new MappedFile);
+		if(!readModelCache(path, *model->m_cache_file, model, &model->m_geometry))
+		{
+			delete model;
+			return nullptr;
+		}
+		model->m_name = filename;
+		model->m_filename = path;
+		model->m_packed_vertices = pack_vertices;
+		decodeTextures(model, directory);
+
+		log << "done (cached).\n";
+		finishGeometry(model, log);
+		return model;
+	}
+} // namespace
+
+Model* loadModelFromOBJ(std::string path, bool packVertices)
+{
+	std::string log;
+	Model* model = readModelFromOBJ(path, packVertices, &log);
+	std::cout << log << std::flush;
+	if(model == nullptr)
+	{
+		exit(1);
+	}
+	uploadModel(model);
+	return model;
 }
 
+void uploadModel(Model* model)
+{
+	TRACE_FUNCTION();
+	uploadGeometry(model);
+	for(auto& material : model->m_materials)
+	{
+		for(const auto& texture : materialTextures(material))
+		{
+			if(texture.first->filename != "")
+			{
+				texture.first->load(texture.first->directory, texture.first->filename, texture.second);
+			}
+		}
+	}
+	uploadMaterials(model);
+}
 
-Model* loadModelFromOBJ(std::string path)
+void uploadMaterials(Model* model)
 {
+	// Whole windows of MATERIAL_BLOCK_SIZE, the size of the block in the shader
+	const size_t windows = (model->m_materials.size() + MATERIAL_BLOCK_SIZE - 1) / MATERIAL_BLOCK_SIZE;
+	std::vector<MaterialParameters> parameters(std::max(size_t(1), windows) * MATERIAL_BLOCK_SIZE);
+	for(size_t i = 0; i < model->m_materials.size(); i++)
+	{
+		const Material& material = model->m_materials[i];
+		MaterialParameters& p = parameters[i];
+		p.color = material.m_color;
+		p.metalness = material.m_metalness;
+		p.emission = material.m_emission;
+		p.fresnel = material.m_fresnel;
+		p.shininess = material.m_shininess;
+		p.has_color_texture = material.m_color_texture.valid;
+		p.has_emission_texture = material.m_emission_texture.valid;
+	}
+	if(model->m_materials_bo == 0)
+	{
+		glGenBuffers(1, &model->m_materials_bo);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, model->m_materials_bo);
+	glBufferData(GL_UNIFORM_BUFFER, parameters.size() * sizeof(MaterialParameters), parameters.data(),
+	             GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+Model* readModelFromOBJ(std::string path, bool packVertices, std::string* log)
+{
+	TRACE_FUNCTION();
 	std::string filename, extension, directory;
 
 	filename = file::normalise(path);
@@ -130,246 +685,210 @@ Model* loadModelFromOBJ(std::string path)
 
 	if(extension != ".obj")
 	{
-		std::cout << "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
-		exit(1);
+		*log += "Fatal: loadModelFromOBJ(): Expecting filename ending in '.obj'\n";
+		return nullptr;
+	}
+
+	std::ostringstream out;
+	out << "Loading " << path << "...";
+	if(Model* model = readModelFromCache(path, directory, filename, packVertices, out))
+	{
+		*log += out.str();
+		return model;
 	}
 
 	///////////////////////////////////////////////////////////////////////
-	// Parse the OBJ file using tinyobj
+	// Parse the OBJ file, in parallel but into tinyobj's structures
 	///////////////////////////////////////////////////////////////////////
-	std::cout << "Loading " << path << "..." << std::flush;
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 	std::string err;
-	// Expect '.mtl' file in the same directory and triangulate meshes
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err,
-	                            (directory + filename + extension).c_str(), directory.c_str(), true);
+	// Expect '.mtl' file in the same directory, meshes are triangulated
+	bool ret = loadObj(&attrib, &shapes, &materials, &err, directory + filename + extension, directory);
 	if(!err.empty())
 	{ // `err` may contain warning message.
 		std::cerr << err << std::endl;
 	}
 	if(!ret)
 	{
-		exit(1);
+		*log += out.str() + "failed.\n";
+		return nullptr;
 	}
 	Model* model = new Model;
 	model->m_name = filename;
 	model->m_filename = path;
+	model->m_packed_vertices = packVertices;
 
 	///////////////////////////////////////////////////////////////////////
-	// Transform all materials into our datastructure
+	// Transform all materials into our datastructure. The textures are
+	// decoded in parallel, and only once if several materials share them.
 	///////////////////////////////////////////////////////////////////////
 	for(const auto& m : materials)
 	{
 		Material material;
 		material.m_name = m.name;
 		material.m_color = glm::vec3(m.diffuse[0], m.diffuse[1], m.diffuse[2]);
-		if(m.diffuse_texname != "")
-		{
-			material.m_color_texture.load(directory, m.diffuse_texname, 4);
-		}
+		material.m_color_texture.filename = file::normalise(m.diffuse_texname);
 		material.m_metalness = m.metallic;
-		if(m.metallic_texname != "")
-		{
-			material.m_metalness_texture.load(directory, m.metallic_texname, 1);
-		}
+		material.m_metalness_texture.filename = file::normalise(m.metallic_texname);
 		material.m_fresnel = m.specular[0];
-		if(m.specular_texname != "")
-		{
-			material.m_fresnel_texture.load(directory, m.specular_texname, 1);
-		}
+		material.m_fresnel_texture.filename = file::normalise(m.specular_texname);
 		material.m_shininess = m.roughness;
-		if(m.roughness_texname != "")
-		{
-			material.m_shininess_texture.load(directory, m.roughness_texname, 1);
-		}
+		material.m_shininess_texture.filename = file::normalise(m.roughness_texname);
 		material.m_emission = glm::vec3(m.emission[0], m.emission[1], m.emission[2]);
-		if(m.emissive_texname != "")
-		{
-			material.m_emission_texture.load(directory, m.emissive_texname, 4);
-		}
+		material.m_emission_texture.filename = file::normalise(m.emissive_texname);
 		material.m_transparency = m.transmittance[0];
 		material.m_ior = m.ior;
 		model->m_materials.push_back(material);
 	}
-
-	///////////////////////////////////////////////////////////////////////
-	// A vertex in the OBJ file may have different indices for position,
-	// normal and texture coordinate. We will not even attempt to use
-	// indexed lookups, but will store a simple vertex stream per mesh.
-	///////////////////////////////////////////////////////////////////////
-	uint64_t number_of_vertices = 0;
-	for(const auto& shape : shapes)
-	{
-		number_of_vertices += shape.mesh.indices.size();
-	}
-	model->m_positions.resize(number_of_vertices);
-	model->m_normals.resize(number_of_vertices);
-	model->m_texture_coordinates.resize(number_of_vertices);
+	decodeTextures(model, directory);
 
 	///////////////////////////////////////////////////////////////////////
 	// For each vertex _position_ auto generate a normal that will be used
 	// if no normal is supplied.
 	///////////////////////////////////////////////////////////////////////
-	std::vector<glm::vec4> auto_normals(attrib.vertices.size() / 3);
+	bool needs_auto_normals = false;
 	for(const auto& shape : shapes)
 	{
-		for(int face = 0; face < int(shape.mesh.indices.size()) / 3; face++)
+		for(const auto& index : shape.mesh.indices)
 		{
-			glm::vec3 v0 = glm::vec3(attrib.vertices[shape.mesh.indices[face * 3 + 0].vertex_index * 3 + 0],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 0].vertex_index * 3 + 1],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 0].vertex_index * 3 + 2]);
-			glm::vec3 v1 = glm::vec3(attrib.vertices[shape.mesh.indices[face * 3 + 1].vertex_index * 3 + 0],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 1].vertex_index * 3 + 1],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 1].vertex_index * 3 + 2]);
-			glm::vec3 v2 = glm::vec3(attrib.vertices[shape.mesh.indices[face * 3 + 2].vertex_index * 3 + 0],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 2].vertex_index * 3 + 1],
-			                         attrib.vertices[shape.mesh.indices[face * 3 + 2].vertex_index * 3 + 2]);
-
-			glm::vec3 e0 = glm::normalize(v1 - v0);
-			glm::vec3 e1 = glm::normalize(v2 - v0);
-			glm::vec3 face_normal = cross(e0, e1);
-
-			auto_normals[shape.mesh.indices[face * 3 + 0].vertex_index] += glm::vec4(face_normal, 1.0f);
-			auto_normals[shape.mesh.indices[face * 3 + 1].vertex_index] += glm::vec4(face_normal, 1.0f);
-			auto_normals[shape.mesh.indices[face * 3 + 2].vertex_index] += glm::vec4(face_normal, 1.0f);
+			needs_auto_normals = needs_auto_normals || index.normal_index == -1;
 		}
 	}
-	for(auto& normal : auto_normals)
+	std::vector<glm::vec3> auto_normals;
+	if(needs_auto_normals)
 	{
-		normal = (1.0f / normal.w) * normal;
+		auto_normals = generateNormals(attrib, shapes);
 	}
 
 	///////////////////////////////////////////////////////////////////////
 	// Now we will turn all shapes into Meshes. A shape that has several
-	// materials will be split into several meshes with unique names
+	// materials will be split into one Mesh per Material, in the order the
+	// materials first appear. Counting the faces of every material gives
+	// each mesh its range of the vertex stream, and each face its place in
+	// that range, in one pass over the faces.
 	///////////////////////////////////////////////////////////////////////
-	int vertices_so_far = 0;
-	for(int s = 0; s < shapes.size(); ++s)
+	const uint32_t NO_MESH = ~0u;
+	// First vertex of every face, NO_MESH if the face has no material
+	std::vector<std::vector<uint32_t>> face_first_vertex(shapes.size());
+	std::vector<uint32_t> material_faces(materials.size(), 0);
+	std::vector<uint32_t> material_next_vertex(materials.size(), 0);
+	std::vector<int> shape_materials;
+	uint32_t vertices_so_far = 0;
+	for(size_t s = 0; s < shapes.size(); ++s)
 	{
 		const auto& shape = shapes[s];
-		///////////////////////////////////////////////////////////////////
-		// The shapes in an OBJ file may several different materials.
-		// If so, we will split the shape into one Mesh per Material
-		///////////////////////////////////////////////////////////////////
-		int next_material_index = shape.mesh.material_ids[0];
-		int next_material_starting_face = 0;
-		std::vector<bool> finished_materials(materials.size(), false);
-		int number_of_materials_in_shape = 0;
-		while(next_material_index != -1)
-		{
-			int current_material_index = next_material_index;
-			int current_material_starting_face = next_material_starting_face;
-			next_material_index = -1;
-			next_material_starting_face = -1;
-			// Process a new Mesh with a unique material
+		shape_materials.clear();
+		for(int material_id : shape.mesh.material_ids)
+		{
+			if(material_id >= 0 && material_faces[material_id]++ == 0)
+			{
+				shape_materials.push_back(material_id);
+			}
+		}
+		for(int material_id : shape_materials)
+		{
 			Mesh mesh;
-			mesh.m_name = shape.name + "_" + materials[current_material_index].name;
-			mesh.m_material_idx = current_material_index;
-			mesh.m_start_index = vertices_so_far;
-			number_of_materials_in_shape += 1;
+			// If there's only one material, we don't need the material name in the mesh name
+			mesh.m_name = shape_materials.size() == 1 ? shape.name : shape.name + "_" + materials[material_id].name;
+			mesh.m_material_idx = material_id;
+			mesh.m_start_vertex = vertices_so_far;
+			mesh.m_number_of_vertices = material_faces[material_id] * 3;
+			model->m_meshes.push_back(mesh);
+			material_next_vertex[material_id] = vertices_so_far;
+			vertices_so_far += mesh.m_number_of_vertices;
+			material_faces[material_id] = 0;
+		}
+		std::vector<uint32_t>& first_vertex = face_first_vertex[s];
+		first_vertex.resize(shape.mesh.material_ids.size());
+		for(size_t i = 0; i < first_vertex.size(); i++)
+		{
+			int material_id = shape.mesh.material_ids[i];
+			if(material_id < 0)
+			{
+				first_vertex[i] = NO_MESH;
+				continue;
+			}
+			first_vertex[i] = material_next_vertex[material_id];
+			material_next_vertex[material_id] += 3;
+		}
+	}
 
-			uint64_t number_of_faces = shape.mesh.indices.size() / 3;
-			for(int i = current_material_starting_face; i < number_of_faces; i++)
+	///////////////////////////////////////////////////////////////////////
+	// A vertex in the OBJ file may have different indices for position,
+	// normal and texture coordinate. We first generate a simple vertex
+	// stream per mesh, and weld identical vertices into an index buffer
+	// once all meshes are done. Every face knows where its vertices go, so
+	// the faces are written in parallel.
+	///////////////////////////////////////////////////////////////////////
+	model->m_positions.resize(vertices_so_far);
+	model->m_normals.resize(vertices_so_far);
+	model->m_texture_coordinates.resize(vertices_so_far);
+	for(size_t s = 0; s < shapes.size(); ++s)
+	{
+		const auto& indices = shapes[s].mesh.indices;
+		const std::vector<uint32_t>& first_vertex = face_first_vertex[s];
+		parallelForBatches(first_vertex.size(), [&](size_t begin, size_t end) {
+			for(size_t i = begin; i < end; i++)
 			{
-				if(shape.mesh.material_ids[i] != current_material_index)
+				if(first_vertex[i] == NO_MESH)
 				{
-					if(next_material_index >= 0)
-						continue;
-					else if(finished_materials[shape.mesh.material_ids[i]])
-						continue;
-					else
-					{ // Found a new material that we have not processed.
-						next_material_index = shape.mesh.material_ids[i];
-						next_material_starting_face = i;
-					}
+					continue;
 				}
-				else
+				for(int j = 0; j < 3; j++)
 				{
-					///////////////////////////////////////////////////////
-					// Now we generate the vertices
-					///////////////////////////////////////////////////////
-					for(int j = 0; j < 3; j++)
+					const tinyobj::index_t& index = indices[i * 3 + j];
+					const uint32_t vertex = first_vertex[i] + j;
+					model->m_positions[vertex] = glm::vec3(attrib.vertices[index.vertex_index * 3 + 0],
+					                                       attrib.vertices[index.vertex_index * 3 + 1],
+					                                       attrib.vertices[index.vertex_index * 3 + 2]);
+					if(index.normal_index == -1)
 					{
-						int v = shape.mesh.indices[i * 3 + j].vertex_index;
-						model->m_positions[vertices_so_far + j] =
-						    glm::vec3(attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 0],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 1],
-						              attrib.vertices[shape.mesh.indices[i * 3 + j].vertex_index * 3 + 2]);
-						if(shape.mesh.indices[i * 3 + j].normal_index == -1)
-						{
-							// No normal, use the autogenerated
-							model->m_normals[vertices_so_far + j] = glm::vec3(
-							    auto_normals[shape.mesh.indices[i * 3 + j].vertex_index]);
-						}
-						else
-						{
-							model->m_normals[vertices_so_far + j] =
-							    glm::vec3(attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 0],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 1],
-							              attrib.normals[shape.mesh.indices[i * 3 + j].normal_index * 3 + 2]);
-						}
-						if(shape.mesh.indices[i * 3 + j].texcoord_index == -1)
-						{
-							// No UV coordinates. Use null.
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(0.0f);
-						}
-						else
-						{
-							model->m_texture_coordinates[vertices_so_far + j] = glm::vec2(
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 0],
-							    attrib.texcoords[shape.mesh.indices[i * 3 + j].texcoord_index * 2 + 1]);
-						}
+						// No normal, use the autogenerated
+						model->m_normals[vertex] = auto_normals[index.vertex_index];
+					}
+					else
+					{
+						model->m_normals[vertex] = glm::vec3(attrib.normals[index.normal_index * 3 + 0],
+						                                     attrib.normals[index.normal_index * 3 + 1],
+						                                     attrib.normals[index.normal_index * 3 + 2]);
+					}
+					if(index.texcoord_index == -1)
+					{
+						// No UV coordinates. Use null.
+						model->m_texture_coordinates[vertex] = glm::vec2(0.0f);
+					}
+					else
+					{
+						model->m_texture_coordinates[vertex] =
+						    glm::vec2(attrib.texcoords[index.texcoord_index * 2 + 0],
+						              attrib.texcoords[index.texcoord_index * 2 + 1]);
 					}
-					vertices_so_far += 3;
 				}
 			}
-			///////////////////////////////////////////////////////////////
-			// Finalize and push this mesh to the list
-			///////////////////////////////////////////////////////////////
-			mesh.m_number_of_vertices = vertices_so_far - mesh.m_start_index;
-			model->m_meshes.push_back(mesh);
-			finished_materials[current_material_index] = true;
-		}
-		if(number_of_materials_in_shape == 1)
-		{
-			// If there's only one material, we don't need the material name in the mesh name
-			model->m_meshes.back().m_name = shape.name;
-		}
+		});
 	}
 
+	weldVertices(model);
+	VertexCacheStats before, after;
+	optimizeMeshes(model, before, after);
+
 	std::sort(model->m_meshes.begin(), model->m_meshes.end(),
 	          [](const Mesh& a, const Mesh& b) { return a.m_name < b.m_name; });
+	batchMeshesByMaterial(model);
 
 	///////////////////////////////////////////////////////////////////////
-	// Upload to GPU
+	// Cache the result for the next load
 	///////////////////////////////////////////////////////////////////////
-	glGenVertexArrays(1, &model->m_vaob);
-	glBindVertexArray(model->m_vaob);
-	glGenBuffers(1, &model->m_positions_bo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->m_positions_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_positions.size() * sizeof(glm::vec3), &model->m_positions[0].x,
-	             GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);
-	glEnableVertexAttribArray(0);
-	glGenBuffers(1, &model->m_normals_bo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->m_normals_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_normals.size() * sizeof(glm::vec3), &model->m_normals[0].x,
-	             GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 3, GL_FLOAT, false, 0, 0);
-	glEnableVertexAttribArray(1);
-	glGenBuffers(1, &model->m_texture_coordinates_bo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->m_texture_coordinates_bo);
-	glBufferData(GL_ARRAY_BUFFER, model->m_texture_coordinates.size() * sizeof(glm::vec2),
-	             &model->m_texture_coordinates[0].x, GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);
-	glEnableVertexAttribArray(2);
-
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-	std::cout << "done.\n";
+	writeModelCache(path, model);
+
+	out << "done.\n";
+	out << std::fixed << std::setprecision(3) << "  Vertex cache: ACMR " << before.acmr() << " -> " << after.acmr()
+	    << ", ATVR " << before.atvr() << " -> " << after.atvr() << "\n";
+	out.unsetf(std::ios::floatfield);
+	finishGeometry(model, out);
+	*log += out.str();
 	return model;
 }
 
@@ -437,35 +956,39 @@ void saveModelToOBJ(Model* model, std::string filename)
 	}
 	obj_file << "# Exported by Chalmers Graphics Group\n";
 	obj_file << "mtllib " << filename << ".mtl\n";
+	const ModelGeometry& geometry = model->m_geometry;
 	int vertex_counter = 1;
 	for(auto mesh : model->m_meshes)
 	{
 		obj_file << "o " << mesh.m_name << "\n";
 		obj_file << "g " << mesh.m_name << "\n";
 		obj_file << "usemtl " << model->m_materials[mesh.m_material_idx].m_name << "\n";
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = mesh.m_start_vertex; i < mesh.m_start_vertex + mesh.m_number_of_vertices; i++)
 		{
-			obj_file << "v " << model->m_positions[i].x << " " << model->m_positions[i].y << " "
-			         << model->m_positions[i].z << "\n";
+			obj_file << "v " << geometry.positions[i].x << " " << geometry.positions[i].y << " "
+			         << geometry.positions[i].z << "\n";
 		}
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = mesh.m_start_vertex; i < mesh.m_start_vertex + mesh.m_number_of_vertices; i++)
 		{
-			obj_file << "vn " << model->m_normals[i].x << " " << model->m_normals[i].y << " "
-			         << model->m_normals[i].z << "\n";
+			obj_file << "vn " << geometry.normals[i].x << " " << geometry.normals[i].y << " "
+			         << geometry.normals[i].z << "\n";
 		}
-		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_vertices; i++)
+		for(uint32_t i = mesh.m_start_vertex; i < mesh.m_start_vertex + mesh.m_number_of_vertices; i++)
 		{
-			obj_file << "vt " << model->m_texture_coordinates[i].x << " " << model->m_texture_coordinates[i].y
+			obj_file << "vt " << geometry.texture_coordinates[i].x << " " << geometry.texture_coordinates[i].y
 			         << "\n";
 		}
-		int number_of_faces = mesh.m_number_of_vertices / 3;
-		for(int i = 0; i < number_of_faces; i++)
+		for(uint32_t i = mesh.m_start_index; i < mesh.m_start_index + mesh.m_number_of_indices; i += 3)
 		{
-			obj_file << "f " << vertex_counter << "/" << vertex_counter << "/" << vertex_counter << " "
-			         << vertex_counter + 1 << "/" << vertex_counter + 1 << "/" << vertex_counter + 1 << " "
-			         << vertex_counter + 2 << "/" << vertex_counter + 2 << "/" << vertex_counter + 2 << "\n";
-			vertex_counter += 3;
+			obj_file << "f";
+			for(uint32_t j = 0; j < 3; j++)
+			{
+				int v = vertex_counter + int(geometry.indices[i + j] - mesh.m_start_vertex);
+				obj_file << " " << v << "/" << v << "/" << v;
+			}
+			obj_file << "\n";
 		}
+		vertex_counter += mesh.m_number_of_vertices;
 	}
 }
 
@@ -478,74 +1001,117 @@ void freeModel(Model* model)
 		delete model;
 }
 
+namespace
+{
+	///////////////////////////////////////////////////////////////////////
+	// Handles of the material and mesh uniforms, looked up once per program
+	///////////////////////////////////////////////////////////////////////
+	struct MaterialUniforms
+	{
+		uint32_t generation = 0;
+		int material_index = -1;
+		int mesh_position_offset = -1;
+		int mesh_position_scale = -1;
+
+		void update(const ProgramReflection* reflection)
+		{
+			if(reflection->generation() == generation)
+				return;
+			generation = reflection->generation();
+			material_index = reflection->find("material_index");
+			mesh_position_offset = reflection->find("meshPositionOffset");
+			mesh_position_scale = reflection->find("meshPositionScale");
+		}
+	};
+
+	void drawIndices(uint32_t start_index, uint32_t number_of_indices)
+	{
+		glDrawElements(GL_TRIANGLES, (GLsizei)number_of_indices, GL_UNSIGNED_INT,
+		               (const void*)(size_t(start_index) * sizeof(uint32_t)));
+	}
+} // namespace
+
 ///////////////////////////////////////////////////////////////////////
-// Loop through all Meshes in the Model and render them
+// Renders the Model batch by batch, so material state only changes
+// between batches. Without packed vertices every batch is a single draw,
+// and the whole model is one draw when no materials are submitted; packed
+// vertices need the bounds of each mesh.
 ///////////////////////////////////////////////////////////////////////
 void render(const Model* model, const bool submitMaterials)
 {
-	GLint current_program = 0;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+	GLStateCache& gl = getGLState();
+	GLuint current_program = gl.program();
+	ProgramReflection* reflection = getProgramReflection(current_program);
+	static MaterialUniforms uniforms;
+	if(reflection != nullptr)
+	{
+		uniforms.update(reflection);
+	}
+
+	gl.bindVertexArray(model->m_vaob);
+	if(!submitMaterials && !model->m_packed_vertices && !model->m_batches.empty())
+	{
+		// The batches cover the index buffer, in order
+		const MaterialBatch& last = model->m_batches.back();
+		drawIndices(0, last.m_start_index + last.m_number_of_indices);
+		return;
+	}
 
-	glBindVertexArray(model->m_vaob);
-	for(auto& mesh : model->m_meshes)
+	uint32_t material_window = ~0u;
+	for(const MaterialBatch& batch : model->m_batches)
 	{
 		if(submitMaterials)
 		{
-			const Material& material = model->m_materials[mesh.m_material_idx];
-
-			bool has_color_texture = material.m_color_texture.valid;
-			bool has_metalness_texture = material.m_metalness_texture.valid;
-			bool has_fresnel_texture = material.m_fresnel_texture.valid;
-			bool has_shininess_texture = material.m_shininess_texture.valid;
-			bool has_emission_texture = material.m_emission_texture.valid;
-			if(has_color_texture)
+			const Material& material = model->m_materials[batch.m_material_idx];
+			const uint32_t window = batch.m_material_idx / MATERIAL_BLOCK_SIZE;
+			if(window != material_window)
 			{
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, material.m_color_texture.gl_id);
+				const GLsizeiptr size = MATERIAL_BLOCK_SIZE * sizeof(MaterialParameters);
+				glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, model->m_materials_bo, window * size, size);
+				material_window = window;
 			}
-			// Actually unused in the labs
-			/*
-			if ( has_metalness_texture )
+			if(material.m_color_texture.valid)
 			{
-				glActiveTexture( GL_TEXTURE2 );
-				glBindTexture( GL_TEXTURE_2D, material.m_metalness_texture.gl_id );
+				gl.bindTexture(0, GL_TEXTURE_2D, material.m_color_texture.gl_id);
 			}
-			if ( has_fresnel_texture )
+			if(material.m_emission_texture.valid)
 			{
-				glActiveTexture( GL_TEXTURE3 );
-				glBindTexture( GL_TEXTURE_2D, material.m_fresnel_texture.gl_id );
+				gl.bindTexture(5, GL_TEXTURE_2D, material.m_emission_texture.gl_id);
 			}
-			if ( has_shininess_texture )
+			// Metalness, fresnel and shininess textures are unused in the labs
+
+			const GLint material_index = GLint(batch.m_material_idx % MATERIAL_BLOCK_SIZE);
+			if(reflection != nullptr)
 			{
-				glActiveTexture( GL_TEXTURE4 );
-				glBindTexture( GL_TEXTURE_2D, material.m_shininess_texture.gl_id );
+				reflection->set(uniforms.material_index, material_index);
 			}
-			*/
-			if(has_emission_texture)
+			else
 			{
-				glActiveTexture(GL_TEXTURE5);
-				glBindTexture(GL_TEXTURE_2D, material.m_emission_texture.gl_id);
+				setUniformSlow(current_program, "material_index", material_index);
 			}
-			glActiveTexture(GL_TEXTURE0);
-
-			setUniformSlow(current_program, "has_color_texture", has_color_texture);
-			setUniformSlow(current_program, "has_emission_texture", has_emission_texture);
-
-			setUniformSlow(current_program, "material_color", material.m_color);
-			setUniformSlow(current_program, "material_metalness", material.m_metalness);
-			setUniformSlow(current_program, "material_fresnel", material.m_fresnel);
-			setUniformSlow(current_program, "material_shininess", material.m_shininess);
-			setUniformSlow(current_program, "material_emission", material.m_emission);
+		}
 
-			// Actually unused in the labs
-			/*
-			setUniformSlow( current_program, "has_metalness_texture", has_metalness_texture );
-			setUniformSlow( current_program, "has_fresnel_texture", has_fresnel_texture );
-			setUniformSlow( current_program, "has_shininess_texture", has_shininess_texture );
-			*/
+		if(!model->m_packed_vertices)
+		{
+			drawIndices(batch.m_start_index, batch.m_number_of_indices);
+			continue;
+		}
+		for(uint32_t i = batch.m_first_mesh; i < batch.m_first_mesh + batch.m_number_of_meshes; i++)
+		{
+			const Mesh& mesh = model->m_meshes[i];
+			const glm::vec3 scale = mesh.m_bounds_max - mesh.m_bounds_min;
+			if(reflection != nullptr)
+			{
+				reflection->set(uniforms.mesh_position_offset, mesh.m_bounds_min);
+				reflection->set(uniforms.mesh_position_scale, scale);
+			}
+			else
+			{
+				setUniformSlow(current_program, "meshPositionOffset", mesh.m_bounds_min);
+				setUniformSlow(current_program, "meshPositionScale", scale);
+			}
+			drawIndices(mesh.m_start_index, mesh.m_number_of_indices);
 		}
-		glDrawArrays(GL_TRIANGLES, mesh.m_start_index, (GLsizei)mesh.m_number_of_vertices);
 	}
-	glBindVertexArray(0);
 }
 } // namespace labhelper
@@ -3,7 +3,9 @@
 #include <vector>
 #include <memory>
 #include <memory>
+#include <cstdint>
 #include <glm/glm.hpp>
+#include "MeshCache.h"
 
 namespace labhelper
 {
@@ -51,9 +53,59 @@ struct Mesh
 {
 	std::string m_name;
 	uint32_t m_material_idx;
-	// Where this Mesh's vertices start
+	// Where this Mesh's indices start, three per triangle
 	uint32_t m_start_index;
+	uint32_t m_number_of_indices;
+	// The vertices its indices refer to (indices are into the whole model)
+	uint32_t m_start_vertex;
 	uint32_t m_number_of_vertices;
+	// Bounding box of those vertices, packed positions are relative to it
+	glm::vec3 m_bounds_min;
+	glm::vec3 m_bounds_max;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Consecutive meshes that share a material. Their indices are consecutive
+// too, so without packed vertices a batch is drawn with a single call.
+///////////////////////////////////////////////////////////////////////////
+struct MaterialBatch
+{
+	uint32_t m_material_idx;
+	uint32_t m_first_mesh;
+	uint32_t m_number_of_meshes;
+	uint32_t m_start_index;
+	uint32_t m_number_of_indices;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// render() binds the materials of a model to this uniform block binding
+// point and selects one with the "material_index" uniform, see the
+// MaterialBlock in shading.frag. The block holds MATERIAL_BLOCK_SIZE
+// materials; a model with more binds the window its batch's material is in.
+///////////////////////////////////////////////////////////////////////////
+const uint32_t MATERIAL_BLOCK_BINDING = 3;
+const uint32_t MATERIAL_BLOCK_SIZE = 256;
+
+// One material in the std140 MaterialBlock, see shading.frag
+struct MaterialParameters
+{
+	glm::vec3 color;
+	float metalness;
+	glm::vec3 emission;
+	float fresnel;
+	float shininess;
+	int32_t has_color_texture;
+	int32_t has_emission_texture;
+	float pad;
+};
+static_assert(sizeof(MaterialParameters) == 3 * 16, "MaterialParameters does not match std140 layout");
+
+// A vertex of the packed format, see Model::m_packed_vertices
+struct PackedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint16_t texture_coordinate[2];
 };
 
 class Model
@@ -66,21 +118,58 @@ public:
 	std::string m_filename;
 	// The materials
 	std::vector<Material> m_materials;
-	// A model will contain one or more "Meshes"
+	// A model will contain one or more "Meshes", ordered by material
 	std::vector<Mesh> m_meshes;
-	// Buffers on CPU
+	// Runs of m_meshes with the same material, materials with the same
+	// textures next to each other
+	std::vector<MaterialBatch> m_batches;
+	// Buffers on CPU, while the model is read from the OBJ file. They stay
+	// empty for a model read from its cache.
 	std::vector<glm::vec3> m_positions;
 	std::vector<glm::vec3> m_normals;
 	std::vector<glm::vec2> m_texture_coordinates;
+	std::vector<uint32_t> m_indices;
+	// The vertices and indices of the read model, in the buffers above or
+	// in the mapped cache. The model keeps the mapping open, its pages are
+	// backed by the file, so nothing is copied to upload them.
+	ModelGeometry m_geometry;
+	std::unique_ptr<MappedFile> m_cache_file;
 	// Buffers on GPU
-	uint32_t m_positions_bo;
-	uint32_t m_normals_bo;
-	uint32_t m_texture_coordinates_bo;
+	uint32_t m_positions_bo = 0;
+	uint32_t m_normals_bo = 0;
+	uint32_t m_texture_coordinates_bo = 0;
+	uint32_t m_indices_bo = 0;
+	///////////////////////////////////////////////////////////////////////
+	// With packed vertices a single interleaved buffer replaces the three
+	// above, 16 instead of 32 bytes per vertex:
+	//  location 0: position, 3 x unorm16 relative to the mesh bounds
+	//  location 1: normal, octahedral encoded in 2 x snorm16
+	//  location 2: texture coordinate, 2 x half float
+	// The vertex shader must decode them, see PACKED_VERTICES in shading.vert
+	///////////////////////////////////////////////////////////////////////
+	bool m_packed_vertices = false;
+	uint32_t m_packed_vertices_bo = 0;
+	// The packed vertices between readModelFromOBJ() and uploadModel()
+	std::vector<PackedVertex> m_packed_vertex_data;
 	// Vertex Array Object
-	uint32_t m_vaob;
+	uint32_t m_vaob = 0;
+	// Uniform buffer with the parameters of all materials
+	uint32_t m_materials_bo = 0;
 };
 
-Model* loadModelFromOBJ(std::string filename);
+Model* loadModelFromOBJ(std::string filename, bool packVertices = false);
+///////////////////////////////////////////////////////////////////////////
+// loadModelFromOBJ() in two steps, for loading in the background.
+// readModelFromOBJ() does everything but the GL work, including decoding
+// the textures, and may run on any thread. It returns nullptr if the file
+// can't be read or is no OBJ file, and appends what loadModelFromOBJ()
+// prints to `log`.
+// uploadModel() then creates the buffers and textures on the GL thread.
+///////////////////////////////////////////////////////////////////////////
+Model* readModelFromOBJ(std::string filename, bool packVertices, std::string* log);
+void uploadModel(Model* model);
+// (Re)uploads the material parameters, after m_materials were changed
+void uploadMaterials(Model* model);
 void saveModelToOBJ(Model* model, std::string filename);
 void saveModelMaterialsToMTL(Model* model, std::string filename);
 void freeModel(Model* model);
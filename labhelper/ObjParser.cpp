@@ -0,0 +1,728 @@
+#include "ObjParser.h"
+#include "MeshCache.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+
+namespace labhelper
+{
+namespace
+{
+// Chunks are cut at the first line break after this many bytes
+const size_t CHUNK_SIZE = 512 * 1024;
+
+///////////////////////////////////////////////////////////////////////////
+/// A face corner as tinyobj's parseTriple() makes it: raw - 1, 0 for 0
+/// and -1 if missing. A negative raw index counts back from the vertices
+/// read so far. The chunk only knows its own, so the index is relative to
+/// its first vertex and flagged in `relative` until the merge.
+///////////////////////////////////////////////////////////////////////////
+enum
+{
+	POSITION = 0,
+	TEXCOORD = 1,
+	NORMAL = 2
+};
+
+struct Corner
+{
+	int index[3];
+	uint8_t relative;
+};
+
+enum class Keyword : uint8_t
+{
+	UseMtl,
+	MtlLib,
+	Group,
+	Object
+};
+
+// A line that changes the shape or material, and where in the chunk it was
+struct Statement
+{
+	Keyword keyword;
+	size_t face;
+	size_t corner;
+	size_t triangle;
+	std::string argument;
+};
+
+// Faces of a chunk that go to one shape with one material
+struct Run
+{
+	size_t face_begin, face_end;
+	size_t corner;
+	size_t shape;
+	int material_id;
+	// First triangle in the shape
+	size_t triangle;
+};
+
+struct Chunk
+{
+	const char* begin;
+	const char* end;
+
+	std::vector<float> positions;
+	std::vector<float> normals;
+	std::vector<float> texcoords;
+	std::vector<Corner> corners;
+	std::vector<uint32_t> face_sizes;
+	size_t triangles = 0;
+	std::vector<Statement> statements;
+
+	// Filled in by the merge
+	size_t first_position = 0, first_normal = 0, first_texcoord = 0;
+	std::vector<Run> runs;
+};
+
+inline bool isSpace(char c)
+{
+	return c == ' ' || c == '\t';
+}
+
+inline bool isDigit(char c)
+{
+	return unsigned(c - '0') < 10u;
+}
+
+inline const char* skipSpace(const char* p, const char* end)
+{
+	while(p < end && isSpace(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+inline const char* skipToken(const char* p, const char* end)
+{
+	while(p < end && !isSpace(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+// `keyword` followed by a space or tab
+inline bool isKeyword(const char* token, const char* end, const char* keyword, size_t length)
+{
+	return size_t(end - token) > length && memcmp(token, keyword, length) == 0 && isSpace(token[length]);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Converts the number at the start of [p, end) like std::from_chars
+/// would, 0 if there is none, without strtod's locale overhead. Up to 19
+/// significant digits are kept in an integer. If it fits a double's
+/// mantissa and the exponent is within +-22, one division or product by an
+/// exact power of ten gives the correctly rounded double, otherwise pow()
+/// gives an approximation. Rounding that double to float again means the
+/// result is not guaranteed to match strtof(), though it does for the
+/// short decimals OBJ exporters write.
+///////////////////////////////////////////////////////////////////////////
+float parseFloat(const char* p, const char* end)
+{
+	static const double POWERS_OF_TEN[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+		                                    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		                                    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	bool negative = false;
+	if(p < end && (*p == '+' || *p == '-'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool any_digits = false;
+	for(; p < end && isDigit(*p); p++)
+	{
+		any_digits = true;
+		if(digits < 19)
+		{
+			mantissa = mantissa * 10 + uint64_t(*p - '0');
+			digits += mantissa != 0;
+		}
+		else
+		{
+			exponent++;
+		}
+	}
+	if(p < end && *p == '.')
+	{
+		for(p++; p < end && isDigit(*p); p++)
+		{
+			any_digits = true;
+			if(digits < 19)
+			{
+				mantissa = mantissa * 10 + uint64_t(*p - '0');
+				digits += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+	if(!any_digits)
+	{
+		return 0.0f;
+	}
+	if(p + 1 < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negative_exponent = false;
+		if(*e == '+' || *e == '-')
+		{
+			negative_exponent = *e == '-';
+			e++;
+		}
+		int value = 0;
+		for(; e < end && isDigit(*e); e++)
+		{
+			value = std::min(value * 10 + (*e - '0'), 100000);
+		}
+		exponent += negative_exponent ? -value : value;
+	}
+
+	double value;
+	if(mantissa == 0)
+	{
+		value = 0.0;
+	}
+	else if(mantissa < (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22)
+	{
+		value = exponent < 0 ? double(mantissa) / POWERS_OF_TEN[-exponent] :
+		                       double(mantissa) * POWERS_OF_TEN[exponent];
+	}
+	else
+	{
+		value = double(mantissa) * std::pow(10.0, double(exponent));
+	}
+	return float(negative ? -value : value);
+}
+
+// Reads the next whitespace separated number of a line, like tinyobj's parseReal()
+inline float nextFloat(const char*& p, const char* end)
+{
+	p = skipSpace(p, end);
+	const char* token_end = skipToken(p, end);
+	float value = parseFloat(p, token_end);
+	p = token_end;
+	return value;
+}
+
+// atoi() of [p, end)
+inline int parseInt(const char* p, const char* end)
+{
+	p = skipSpace(p, end);
+	bool negative = false;
+	if(p < end && (*p == '+' || *p == '-'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+	int64_t value = 0;
+	for(; p < end && isDigit(*p); p++)
+	{
+		value = std::min(value * 10 + (*p - '0'), int64_t(std::numeric_limits<int>::max()));
+	}
+	return int(negative ? -value : value);
+}
+
+// strcspn(p, "/ \t\r")
+inline const char* skipIndex(const char* p, const char* end)
+{
+	while(p < end && *p != '/' && !isSpace(*p))
+	{
+		p++;
+	}
+	return p;
+}
+
+inline void setIndex(Corner& corner, int slot, int raw, size_t count)
+{
+	if(raw > 0)
+	{
+		corner.index[slot] = raw - 1;
+	}
+	else if(raw == 0)
+	{
+		corner.index[slot] = 0;
+	}
+	else
+	{
+		corner.index[slot] = int(count) + raw;
+		corner.relative |= uint8_t(1 << slot);
+	}
+}
+
+// i, i/j/k, i//k or i/j, the same way as tinyobj's parseTriple()
+Corner parseCorner(const char*& p, const char* end, const Chunk& chunk)
+{
+	Corner corner = { { -1, -1, -1 }, 0 };
+	setIndex(corner, POSITION, parseInt(p, end), chunk.positions.size() / 3);
+	p = skipIndex(p, end);
+	if(p == end || *p != '/')
+	{
+		return corner;
+	}
+	p++;
+	if(p < end && *p == '/')
+	{
+		p++;
+		setIndex(corner, NORMAL, parseInt(p, end), chunk.normals.size() / 3);
+		p = skipIndex(p, end);
+		return corner;
+	}
+	setIndex(corner, TEXCOORD, parseInt(p, end), chunk.texcoords.size() / 2);
+	p = skipIndex(p, end);
+	if(p == end || *p != '/')
+	{
+		return corner;
+	}
+	p++;
+	setIndex(corner, NORMAL, parseInt(p, end), chunk.normals.size() / 3);
+	p = skipIndex(p, end);
+	return corner;
+}
+
+void addStatement(Chunk& chunk, Keyword keyword, const char* argument, const char* end)
+{
+	Statement statement;
+	statement.keyword = keyword;
+	statement.face = chunk.face_sizes.size();
+	statement.corner = chunk.corners.size();
+	statement.triangle = chunk.triangles;
+	statement.argument.assign(argument, end);
+	chunk.statements.push_back(std::move(statement));
+}
+
+void parseLine(Chunk& chunk, const char* token, const char* end)
+{
+	token = skipSpace(token, end);
+	if(token == end || *token == '#')
+	{
+		return;
+	}
+	if(isKeyword(token, end, "v", 1))
+	{
+		token += 2;
+		for(int i = 0; i < 3; i++)
+		{
+			chunk.positions.push_back(nextFloat(token, end));
+		}
+	}
+	else if(isKeyword(token, end, "vn", 2))
+	{
+		token += 3;
+		for(int i = 0; i < 3; i++)
+		{
+			chunk.normals.push_back(nextFloat(token, end));
+		}
+	}
+	else if(isKeyword(token, end, "vt", 2))
+	{
+		token += 3;
+		for(int i = 0; i < 2; i++)
+		{
+			chunk.texcoords.push_back(nextFloat(token, end));
+		}
+	}
+	else if(isKeyword(token, end, "f", 1))
+	{
+		token = skipSpace(token + 2, end);
+		uint32_t size = 0;
+		while(token < end)
+		{
+			chunk.corners.push_back(parseCorner(token, end, chunk));
+			size++;
+			token = skipSpace(token, end);
+		}
+		chunk.face_sizes.push_back(size);
+		chunk.triangles += size > 2 ? size - 2 : 0;
+	}
+	else if(isKeyword(token, end, "usemtl", 6))
+	{
+		addStatement(chunk, Keyword::UseMtl, token + 7, end);
+	}
+	else if(isKeyword(token, end, "mtllib", 6))
+	{
+		addStatement(chunk, Keyword::MtlLib, token + 7, end);
+	}
+	else if(isKeyword(token, end, "g", 1))
+	{
+		addStatement(chunk, Keyword::Group, token, end);
+	}
+	else if(isKeyword(token, end, "o", 1))
+	{
+		addStatement(chunk, Keyword::Object, token + 2, end);
+	}
+}
+
+void parseChunk(Chunk& chunk)
+{
+	const char* p = chunk.begin;
+	while(p < chunk.end)
+	{
+		const char* line_end = p;
+		while(line_end < chunk.end && *line_end != '\n' && *line_end != '\r')
+		{
+			line_end++;
+		}
+		parseLine(chunk, p, line_end);
+		p = line_end + 1;
+	}
+}
+
+// What sscanf(s, "%s") reads
+std::string firstWord(const std::string& s)
+{
+	std::istringstream stream(s);
+	std::string word;
+	stream >> word;
+	return word;
+}
+
+// The second word of a 'g' line, as tinyobj takes it
+std::string groupName(const std::string& line)
+{
+	const char* p = line.c_str();
+	const char* end = p + line.size();
+	p = skipSpace(skipToken(p, end), end);
+	return std::string(p, skipToken(p, end));
+}
+
+void loadMaterialLibraries(const std::string& argument,
+                           const std::string& mtl_basedir,
+                           std::vector<tinyobj::material_t>* materials,
+                           std::map<std::string, int>* material_map,
+                           std::string* err)
+{
+	std::vector<std::string> filenames;
+	std::istringstream stream(argument);
+	std::string filename;
+	while(std::getline(stream, filename, ' '))
+	{
+		filenames.push_back(filename);
+	}
+	if(filenames.empty())
+	{
+		*err += "WARN: Looks like empty filename for mtllib. Use default material. \n";
+		return;
+	}
+	tinyobj::MaterialFileReader reader(mtl_basedir);
+	for(const std::string& name : filenames)
+	{
+		std::string err_mtl;
+		bool ok = reader(name, materials, material_map, &err_mtl);
+		*err += err_mtl;
+		if(ok)
+		{
+			return;
+		}
+	}
+	*err += "WARN: Failed to load material file(s). Use default material.\n";
+}
+
+tinyobj::index_t resolve(const Corner& corner, const Chunk& chunk)
+{
+	tinyobj::index_t index;
+	index.vertex_index = corner.index[POSITION] + (corner.relative & (1 << POSITION) ? int(chunk.first_position) : 0);
+	index.texcoord_index = corner.index[TEXCOORD] + (corner.relative & (1 << TEXCOORD) ? int(chunk.first_texcoord) : 0);
+	index.normal_index = corner.index[NORMAL] + (corner.relative & (1 << NORMAL) ? int(chunk.first_normal) : 0);
+	return index;
+}
+} // namespace
+
+bool loadObj(tinyobj::attrib_t* attrib,
+             std::vector<tinyobj::shape_t>* shapes,
+             std::vector<tinyobj::material_t>* materials,
+             std::string* err,
+             const std::string& filename,
+             const std::string& mtl_basedir)
+{
+	TRACE_FUNCTION();
+	attrib->vertices.clear();
+	attrib->normals.clear();
+	attrib->texcoords.clear();
+	shapes->clear();
+	err->clear();
+
+	MappedFile file;
+	if(!file.open(filename))
+	{
+		// An empty file can't be mapped, but is a valid OBJ
+		if(std::ifstream(filename.c_str()))
+		{
+			return true;
+		}
+		*err = "Cannot open file [" + filename + "]\n";
+		return false;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Tokenize and convert the chunks in parallel
+	///////////////////////////////////////////////////////////////////////
+	std::vector<Chunk> chunks;
+	{
+		const char* p = reinterpret_cast<const char*>(file.data());
+		const char* end = p + file.size();
+		while(p < end)
+		{
+			Chunk chunk;
+			chunk.begin = p;
+			chunk.end = size_t(end - p) > CHUNK_SIZE ? p + CHUNK_SIZE : end;
+			while(chunk.end < end && chunk.end[-1] != '\n')
+			{
+				chunk.end++;
+			}
+			p = chunk.end;
+			chunks.push_back(std::move(chunk));
+		}
+	}
+	getThreadPool().parallelFor(chunks.size(), [&](size_t i) {
+		TRACE_SCOPE("Parse OBJ chunk");
+		parseChunk(chunks[i]);
+	});
+
+	///////////////////////////////////////////////////////////////////////
+	// Replay the statements in file order to find the shape and material
+	// of every run of faces. Like tinyobj, a 'g' or 'o' line keeps the
+	// current shape only if faces were added since the last 'usemtl' that
+	// changed the material.
+	///////////////////////////////////////////////////////////////////////
+	struct ShapeInfo
+	{
+		std::string name;
+		size_t triangles = 0;
+		bool keep = false;
+	};
+	std::vector<ShapeInfo> infos(1);
+	std::map<std::string, int> material_map;
+	int material_id = -1;
+	std::string name;
+	bool has_new_faces = false;
+	size_t positions = 0, normals = 0, texcoords = 0;
+	for(Chunk& chunk : chunks)
+	{
+		chunk.first_position = positions;
+		chunk.first_normal = normals;
+		chunk.first_texcoord = texcoords;
+		positions += chunk.positions.size() / 3;
+		normals += chunk.normals.size() / 3;
+		texcoords += chunk.texcoords.size() / 2;
+
+		size_t face = 0, corner = 0, triangle = 0;
+		auto addRun = [&](size_t face_end, size_t corner_end, size_t triangle_end) {
+			if(face_end > face)
+			{
+				ShapeInfo& info = infos.back();
+				Run run = { face, face_end, corner, infos.size() - 1, material_id, info.triangles };
+				chunk.runs.push_back(run);
+				info.triangles += triangle_end - triangle;
+				info.name = name;
+				has_new_faces = true;
+			}
+			face = face_end;
+			corner = corner_end;
+			triangle = triangle_end;
+		};
+		for(const Statement& statement : chunk.statements)
+		{
+			addRun(statement.face, statement.corner, statement.triangle);
+			switch(statement.keyword)
+			{
+			case Keyword::UseMtl:
+			{
+				auto it = material_map.find(firstWord(statement.argument));
+				int new_material_id = it != material_map.end() ? it->second : -1;
+				if(new_material_id != material_id)
+				{
+					has_new_faces = false;
+					material_id = new_material_id;
+				}
+				break;
+			}
+			case Keyword::MtlLib:
+				loadMaterialLibraries(statement.argument, mtl_basedir, materials, &material_map, err);
+				break;
+			case Keyword::Group:
+			case Keyword::Object:
+				infos.back().keep = has_new_faces;
+				infos.push_back(ShapeInfo());
+				has_new_faces = false;
+				name = statement.keyword == Keyword::Group ? groupName(statement.argument) :
+				                                             firstWord(statement.argument);
+				break;
+			}
+		}
+		addRun(chunk.face_sizes.size(), chunk.corners.size(), chunk.triangles);
+	}
+	infos.back().keep = has_new_faces || infos.back().triangles > 0;
+
+	std::vector<size_t> shape_slot(infos.size(), SIZE_MAX);
+	for(size_t i = 0; i < infos.size(); i++)
+	{
+		if(infos[i].keep)
+		{
+			shape_slot[i] = shapes->size();
+			tinyobj::shape_t shape;
+			shape.name = infos[i].name;
+			shape.mesh.indices.resize(infos[i].triangles * 3);
+			shape.mesh.num_face_vertices.assign(infos[i].triangles, 3);
+			shape.mesh.material_ids.resize(infos[i].triangles);
+			shapes->push_back(std::move(shape));
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Every chunk copies its vertices and triangulates its faces into the
+	// places the prefix sums gave it
+	///////////////////////////////////////////////////////////////////////
+	attrib->vertices.resize(positions * 3);
+	attrib->normals.resize(normals * 3);
+	attrib->texcoords.resize(texcoords * 2);
+	getThreadPool().parallelFor(chunks.size(), [&](size_t i) {
+		TRACE_SCOPE("Merge OBJ chunk");
+		const Chunk& chunk = chunks[i];
+		std::copy(chunk.positions.begin(), chunk.positions.end(), attrib->vertices.begin() + chunk.first_position * 3);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), attrib->normals.begin() + chunk.first_normal * 3);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+		          attrib->texcoords.begin() + chunk.first_texcoord * 2);
+		for(const Run& run : chunk.runs)
+		{
+			if(shape_slot[run.shape] == SIZE_MAX)
+			{
+				continue;
+			}
+			tinyobj::mesh_t& mesh = (*shapes)[shape_slot[run.shape]].mesh;
+			tinyobj::index_t* indices = &mesh.indices[0] + run.triangle * 3;
+			int* material_ids = &mesh.material_ids[0] + run.triangle;
+			const Corner* corners = &chunk.corners[run.corner];
+			for(size_t f = run.face_begin; f < run.face_end; f++)
+			{
+				// Triangle fan around the first corner
+				uint32_t size = chunk.face_sizes[f];
+				for(uint32_t k = 2; k < size; k++)
+				{
+					*indices++ = resolve(corners[0], chunk);
+					*indices++ = resolve(corners[k - 1], chunk);
+					*indices++ = resolve(corners[k], chunk);
+					*material_ids++ = run.material_id;
+				}
+				corners += size;
+			}
+		}
+	});
+	return true;
+}
+
+void benchmarkObjParser(const std::vector<std::string>& filenames, int repetitions)
+{
+	typedef std::chrono::steady_clock Clock;
+	std::cout << "OBJ parser benchmark, best of " << repetitions << ", " << getThreadPool().numberOfThreads() + 1
+	          << " threads\n";
+	for(const std::string& filename : filenames)
+	{
+		std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+		tinyobj::attrib_t attrib[2];
+		std::vector<tinyobj::shape_t> shapes[2];
+		std::vector<tinyobj::material_t> materials[2];
+		double best_ms[2] = { std::numeric_limits<double>::max(), std::numeric_limits<double>::max() };
+		bool ok[2] = { true, true };
+		for(int r = 0; r < repetitions; r++)
+		{
+			for(int parser = 0; parser < 2; parser++)
+			{
+				std::string err;
+				materials[parser].clear();
+				Clock::time_point start = Clock::now();
+				ok[parser] = parser == 0 ? tinyobj::LoadObj(&attrib[0], &shapes[0], &materials[0], &err,
+				                                            filename.c_str(), directory.c_str(), true) :
+				                           loadObj(&attrib[1], &shapes[1], &materials[1], &err, filename, directory);
+				double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+				best_ms[parser] = std::min(best_ms[parser], ms);
+			}
+		}
+
+		// The numbers may differ in the last bit, everything else must be identical
+		std::string mismatch;
+		float max_difference = 0.0f;
+		const std::vector<float>* streams[2][3] = {
+			{ &attrib[0].vertices, &attrib[0].normals, &attrib[0].texcoords },
+			{ &attrib[1].vertices, &attrib[1].normals, &attrib[1].texcoords }
+		};
+		for(int s = 0; s < 3; s++)
+		{
+			const std::vector<float>& a = *streams[0][s];
+			const std::vector<float>& b = *streams[1][s];
+			if(a.size() != b.size())
+			{
+				mismatch = "vertex count";
+				break;
+			}
+			for(size_t i = 0; i < a.size(); i++)
+			{
+				float scale = std::max(1.0f, std::fabs(a[i]));
+				max_difference = std::max(max_difference, std::fabs(a[i] - b[i]) / scale);
+			}
+		}
+		if(!ok[0] && !ok[1])
+		{
+			std::cout << filename << ": could not be loaded\n";
+			continue;
+		}
+		if(ok[0] != ok[1])
+		{
+			mismatch = "result";
+		}
+		else if(shapes[0].size() != shapes[1].size())
+		{
+			mismatch = "shape count";
+		}
+		for(size_t i = 0; mismatch.empty() && i < shapes[0].size(); i++)
+		{
+			const tinyobj::mesh_t& a = shapes[0][i].mesh;
+			const tinyobj::mesh_t& b = shapes[1][i].mesh;
+			if(shapes[0][i].name != shapes[1][i].name)
+			{
+				mismatch = "name of shape " + std::to_string(i);
+			}
+			else if(a.indices.size() != b.indices.size() || a.material_ids != b.material_ids
+			        || a.num_face_vertices != b.num_face_vertices
+			        || (!a.indices.empty()
+			            && memcmp(&a.indices[0], &b.indices[0], a.indices.size() * sizeof(tinyobj::index_t)) != 0))
+			{
+				mismatch = "faces of shape " + std::to_string(i);
+			}
+		}
+		if(mismatch.empty() && materials[0].size() != materials[1].size())
+		{
+			mismatch = "material count";
+		}
+
+		std::ostringstream line;
+		line.precision(1);
+		line << std::fixed << filename << ": tinyobj " << best_ms[0] << " ms, parallel " << best_ms[1] << " ms ("
+		     << best_ms[0] / std::max(best_ms[1], 1e-3) << "x), ";
+		if(mismatch.empty())
+		{
+			line << std::scientific << "identical up to " << max_difference << " relative\n";
+		}
+		else
+		{
+			line << "DIFFERENT " << mismatch << "\n";
+		}
+		std::cout << line.str() << std::flush;
+	}
+}
+} // namespace labhelper
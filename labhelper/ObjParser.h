@@ -0,0 +1,39 @@
+#pragma once
+
+#include <tiny_obj_loader.h>
+
+#include <string>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// OBJ parser producing the same attrib_t, shapes and materials as
+/// tinyobj::LoadObj with triangulation, but on all cores.
+///
+/// The file is memory mapped and split into chunks that end at line
+/// breaks. Every chunk is tokenized and its numbers converted on the
+/// thread pool, remembering negative (relative) indices and the positions
+/// of 'usemtl', 'mtllib', 'g' and 'o' lines. A short serial pass over those
+/// lines then decides which shape and material every run of faces goes to,
+/// and the prefix sums of the per-chunk counts tell each chunk where to
+/// write its vertices and triangles, which it again does in parallel.
+///
+/// Differences to tinyobj: 't' (subdivision tag) lines are ignored, ".5"
+/// reads as 0.5 rather than 0, and numbers are converted by our own code.
+/// Neither conversion is guaranteed to be correctly rounded, so a
+/// coordinate can differ from tinyobj's in the last bit.
+///////////////////////////////////////////////////////////////////////////
+bool loadObj(tinyobj::attrib_t* attrib,
+             std::vector<tinyobj::shape_t>* shapes,
+             std::vector<tinyobj::material_t>* materials,
+             std::string* err,
+             const std::string& filename,
+             const std::string& mtl_basedir);
+
+///////////////////////////////////////////////////////////////////////////
+/// Loads every file with tinyobj::LoadObj and with loadObj(), prints the
+/// best time of each and checks that both give the same result.
+///////////////////////////////////////////////////////////////////////////
+void benchmarkObjParser(const std::vector<std::string>& filenames, int repetitions);
+} // namespace labhelper
@@ -0,0 +1,254 @@
+#include "Profiler.h"
+#include "Trace.h"
+
+#include <imgui.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace labhelper
+{
+void GpuProfiler::beginFrame()
+{
+	m_stack.clear();
+	m_in_frame = enabled;
+	if(!m_in_frame)
+	{
+		return;
+	}
+	m_current = (m_current + 1) % FRAMES_IN_FLIGHT;
+	Frame& frame = m_frames[m_current];
+	// These queries were issued FRAMES_IN_FLIGHT frames ago
+	resolve(frame);
+	frame.scopes.clear();
+	frame.used_queries = 0;
+	frame.number = m_frame_number++;
+	if(!m_calibrated || frame.number - m_calibrated_frame >= HISTORY_LENGTH)
+	{
+		calibrate();
+	}
+}
+
+void GpuProfiler::calibrate()
+{
+	GLint64 gpu_now = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+	m_gpu_clock_offset = int64_t(gpu_now) - int64_t(traceNow());
+	m_calibrated_frame = m_frame_number;
+	m_calibrated = true;
+}
+
+void GpuProfiler::endFrame()
+{
+	if(!m_in_frame)
+	{
+		return;
+	}
+	while(!m_stack.empty())
+	{
+		endScope();
+	}
+	m_frames[m_current].pending = !m_frames[m_current].scopes.empty();
+	m_in_frame = false;
+}
+
+void GpuProfiler::beginScope(const char* name)
+{
+	if(!m_in_frame)
+	{
+		return;
+	}
+	Frame& frame = m_frames[m_current];
+	Scope scope;
+	scope.name = name;
+	scope.pass = findPass(name);
+	scope.begin_query = acquireQuery(frame);
+	scope.end_query = acquireQuery(frame);
+	glQueryCounter(scope.begin_query, GL_TIMESTAMP);
+	m_stack.push_back(int(frame.scopes.size()));
+	frame.scopes.push_back(scope);
+}
+
+void GpuProfiler::endScope()
+{
+	if(!m_in_frame || m_stack.empty())
+	{
+		return;
+	}
+	Frame& frame = m_frames[m_current];
+	frame.last_query = frame.scopes[m_stack.back()].end_query;
+	glQueryCounter(frame.last_query, GL_TIMESTAMP);
+	m_stack.pop_back();
+}
+
+GLuint GpuProfiler::acquireQuery(Frame& frame)
+{
+	if(frame.used_queries == frame.queries.size())
+	{
+		GLuint query;
+		glGenQueries(1, &query);
+		frame.queries.push_back(query);
+	}
+	return frame.queries[frame.used_queries++];
+}
+
+int GpuProfiler::findPass(const char* name)
+{
+	auto it = m_pass_lookup.find(name);
+	if(it != m_pass_lookup.end())
+	{
+		return it->second;
+	}
+	int index = int(m_passes.size());
+	m_passes.push_back(PassStats());
+	m_passes.back().name = name;
+	m_pass_lookup[name] = index;
+	return index;
+}
+
+void GpuProfiler::resolve(Frame& frame)
+{
+	if(!frame.pending)
+	{
+		return;
+	}
+	frame.pending = false;
+
+	// Timestamps complete in order, if the last one is there all of them are
+	GLuint available = 0;
+	glGetQueryObjectuiv(frame.last_query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if(!available)
+	{
+		m_dropped_frames++;
+		return;
+	}
+
+	// A pass may be entered several times per frame, report the sum
+	m_frame_totals.assign(m_passes.size(), -1.0f);
+	for(const Scope& scope : frame.scopes)
+	{
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(scope.begin_query, GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(scope.end_query, GL_QUERY_RESULT, &end);
+		float ms = float(double(end - begin) * 1e-6);
+		float& total = m_frame_totals[scope.pass];
+		total = std::max(total, 0.0f) + ms;
+		traceGpuEvent(scope.name, uint64_t(int64_t(begin) - m_gpu_clock_offset),
+		              uint64_t(int64_t(end) - m_gpu_clock_offset));
+	}
+	for(size_t i = 0; i < m_passes.size(); i++)
+	{
+		if(m_frame_totals[i] >= 0.0f)
+		{
+			push(m_passes[i], m_frame_totals[i], frame.number);
+			if(record)
+			{
+				Sample sample = { frame.number, int(i), m_frame_totals[i] };
+				m_recorded.push_back(sample);
+			}
+		}
+	}
+}
+
+void GpuProfiler::flush()
+{
+	glFinish();
+	// Oldest first
+	for(int i = 1; i <= FRAMES_IN_FLIGHT; i++)
+	{
+		resolve(m_frames[(m_current + i) % FRAMES_IN_FLIGHT]);
+	}
+}
+
+void GpuProfiler::push(PassStats& pass, float ms, uint64_t frame)
+{
+	pass.history[pass.head] = ms;
+	pass.frame[pass.head] = frame;
+	pass.head = (pass.head + 1) % HISTORY_LENGTH;
+	pass.count = std::min(pass.count + 1, int(HISTORY_LENGTH));
+	pass.last = ms;
+
+	float sorted[HISTORY_LENGTH];
+	std::copy(pass.history, pass.history + pass.count, sorted);
+	std::sort(sorted, sorted + pass.count);
+	float sum = 0.0f;
+	for(int i = 0; i < pass.count; i++)
+	{
+		sum += sorted[i];
+	}
+	pass.min = sorted[0];
+	pass.avg = sum / pass.count;
+	pass.p99 = sorted[std::min(pass.count - 1, int(pass.count * 0.99f))];
+}
+
+bool GpuProfiler::exportCSV(std::string filename) const
+{
+	if(filename.empty())
+	{
+		auto tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+		std::ostringstream name;
+		name << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << "_gpuprofile.csv";
+		filename = name.str();
+	}
+	std::ofstream file(filename);
+	if(!file)
+	{
+		return false;
+	}
+	file << "frame,pass,ms\n";
+	for(const PassStats& pass : m_passes)
+	{
+		// Oldest sample first
+		int first = pass.count < HISTORY_LENGTH ? 0 : pass.head;
+		for(int i = 0; i < pass.count; i++)
+		{
+			int idx = (first + i) % HISTORY_LENGTH;
+			file << pass.frame[idx] << "," << pass.name << "," << pass.history[idx] << "\n";
+		}
+	}
+	return true;
+}
+
+void GpuProfiler::drawGui()
+{
+	ImGui::Checkbox("Profile GPU", &enabled);
+	for(const PassStats& pass : m_passes)
+	{
+		if(pass.count == 0)
+		{
+			continue;
+		}
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "%.3f ms", pass.last);
+		int offset = pass.count < HISTORY_LENGTH ? 0 : pass.head;
+		ImGui::PlotLines(pass.name.c_str(), pass.history, pass.count, offset, overlay, 0.0f, std::max(pass.p99 * 1.25f, 0.001f),
+		                 ImVec2(0, 40));
+		ImGui::Text("  min %.3f  avg %.3f  p99 %.3f ms", pass.min, pass.avg, pass.p99);
+	}
+	ImGui::Text("Dropped frames: %llu", (unsigned long long)m_dropped_frames);
+	if(ImGui::Button("Export CSV"))
+	{
+		exportCSV();
+	}
+}
+
+void GpuProfiler::free()
+{
+	for(Frame& frame : m_frames)
+	{
+		if(!frame.queries.empty())
+		{
+			glDeleteQueries(GLsizei(frame.queries.size()), frame.queries.data());
+		}
+		frame.queries.clear();
+		frame.scopes.clear();
+		frame.used_queries = 0;
+		frame.pending = false;
+	}
+}
+} // namespace labhelper
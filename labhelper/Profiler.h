@@ -0,0 +1,155 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Measures GPU time of render passes with timer queries.
+///
+/// Queries are written into one of FRAMES_IN_FLIGHT query sets and read back
+/// FRAMES_IN_FLIGHT frames later, so reading the results never waits for the
+/// GPU. If a set is still not done when it is needed again that frame is
+/// dropped instead. Every scope is a pair of GL_TIMESTAMP queries, which,
+/// unlike GL_TIME_ELAPSED, may be nested. Resolved scopes are also sent to
+/// the GPU track of the CPU trace (see Trace.h).
+///
+/// Usage:
+///	profiler.beginFrame();
+///	{
+///		GpuProfileScope scope(profiler, "Scene");
+///		drawScene();
+///	}
+///	profiler.endFrame();
+///////////////////////////////////////////////////////////////////////////
+class GpuProfiler
+{
+public:
+	static const int FRAMES_IN_FLIGHT = 3;
+	static const int HISTORY_LENGTH = 256;
+
+	struct PassStats
+	{
+		std::string name;
+		// Rolling history in milliseconds, `head` is the next slot to write
+		float history[HISTORY_LENGTH];
+		uint64_t frame[HISTORY_LENGTH];
+		int count = 0;
+		int head = 0;
+		float last = 0.0f;
+		float min = 0.0f;
+		float avg = 0.0f;
+		float p99 = 0.0f;
+	};
+
+	struct Sample
+	{
+		uint64_t frame;
+		int pass;
+		float ms;
+	};
+
+	bool enabled = true;
+	// Keep every resolved sample until clearRecording(), e.g. for benchmarks
+	bool record = false;
+
+	void beginFrame();
+	void endFrame();
+
+	// Names are kept as pointers for the trace, pass string literals
+	void beginScope(const char* name);
+	void endScope();
+
+	const std::vector<PassStats>& passes() const { return m_passes; }
+	// Frames whose queries were not ready in time
+	uint64_t droppedFrames() const { return m_dropped_frames; }
+	// Number the next beginFrame() gives its frame, as used in Sample::frame
+	uint64_t frameNumber() const { return m_frame_number; }
+
+	const std::vector<Sample>& recordedSamples() const { return m_recorded; }
+	void clearRecording() { m_recorded.clear(); }
+
+	///////////////////////////////////////////////////////////////////////
+	/// Waits for the GPU and resolves all frames still in flight. Stalls,
+	/// only call it when done measuring.
+	///////////////////////////////////////////////////////////////////////
+	void flush();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Writes the history of all passes as "frame,pass,ms" rows. An empty
+	/// filename writes to <timestamp>_gpuprofile.csv.
+	///////////////////////////////////////////////////////////////////////
+	bool exportCSV(std::string filename = std::string()) const;
+
+	///////////////////////////////////////////////////////////////////////
+	/// Draws graphs and min/avg/p99 of every pass into the current ImGui window
+	///////////////////////////////////////////////////////////////////////
+	void drawGui();
+
+	// Deletes all query objects, call while the context is still alive
+	void free();
+
+private:
+	struct Scope
+	{
+		const char* name;
+		int pass;
+		GLuint begin_query;
+		GLuint end_query;
+	};
+	struct Frame
+	{
+		std::vector<Scope> scopes;
+		std::vector<GLuint> queries;
+		size_t used_queries = 0;
+		// The end query issued last, an outer scope's is issued after its inner ones'
+		GLuint last_query = 0;
+		uint64_t number = 0;
+		bool pending = false;
+	};
+
+	GLuint acquireQuery(Frame& frame);
+	void resolve(Frame& frame);
+	void push(PassStats& pass, float ms, uint64_t frame);
+	void calibrate();
+	int findPass(const char* name);
+
+	Frame m_frames[FRAMES_IN_FLIGHT];
+	int m_current = 0;
+	uint64_t m_frame_number = 0;
+	uint64_t m_dropped_frames = 0;
+	// GL_TIMESTAMP minus traceNow(), refreshed now and then to follow clock drift
+	int64_t m_gpu_clock_offset = 0;
+	uint64_t m_calibrated_frame = 0;
+	bool m_calibrated = false;
+	bool m_in_frame = false;
+	std::vector<int> m_stack;
+	std::vector<PassStats> m_passes;
+	std::unordered_map<std::string, int> m_pass_lookup;
+	std::vector<float> m_frame_totals;
+	std::vector<Sample> m_recorded;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Times everything submitted to GL during its lifetime.
+///////////////////////////////////////////////////////////////////////////
+class GpuProfileScope
+{
+public:
+	GpuProfileScope(GpuProfiler& profiler, const char* name) : m_profiler(profiler)
+	{
+		m_profiler.beginScope(name);
+	}
+	~GpuProfileScope() { m_profiler.endScope(); }
+
+private:
+	GpuProfileScope(const GpuProfileScope&);
+	GpuProfileScope& operator=(const GpuProfileScope&);
+	GpuProfiler& m_profiler;
+};
+} // namespace labhelper
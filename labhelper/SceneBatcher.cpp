@@ -0,0 +1,356 @@
+#include "SceneBatcher.h"
+#include "GLState.h"
+#include "Model.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <imgui.h>
+
+namespace labhelper
+{
+namespace
+{
+	// Appends `bytes` of `source` to `destination` at `offset`
+	void copyBuffer(GLuint source, GLuint destination, size_t offset, size_t bytes)
+	{
+		if(bytes == 0)
+		{
+			return;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, source);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, bytes);
+	}
+
+	GLuint createBuffer(GLenum target, size_t bytes, const void* data)
+	{
+		GLuint buffer;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(target, buffer);
+		glBufferData(target, bytes, data, GL_STATIC_DRAW);
+		glBindBuffer(target, 0);
+		return buffer;
+	}
+} // namespace
+
+bool SceneBatcher::supported()
+{
+	// Without base instance support the commands' base_instance must be zero,
+	// and every draw would read the first draw's data
+	return (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+}
+
+void SceneBatcher::update(const std::vector<Object>& objects)
+{
+	std::vector<const Model*> models;
+	std::vector<glm::mat4> model_matrices;
+	for(const Object& object : objects)
+	{
+		if(object.model != nullptr)
+		{
+			models.push_back(object.model);
+			model_matrices.push_back(object.model_matrix);
+		}
+	}
+	if(models != m_models)
+	{
+		m_models = models;
+		m_model_matrices = model_matrices;
+		build();
+		writeDrawData();
+	}
+	else if(model_matrices != m_model_matrices)
+	{
+		m_model_matrices = model_matrices;
+		writeDrawData();
+	}
+}
+
+void SceneBatcher::build()
+{
+	TRACE_FUNCTION();
+	freeBuffers();
+	m_draws.clear();
+	m_groups.clear();
+	if(m_models.empty())
+	{
+		return;
+	}
+	m_packed_vertices = m_models[0]->m_packed_vertices;
+
+	///////////////////////////////////////////////////////////////////////
+	// Where every model's vertices, indices and materials go, and a draw
+	// per batch (per mesh with packed vertices, which need its bounds)
+	///////////////////////////////////////////////////////////////////////
+	size_t number_of_vertices = 0, number_of_indices = 0, number_of_materials = 0;
+	for(uint32_t object = 0; object < m_models.size(); object++)
+	{
+		const Model* model = m_models[object];
+		for(const MaterialBatch& batch : model->m_batches)
+		{
+			const Material& material = model->m_materials[batch.m_material_idx];
+			Draw draw;
+			draw.object = object;
+			draw.material = uint32_t(number_of_materials + batch.m_material_idx);
+			draw.color_texture = material.m_color_texture.valid ? material.m_color_texture.gl_id : 0;
+			draw.emission_texture = material.m_emission_texture.valid ? material.m_emission_texture.gl_id : 0;
+			draw.command.instance_count = 1;
+			draw.command.base_vertex = int32_t(number_of_vertices);
+			draw.position_offset = glm::vec3(0.0f);
+			draw.position_scale = glm::vec3(1.0f);
+			if(!m_packed_vertices)
+			{
+				draw.command.count = batch.m_number_of_indices;
+				draw.command.first_index = uint32_t(number_of_indices + batch.m_start_index);
+				m_draws.push_back(draw);
+				continue;
+			}
+			for(uint32_t i = batch.m_first_mesh; i < batch.m_first_mesh + batch.m_number_of_meshes; i++)
+			{
+				const Mesh& mesh = model->m_meshes[i];
+				draw.command.count = mesh.m_number_of_indices;
+				draw.command.first_index = uint32_t(number_of_indices + mesh.m_start_index);
+				draw.position_offset = mesh.m_bounds_min;
+				draw.position_scale = mesh.m_bounds_max - mesh.m_bounds_min;
+				m_draws.push_back(draw);
+			}
+		}
+		number_of_vertices += model->m_geometry.number_of_vertices;
+		number_of_indices += model->m_geometry.number_of_indices;
+		number_of_materials += model->m_materials.size();
+	}
+
+	// Draws with the same material window and textures next to each other
+	std::stable_sort(m_draws.begin(), m_draws.end(), [](const Draw& a, const Draw& b) {
+		if(a.material / MATERIAL_BLOCK_SIZE != b.material / MATERIAL_BLOCK_SIZE)
+		{
+			return a.material / MATERIAL_BLOCK_SIZE < b.material / MATERIAL_BLOCK_SIZE;
+		}
+		if(a.color_texture != b.color_texture)
+		{
+			return a.color_texture < b.color_texture;
+		}
+		return a.emission_texture < b.emission_texture;
+	});
+	std::vector<DrawCommand> commands;
+	for(uint32_t i = 0; i < m_draws.size(); i++)
+	{
+		Draw& draw = m_draws[i];
+		draw.command.base_instance = i;
+		commands.push_back(draw.command);
+
+		const uint32_t window = draw.material / MATERIAL_BLOCK_SIZE;
+		if(m_groups.empty() || m_groups.back().material_window != window
+		   || m_groups.back().color_texture != draw.color_texture
+		   || m_groups.back().emission_texture != draw.emission_texture)
+		{
+			Group group = { window, draw.color_texture, draw.emission_texture, i, 0 };
+			m_groups.push_back(group);
+		}
+		m_groups.back().number_of_commands++;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Shared buffers, filled from the models' own on the GPU
+	///////////////////////////////////////////////////////////////////////
+	const size_t windows = (number_of_materials + MATERIAL_BLOCK_SIZE - 1) / MATERIAL_BLOCK_SIZE;
+	const size_t vertex_sizes[3] = { m_packed_vertices ? sizeof(PackedVertex) : sizeof(glm::vec3), sizeof(glm::vec3),
+		                             sizeof(glm::vec2) };
+	const int number_of_streams = m_packed_vertices ? 1 : 3;
+	for(int stream = 0; stream < number_of_streams; stream++)
+	{
+		m_vertex_buffers[stream] =
+		    createBuffer(GL_ARRAY_BUFFER, number_of_vertices * vertex_sizes[stream], nullptr);
+	}
+	m_index_buffer = createBuffer(GL_COPY_WRITE_BUFFER, number_of_indices * sizeof(uint32_t), nullptr);
+	m_materials_buffer = createBuffer(GL_UNIFORM_BUFFER, windows * MATERIAL_BLOCK_SIZE * sizeof(MaterialParameters),
+	                                  nullptr);
+	m_command_buffer = createBuffer(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), commands.data());
+	m_draw_data_buffer = createBuffer(GL_ARRAY_BUFFER, m_draws.size() * sizeof(DrawData), nullptr);
+
+	size_t vertex_offset = 0, index_offset = 0, material_offset = 0;
+	for(const Model* model : m_models)
+	{
+		const size_t vertices = model->m_geometry.number_of_vertices;
+		const size_t indices = model->m_geometry.number_of_indices;
+		const GLuint streams[3] = { m_packed_vertices ? model->m_packed_vertices_bo : model->m_positions_bo,
+			                        model->m_normals_bo, model->m_texture_coordinates_bo };
+		for(int stream = 0; stream < number_of_streams; stream++)
+		{
+			copyBuffer(streams[stream], m_vertex_buffers[stream], vertex_offset * vertex_sizes[stream],
+			           vertices * vertex_sizes[stream]);
+		}
+		copyBuffer(model->m_indices_bo, m_index_buffer, index_offset * sizeof(uint32_t), indices * sizeof(uint32_t));
+		copyBuffer(model->m_materials_bo, m_materials_buffer, material_offset * sizeof(MaterialParameters),
+		           model->m_materials.size() * sizeof(MaterialParameters));
+		vertex_offset += vertices;
+		index_offset += indices;
+		material_offset += model->m_materials.size();
+	}
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	///////////////////////////////////////////////////////////////////////
+	// Vertex attributes as in uploadGeometry(), then the per-draw ones
+	///////////////////////////////////////////////////////////////////////
+	glGenVertexArrays(1, &m_vao);
+	getGLState().bindVertexArray(m_vao);
+	if(m_packed_vertices)
+	{
+		const GLsizei stride = sizeof(PackedVertex);
+		glBindBuffer(GL_ARRAY_BUFFER, m_vertex_buffers[0]);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, true, stride, (const void*)offsetof(PackedVertex, position));
+		glVertexAttribPointer(1, 2, GL_SHORT, true, stride, (const void*)offsetof(PackedVertex, normal));
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, false, stride,
+		                      (const void*)offsetof(PackedVertex, texture_coordinate));
+	}
+	else
+	{
+		const GLint components[3] = { 3, 3, 2 };
+		for(int stream = 0; stream < 3; stream++)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, m_vertex_buffers[stream]);
+			glVertexAttribPointer(stream, components[stream], GL_FLOAT, false, 0, 0);
+		}
+	}
+	for(GLuint location = 0; location < 3; location++)
+	{
+		glEnableVertexAttribArray(location);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, m_draw_data_buffer);
+	const GLsizei stride = sizeof(DrawData);
+	for(GLuint column = 0; column < 4; column++)
+	{
+		glVertexAttribPointer(3 + column, 4, GL_FLOAT, false, stride,
+		                      (const void*)(offsetof(DrawData, model_matrix) + column * sizeof(glm::vec4)));
+	}
+	for(GLuint column = 0; column < 3; column++)
+	{
+		glVertexAttribPointer(7 + column, 3, GL_FLOAT, false, stride,
+		                      (const void*)(offsetof(DrawData, normal_matrix) + column * sizeof(glm::vec4)));
+	}
+	glVertexAttribPointer(10, 3, GL_FLOAT, false, stride, (const void*)offsetof(DrawData, position_offset));
+	glVertexAttribPointer(11, 3, GL_FLOAT, false, stride, (const void*)offsetof(DrawData, position_scale));
+	glVertexAttribIPointer(12, 1, GL_INT, stride, (const void*)offsetof(DrawData, material_index));
+	for(GLuint location = 3; location <= 12; location++)
+	{
+		glEnableVertexAttribArray(location);
+		// Fetched at the command's baseInstance
+		glVertexAttribDivisor(location, 1);
+	}
+	// Part of the vertex array's state, so not unbound below
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+
+	getGLState().bindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void SceneBatcher::writeDrawData()
+{
+	if(m_draws.empty())
+	{
+		return;
+	}
+	std::vector<glm::mat3> normal_matrices;
+	for(const glm::mat4& model_matrix : m_model_matrices)
+	{
+		normal_matrices.push_back(glm::inverse(glm::transpose(glm::mat3(model_matrix))));
+	}
+	std::vector<DrawData> data(m_draws.size());
+	for(size_t i = 0; i < m_draws.size(); i++)
+	{
+		const Draw& draw = m_draws[i];
+		DrawData& d = data[i];
+		d.model_matrix = m_model_matrices[draw.object];
+		for(int column = 0; column < 3; column++)
+		{
+			d.normal_matrix[column] = glm::vec4(normal_matrices[draw.object][column], 0.0f);
+		}
+		d.position_offset = glm::vec4(draw.position_offset, 0.0f);
+		d.position_scale = glm::vec4(draw.position_scale, 0.0f);
+		d.material_index = draw.material % MATERIAL_BLOCK_SIZE;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, m_draw_data_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, data.size() * sizeof(DrawData), data.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void SceneBatcher::draw(bool submitMaterials)
+{
+	m_multi_draws = 0;
+	if(m_draws.empty())
+	{
+		return;
+	}
+	GLStateCache& gl = getGLState();
+	gl.bindVertexArray(m_vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_command_buffer);
+	if(!submitMaterials)
+	{
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, GLsizei(m_draws.size()), 0);
+		m_multi_draws++;
+	}
+	else
+	{
+		uint32_t material_window = ~0u;
+		for(const Group& group : m_groups)
+		{
+			if(group.material_window != material_window)
+			{
+				const GLsizeiptr size = MATERIAL_BLOCK_SIZE * sizeof(MaterialParameters);
+				glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, m_materials_buffer,
+				                  group.material_window * size, size);
+				material_window = group.material_window;
+			}
+			if(group.color_texture != 0)
+			{
+				gl.bindTexture(0, GL_TEXTURE_2D, group.color_texture);
+			}
+			if(group.emission_texture != 0)
+			{
+				gl.bindTexture(5, GL_TEXTURE_2D, group.emission_texture);
+			}
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+			                            (const void*)(size_t(group.first_command) * sizeof(DrawCommand)),
+			                            GLsizei(group.number_of_commands), 0);
+			m_multi_draws++;
+		}
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void SceneBatcher::drawGui()
+{
+	ImGui::Text("Models: %d, draws: %d, multi-draws: %d", int(m_models.size()), int(m_draws.size()),
+	            int(m_multi_draws));
+}
+
+void SceneBatcher::freeBuffers()
+{
+	if(m_vao != 0)
+	{
+		// A new vertex array may get the same name, the state cache must not skip binding it
+		getGLState().bindVertexArray(0);
+		glDeleteVertexArrays(1, &m_vao);
+		m_vao = 0;
+	}
+	glDeleteBuffers(3, m_vertex_buffers);
+	glDeleteBuffers(1, &m_index_buffer);
+	glDeleteBuffers(1, &m_materials_buffer);
+	glDeleteBuffers(1, &m_command_buffer);
+	glDeleteBuffers(1, &m_draw_data_buffer);
+	m_vertex_buffers[0] = m_vertex_buffers[1] = m_vertex_buffers[2] = 0;
+	m_index_buffer = m_materials_buffer = m_command_buffer = m_draw_data_buffer = 0;
+}
+
+void SceneBatcher::free()
+{
+	freeBuffers();
+	m_models.clear();
+	m_model_matrices.clear();
+	m_draws.clear();
+	m_groups.clear();
+}
+} // namespace labhelper
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace labhelper
+{
+class Model;
+
+///////////////////////////////////////////////////////////////////////////
+/// Draws several models with a few glMultiDrawElementsIndirect calls
+/// instead of one glDrawElements per batch and model.
+///
+/// The models' vertex, index and material buffers are copied, on the GPU,
+/// into shared ones. Every MaterialBatch (every mesh, with packed vertices)
+/// becomes an indirect draw command. The command's baseInstance selects its
+/// per-draw data: model matrix, normal matrix, mesh bounds and material,
+/// read by the vertex shader as instanced attributes (see MULTI_DRAW in
+/// shading.vert). The commands are sorted by texture, so one multi-draw is
+/// issued per distinct set of material textures; the depth pass is one.
+///
+/// Needs GL_ARB_multi_draw_indirect (OpenGL 4.3) and, for the per-draw
+/// data, GL_ARB_base_instance (OpenGL 4.2), see supported().
+///
+/// Usage:
+///	batcher.update({ { model, modelMatrix }, ... }); // once per frame
+///	gl.useProgram(batchedProgram); // built with "#define MULTI_DRAW"
+///	batcher.draw(true);
+///////////////////////////////////////////////////////////////////////////
+class SceneBatcher
+{
+public:
+	struct Object
+	{
+		const Model* model;
+		glm::mat4 model_matrix;
+	};
+
+	static bool supported();
+
+	///////////////////////////////////////////////////////////////////////
+	/// Objects without a model (still loading) are skipped. The shared
+	/// buffers are rebuilt when the models change, the per-draw data when
+	/// a matrix does. All models must be uploaded, and all or none must
+	/// have packed vertices.
+	///////////////////////////////////////////////////////////////////////
+	void update(const std::vector<Object>& objects);
+
+	// Binds the materials and textures unless only depth is drawn
+	void draw(bool submitMaterials);
+
+	void drawGui();
+	void free();
+
+private:
+	// One indirect command, as glMultiDrawElementsIndirect reads it
+	struct DrawCommand
+	{
+		uint32_t count;
+		uint32_t instance_count;
+		uint32_t first_index;
+		int32_t base_vertex;
+		uint32_t base_instance;
+	};
+	// Per-draw vertex attributes, locations 3 to 12
+	struct DrawData
+	{
+		glm::mat4 model_matrix;
+		glm::vec4 normal_matrix[3];
+		glm::vec4 position_offset;
+		glm::vec4 position_scale;
+		uint32_t material_index;
+		uint32_t pad[3];
+	};
+	struct Draw
+	{
+		uint32_t object;
+		uint32_t material;
+		uint32_t color_texture;
+		uint32_t emission_texture;
+		DrawCommand command;
+		glm::vec3 position_offset;
+		glm::vec3 position_scale;
+	};
+	// Consecutive commands drawn with the same material window and textures
+	struct Group
+	{
+		uint32_t material_window;
+		uint32_t color_texture;
+		uint32_t emission_texture;
+		uint32_t first_command;
+		uint32_t number_of_commands;
+	};
+
+	void build();
+	void writeDrawData();
+	void freeBuffers();
+
+	std::vector<const Model*> m_models;
+	std::vector<glm::mat4> m_model_matrices;
+	std::vector<Draw> m_draws;
+	std::vector<Group> m_groups;
+	bool m_packed_vertices = false;
+	uint32_t m_multi_draws = 0;
+
+	GLuint m_vao = 0;
+	GLuint m_vertex_buffers[3] = { 0, 0, 0 };
+	GLuint m_index_buffer = 0;
+	GLuint m_materials_buffer = 0;
+	GLuint m_command_buffer = 0;
+	GLuint m_draw_data_buffer = 0;
+};
+} // namespace labhelper
@@ -0,0 +1,212 @@
+#include "ShaderProgram.h"
+#include "labhelper.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace labhelper
+{
+namespace
+{
+	std::unordered_map<GLuint, std::unique_ptr<ProgramReflection>> g_reflections;
+	uint32_t g_next_generation = 1;
+} // namespace
+
+uint64_t ProgramReflection::s_uniform_updates = 0;
+uint64_t ProgramReflection::s_redundant_updates_skipped = 0;
+
+ProgramReflection::ProgramReflection(GLuint program) : m_program(program), m_generation(g_next_generation++)
+{
+	GLint max_name_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
+	GLint max_block_name_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &max_block_name_length);
+	std::vector<char> name(std::max(max_name_length, max_block_name_length) + 1);
+
+	///////////////////////////////////////////////////////////////////////
+	// Uniforms in the default block. Members of uniform blocks have no
+	// location and are set through buffers instead.
+	///////////////////////////////////////////////////////////////////////
+	GLint nof_uniforms = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &nof_uniforms);
+	for(GLint i = 0; i < nof_uniforms; i++)
+	{
+		UniformInfo info;
+		GLsizei length = 0;
+		glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), &length, &info.array_size, &info.type,
+		                   name.data());
+		info.name = std::string(name.data(), length);
+		info.location = glGetUniformLocation(program, info.name.c_str());
+		info.has_value = false;
+		if(info.location < 0)
+		{
+			continue;
+		}
+		int handle = int(m_uniforms.size());
+		m_uniforms.push_back(info);
+		m_uniform_lookup[info.name] = handle;
+		// Arrays are reported as "name[0]", make them reachable as "name" too
+		size_t bracket = info.name.find('[');
+		if(bracket != std::string::npos)
+		{
+			m_uniform_lookup[info.name.substr(0, bracket)] = handle;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Uniform blocks
+	///////////////////////////////////////////////////////////////////////
+	GLint nof_blocks = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &nof_blocks);
+	for(GLint i = 0; i < nof_blocks; i++)
+	{
+		UniformBlockInfo info;
+		GLsizei length = 0;
+		glGetActiveUniformBlockName(program, GLuint(i), GLsizei(name.size()), &length, name.data());
+		info.name = std::string(name.data(), length);
+		info.index = GLuint(i);
+		glGetActiveUniformBlockiv(program, info.index, GL_UNIFORM_BLOCK_DATA_SIZE, &info.data_size);
+		glGetActiveUniformBlockiv(program, info.index, GL_UNIFORM_BLOCK_BINDING, &info.binding);
+		m_block_lookup[info.name] = int(m_blocks.size());
+		m_blocks.push_back(info);
+	}
+}
+
+int ProgramReflection::find(const std::string& name) const
+{
+	auto it = m_uniform_lookup.find(name);
+	return it != m_uniform_lookup.end() ? it->second : -1;
+}
+
+int ProgramReflection::findBlock(const std::string& name) const
+{
+	auto it = m_block_lookup.find(name);
+	return it != m_block_lookup.end() ? it->second : -1;
+}
+
+bool ProgramReflection::changed(int handle, const void* data, size_t size)
+{
+	if(handle < 0)
+	{
+		return false;
+	}
+	UniformInfo& uniform = m_uniforms[handle];
+	if(uniform.has_value && std::memcmp(uniform.value, data, size) == 0)
+	{
+		s_redundant_updates_skipped++;
+		return false;
+	}
+	std::memcpy(uniform.value, data, size);
+	uniform.has_value = true;
+	s_uniform_updates++;
+	return true;
+}
+
+void ProgramReflection::set(int handle, const float value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniform1f(m_program, m_uniforms[handle].location, value);
+}
+void ProgramReflection::set(int handle, const GLint value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniform1i(m_program, m_uniforms[handle].location, value);
+}
+void ProgramReflection::set(int handle, const GLuint value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniform1ui(m_program, m_uniforms[handle].location, value);
+}
+void ProgramReflection::set(int handle, const bool value)
+{
+	set(handle, GLint(value ? 1 : 0));
+}
+void ProgramReflection::set(int handle, const glm::vec2& value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniform2fv(m_program, m_uniforms[handle].location, 1, &value.x);
+}
+void ProgramReflection::set(int handle, const glm::vec3& value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniform3fv(m_program, m_uniforms[handle].location, 1, &value.x);
+}
+void ProgramReflection::set(int handle, const glm::vec4& value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniform4fv(m_program, m_uniforms[handle].location, 1, &value.x);
+}
+void ProgramReflection::set(int handle, const glm::mat3& value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniformMatrix3fv(m_program, m_uniforms[handle].location, 1, false, &value[0].x);
+}
+void ProgramReflection::set(int handle, const glm::mat4& value)
+{
+	if(changed(handle, &value, sizeof(value)))
+		glProgramUniformMatrix4fv(m_program, m_uniforms[handle].location, 1, false, &value[0].x);
+}
+void ProgramReflection::set(int handle, const uint32_t nof_values, const glm::vec3* values)
+{
+	// Arrays are not cached, they don't fit in the value cache
+	if(handle < 0)
+	{
+		return;
+	}
+	m_uniforms[handle].has_value = false;
+	s_uniform_updates++;
+	glProgramUniform3fv(m_program, m_uniforms[handle].location, nof_values, (const float*)values);
+}
+
+void ProgramReflection::invalidate()
+{
+	for(auto& uniform : m_uniforms)
+	{
+		uniform.has_value = false;
+	}
+}
+
+ProgramReflection* reflectShaderProgram(GLuint program)
+{
+	std::unique_ptr<ProgramReflection>& reflection = g_reflections[program];
+	reflection.reset(new ProgramReflection(program));
+	return reflection.get();
+}
+
+ProgramReflection* getProgramReflection(GLuint program)
+{
+	auto it = g_reflections.find(program);
+	return it != g_reflections.end() ? it->second.get() : nullptr;
+}
+
+void forgetProgramReflection(GLuint program)
+{
+	g_reflections.erase(program);
+}
+
+bool ShaderProgram::load(const std::string& vertexShader,
+                         const std::string& fragmentShader,
+                         bool allow_errors,
+                         const std::string& defines)
+{
+	GLuint program = loadShaderProgram(vertexShader, fragmentShader, allow_errors, defines);
+	if(program == 0)
+	{
+		return false;
+	}
+	free();
+	id = program;
+	return true;
+}
+
+void ShaderProgram::free()
+{
+	if(id != 0)
+	{
+		forgetProgramReflection(id);
+		glDeleteProgram(id);
+		id = 0;
+	}
+}
+} // namespace labhelper
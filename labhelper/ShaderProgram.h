@@ -0,0 +1,173 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+namespace labhelper
+{
+struct UniformInfo
+{
+	std::string name;
+	GLint location;
+	GLenum type;
+	GLint array_size;
+	// Last value set through this table, used to skip redundant glProgramUniform calls
+	bool has_value;
+	uint8_t value[sizeof(glm::mat4)];
+};
+
+struct UniformBlockInfo
+{
+	std::string name;
+	GLuint index;
+	GLint data_size;
+	GLint binding;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// All active uniforms and uniform blocks of a linked program, queried once
+/// at link time and stored in a hashed table. Uniforms are addressed by
+/// handle (an index into the table); set() uses the cached location and
+/// skips the GL call when the value is unchanged since the last set().
+///
+/// Note: the value cache only knows about values set through this table.
+/// Don't mix it with raw glUniform* calls on the same uniform.
+///////////////////////////////////////////////////////////////////////////
+class ProgramReflection
+{
+public:
+	explicit ProgramReflection(GLuint program);
+
+	GLuint program() const { return m_program; }
+	// Unique for every reflected program, also across relinks of the same id
+	uint32_t generation() const { return m_generation; }
+
+	// Returns the handle of a uniform, or -1 if it is not an active uniform
+	int find(const std::string& name) const;
+	int findBlock(const std::string& name) const;
+
+	const std::vector<UniformInfo>& uniforms() const { return m_uniforms; }
+	const std::vector<UniformBlockInfo>& blocks() const { return m_blocks; }
+
+	// Setting handle -1 is a no-op, like setting location -1 in GL
+	void set(int handle, const float value);
+	void set(int handle, const GLint value);
+	void set(int handle, const GLuint value);
+	void set(int handle, const bool value);
+	void set(int handle, const glm::vec2& value);
+	void set(int handle, const glm::vec3& value);
+	void set(int handle, const glm::vec4& value);
+	void set(int handle, const glm::mat3& value);
+	void set(int handle, const glm::mat4& value);
+	void set(int handle, const uint32_t nof_values, const glm::vec3* values);
+
+	// Forget all cached values, e.g. after the program was modified behind our back
+	void invalidate();
+
+	// Number of uniform updates sent to GL and skipped as redundant, since start
+	static uint64_t s_uniform_updates;
+	static uint64_t s_redundant_updates_skipped;
+
+private:
+	bool changed(int handle, const void* data, size_t size);
+
+	GLuint m_program;
+	uint32_t m_generation;
+	std::vector<UniformInfo> m_uniforms;
+	std::vector<UniformBlockInfo> m_blocks;
+	std::unordered_map<std::string, int> m_uniform_lookup;
+	std::unordered_map<std::string, int> m_block_lookup;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Reflects a freshly linked program and stores it in the global registry,
+/// replacing any earlier entry for the same id. Called by linkShaderProgram.
+///////////////////////////////////////////////////////////////////////////
+ProgramReflection* reflectShaderProgram(GLuint program);
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns the reflection of a program linked through linkShaderProgram,
+/// or nullptr for unknown programs.
+///////////////////////////////////////////////////////////////////////////
+ProgramReflection* getProgramReflection(GLuint program);
+
+///////////////////////////////////////////////////////////////////////////
+/// Removes a program from the registry (call when deleting the program).
+///////////////////////////////////////////////////////////////////////////
+void forgetProgramReflection(GLuint program);
+
+class ShaderProgram;
+
+///////////////////////////////////////////////////////////////////////////
+/// Typed handle to a uniform of a ShaderProgram. Resolves its name once per
+/// (re)link of the program, after that set() does no string lookups.
+///////////////////////////////////////////////////////////////////////////
+template<typename T>
+class Uniform
+{
+public:
+	Uniform() {}
+	Uniform(const ShaderProgram* program, const std::string& name)
+	    : m_program(program), m_name(name)
+	{
+	}
+
+	void set(const T& value);
+
+private:
+	const ShaderProgram* m_program = nullptr;
+	std::string m_name;
+	int m_handle = -1;
+	uint32_t m_generation = 0;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Owns a shader program and reloads it in place. Uniform handles taken
+/// from it stay valid across reloads.
+///////////////////////////////////////////////////////////////////////////
+class ShaderProgram
+{
+public:
+	GLuint id = 0;
+
+	///////////////////////////////////////////////////////////////////////
+	/// Loads and links a program (see loadShaderProgram). On success the
+	/// previous program, if any, is deleted. On failure it is kept.
+	///////////////////////////////////////////////////////////////////////
+	bool load(const std::string& vertexShader,
+	          const std::string& fragmentShader,
+	          bool allow_errors = false,
+	          const std::string& defines = std::string());
+
+	void free();
+
+	ProgramReflection* reflection() const { return getProgramReflection(id); }
+
+	template<typename T>
+	Uniform<T> uniform(const std::string& name) const
+	{
+		return Uniform<T>(this, name);
+	}
+};
+
+template<typename T>
+void Uniform<T>::set(const T& value)
+{
+	ProgramReflection* reflection = m_program != nullptr ? m_program->reflection() : nullptr;
+	if(reflection == nullptr)
+	{
+		return;
+	}
+	if(reflection->generation() != m_generation)
+	{
+		m_handle = reflection->find(m_name);
+		m_generation = reflection->generation();
+	}
+	reflection->set(m_handle, value);
+}
+} // namespace labhelper
@@ -0,0 +1,225 @@
+#include "TextureCache.h"
+#include "GLState.h"
+#include "Model.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include "labhelper.h"
+
+#include <GL/glew.h>
+#include <iostream>
+#include <stb_image.h>
+
+namespace labhelper
+{
+namespace
+{
+	std::string entryKey(const std::string& path, int components)
+	{
+		return path + "|" + std::to_string(components);
+	}
+} // namespace
+
+TextureCache::~TextureCache()
+{
+	// Decodes still running refer to the entries. The GL context is gone
+	// by now, so what is left is reclaimed with the process.
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_decoded.wait(lock, [this]() { return m_jobs_in_flight == 0; });
+}
+
+std::shared_ptr<TextureCache::Entry> TextureCache::find(const std::string& path, int components, bool* added)
+{
+	std::shared_ptr<Entry>& entry = m_entries[entryKey(path, components)];
+	*added = !entry;
+	if(!entry)
+	{
+		entry = std::make_shared<Entry>();
+		entry->path = path;
+		entry->components = components;
+	}
+	return entry;
+}
+
+bool TextureCache::claim(Entry& entry)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(entry.state != QUEUED)
+	{
+		return false;
+	}
+	entry.state = DECODING;
+	return true;
+}
+
+void TextureCache::decodeEntry(Entry& entry)
+{
+	TRACE_SCOPE("Decode texture");
+	int width, height, components;
+	uint8_t* data = stbi_load(entry.path.c_str(), &width, &height, &components, entry.components);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry.width = width;
+		entry.height = height;
+		entry.data = data;
+		entry.state = data ? DECODED : FAILED;
+	}
+	m_decoded.notify_all();
+}
+
+void TextureCache::prefetch(const std::string& directory, const std::string& filename, int components)
+{
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool added;
+		entry = find(file::normalise(directory) + file::normalise(filename), components, &added);
+		if(!added)
+		{
+			return;
+		}
+		m_jobs_in_flight++;
+	}
+	getThreadPool().submit([this, entry]() {
+		// acquire() may have got to it first
+		if(claim(*entry))
+		{
+			decodeEntry(*entry);
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs_in_flight--;
+		}
+		m_decoded.notify_all();
+	});
+}
+
+void TextureCache::waitDecoded(Entry& entry)
+{
+	// Rather than wait for a worker to start it
+	if(claim(entry))
+	{
+		decodeEntry(entry);
+	}
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_decoded.wait(lock, [&]() { return entry.state == DECODED || entry.state == FAILED; });
+}
+
+void TextureCache::decode(const std::string& directory, const std::string& filename, int components)
+{
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool added;
+		entry = find(file::normalise(directory) + file::normalise(filename), components, &added);
+	}
+	waitDecoded(*entry);
+}
+
+bool TextureCache::acquire(Texture& texture, const std::string& directory, const std::string& filename, int components)
+{
+	texture.filename = file::normalise(filename);
+	texture.directory = file::normalise(directory);
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		bool added;
+		entry = find(texture.directory + texture.filename, components, &added);
+		if(entry->references++ > 0)
+		{
+			m_shared_loads++;
+		}
+	}
+	waitDecoded(*entry);
+	if(entry->state == FAILED)
+	{
+		std::cout << "ERROR: loadModelFromOBJ(): Failed to load texture: " << texture.filename << " in "
+		          << texture.directory << "\n";
+		exit(1);
+	}
+	if(entry->gl_id == 0)
+	{
+		upload(*entry);
+	}
+
+	texture.valid = true;
+	texture.width = entry->width;
+	texture.height = entry->height;
+	texture.data = entry->data;
+	texture.n_components = uint8_t(components);
+	texture.gl_id_internal = entry->gl_id;
+	texture.gl_id = entry->gl_id;
+	return true;
+}
+
+void TextureCache::upload(Entry& entry)
+{
+	TRACE_SCOPE("Upload texture");
+	GLenum format, internal_format;
+	if(entry.components == 1)
+	{
+		format = GL_RED;
+		internal_format = GL_R8;
+	}
+	else if(entry.components == 3)
+	{
+		format = GL_RGB;
+		internal_format = GL_RGB;
+	}
+	else if(entry.components == 4)
+	{
+		format = GL_RGBA;
+		internal_format = GL_RGBA;
+	}
+	else
+	{
+		std::cout << "Texture loading not implemented for this number of compenents.\n";
+		exit(1);
+	}
+	glGenTextures(1, &entry.gl_id);
+	getGLState().bindTexture(GL_TEXTURE_2D, entry.gl_id);
+	// Rows of one and three component images are not 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format, entry.width, entry.height, 0, format, GL_UNSIGNED_BYTE,
+	             entry.data);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
+	getGLState().bindTexture(GL_TEXTURE_2D, 0);
+}
+
+void TextureCache::release(Texture& texture)
+{
+	std::shared_ptr<Entry> entry;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_entries.find(entryKey(texture.directory + texture.filename, texture.n_components));
+		if(it == m_entries.end() || --it->second->references > 0)
+		{
+			return;
+		}
+		entry = it->second;
+		m_entries.erase(it);
+	}
+	stbi_image_free(entry->data);
+	if(entry->gl_id)
+	{
+		getGLState().deleteTextures(1, &entry->gl_id);
+	}
+}
+
+size_t TextureCache::size()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_entries.size();
+}
+
+TextureCache& getTextureCache()
+{
+	static TextureCache cache;
+	return cache;
+}
+} // namespace labhelper
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace labhelper
+{
+struct Texture;
+
+///////////////////////////////////////////////////////////////////////////
+/// Process-wide cache of the images loaded by Texture::load(), keyed by
+/// path and number of components. Every image is decoded once, on the
+/// thread pool, and uploaded once, on the GL thread. All textures that
+/// name it share its pixels and GL texture, which are freed when the last
+/// of them is (Texture::free()).
+///
+/// Usage, as in readModelFromOBJ() and uploadModel():
+///	for(each texture) getTextureCache().prefetch(directory, name, 4); // decodes start
+///	for(each texture) getTextureCache().decode(directory, name, 4); // waits
+///	for(each texture) texture.load(directory, name, 4); // on the GL thread, uploads
+///////////////////////////////////////////////////////////////////////////
+class TextureCache
+{
+public:
+	TextureCache() = default;
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+	~TextureCache();
+
+	// Starts decoding the image on the thread pool, unless it is cached already
+	void prefetch(const std::string& directory, const std::string& filename, int components);
+
+	// Decodes the image on the calling thread, unless it is cached or being
+	// decoded elsewhere, and waits until it is. Any thread may call this.
+	void decode(const std::string& directory, const std::string& filename, int components);
+
+	// Points `texture` at the cached image, which is decoded (or waited for)
+	// and uploaded on first use. Must be called on the GL thread.
+	bool acquire(Texture& texture, const std::string& directory, const std::string& filename, int components);
+
+	// Drops a reference taken by acquire(). Must be called on the GL thread.
+	void release(Texture& texture);
+
+	// Images cached, and how many acquire() calls found theirs already there
+	size_t size();
+	size_t sharedLoads() const { return m_shared_loads; }
+
+private:
+	enum State
+	{
+		QUEUED,
+		DECODING,
+		DECODED,
+		FAILED
+	};
+	struct Entry
+	{
+		std::string path;
+		int components = 4;
+		State state = QUEUED;
+		int width = 0, height = 0;
+		uint8_t* data = nullptr;
+		uint32_t gl_id = 0;
+		int references = 0;
+	};
+
+	// Finds or adds the entry, with m_mutex held
+	std::shared_ptr<Entry> find(const std::string& path, int components, bool* added);
+	bool claim(Entry& entry);
+	void decodeEntry(Entry& entry);
+	void waitDecoded(Entry& entry);
+	static void upload(Entry& entry);
+
+	std::mutex m_mutex;
+	std::condition_variable m_decoded;
+	std::unordered_map<std::string, std::shared_ptr<Entry>> m_entries;
+	int m_jobs_in_flight = 0;
+	size_t m_shared_loads = 0;
+};
+
+TextureCache& getTextureCache();
+} // namespace labhelper
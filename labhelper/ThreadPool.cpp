@@ -0,0 +1,124 @@
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace labhelper
+{
+ThreadPool::ThreadPool(int number_of_threads)
+{
+	for(int i = 0; i < number_of_threads; i++)
+	{
+		m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_work_available.notify_all();
+	for(std::thread& worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	traceSetThreadName("Worker");
+	for(;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_work_available.wait(lock, [this]() { return m_quit || !m_tasks.empty(); });
+			if(m_tasks.empty())
+			{
+				return;
+			}
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	if(m_workers.empty())
+	{
+		task();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.push_back(std::move(task));
+	}
+	m_work_available.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+	if(count == 0)
+	{
+		return;
+	}
+	if(count == 1 || m_workers.empty())
+	{
+		for(size_t i = 0; i < count; i++)
+		{
+			body(i);
+		}
+		return;
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Every participant claims indices until none are left. Helpers that
+	// start late find nothing to do, so the state must outlive this call.
+	///////////////////////////////////////////////////////////////////////
+	struct Loop
+	{
+		std::atomic<size_t> next{ 0 };
+		std::atomic<size_t> done{ 0 };
+		size_t count;
+		const std::function<void(size_t)>* body;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+	std::shared_ptr<Loop> loop = std::make_shared<Loop>();
+	loop->count = count;
+	loop->body = &body;
+	auto run = [](Loop& l) {
+		for(size_t i = l.next++; i < l.count; i = l.next++)
+		{
+			(*l.body)(i);
+			if(++l.done == l.count)
+			{
+				std::lock_guard<std::mutex> lock(l.mutex);
+				l.finished.notify_all();
+			}
+		}
+	};
+
+	size_t helpers = std::min(count - 1, m_workers.size());
+	for(size_t h = 0; h < helpers; h++)
+	{
+		submit([loop, run]() { run(*loop); });
+	}
+	run(*loop);
+
+	std::unique_lock<std::mutex> lock(loop->mutex);
+	loop->finished.wait(lock, [&]() { return loop->done == count; });
+}
+
+ThreadPool& getThreadPool()
+{
+	static ThreadPool pool(std::max(0, int(std::thread::hardware_concurrency()) - 1));
+	return pool;
+}
+} // namespace labhelper
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// A fixed set of worker threads for CPU work such as asset loading.
+///
+/// parallelFor() runs body(0) to body(count - 1) on the workers and the
+/// calling thread, and returns when all are done. The caller takes part,
+/// so parallelFor() may be called from inside a task and never deadlocks;
+/// it then just gets less help. Tasks must not touch GL.
+///
+/// Usage:
+///	getThreadPool().parallelFor(chunks.size(), [&](size_t i) { parse(chunks[i]); });
+///////////////////////////////////////////////////////////////////////////
+class ThreadPool
+{
+public:
+	// 0 threads runs everything on the calling thread
+	explicit ThreadPool(int number_of_threads);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int numberOfThreads() const { return int(m_workers.size()); }
+
+	// Runs `task` on a worker at some point
+	void submit(std::function<void()> task);
+
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_work_available;
+	std::deque<std::function<void()>> m_tasks;
+	bool m_quit = false;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// The pool shared by labhelper, one worker per core but the calling one
+///////////////////////////////////////////////////////////////////////////
+ThreadPool& getThreadPool();
+} // namespace labhelper
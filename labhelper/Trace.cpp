@@ -0,0 +1,170 @@
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace labhelper
+{
+namespace
+{
+	const uint64_t TRACE_BUFFER_CAPACITY = 1 << 16;
+
+	struct TraceEvent
+	{
+		const char* name;
+		uint64_t begin_ns;
+		uint64_t end_ns;
+	};
+
+	///////////////////////////////////////////////////////////////////////
+	/// Written only by its owning thread. `written` is the total number of
+	/// events ever written, published with release so the exporter sees
+	/// complete events.
+	///////////////////////////////////////////////////////////////////////
+	struct TraceThreadBuffer
+	{
+		uint32_t thread_id;
+		std::string thread_name;
+		std::atomic<uint64_t> written;
+		TraceEvent events[TRACE_BUFFER_CAPACITY];
+
+		void write(const char* name, uint64_t begin_ns, uint64_t end_ns)
+		{
+			uint64_t index = written.load(std::memory_order_relaxed);
+			TraceEvent& event = events[index & (TRACE_BUFFER_CAPACITY - 1)];
+			event.name = name;
+			event.begin_ns = begin_ns;
+			event.end_ns = end_ns;
+			written.store(index + 1, std::memory_order_release);
+		}
+	};
+
+	// Buffers live until exit so that events of finished threads can still be exported
+	std::mutex g_buffers_mutex;
+	std::vector<std::unique_ptr<TraceThreadBuffer>> g_buffers;
+	std::atomic<bool> g_enabled(true);
+	const std::chrono::steady_clock::time_point g_epoch = std::chrono::steady_clock::now();
+
+	TraceThreadBuffer* createBuffer(const char* thread_name)
+	{
+		std::unique_ptr<TraceThreadBuffer> buffer(new TraceThreadBuffer);
+		buffer->written.store(0);
+		std::lock_guard<std::mutex> lock(g_buffers_mutex);
+		buffer->thread_id = uint32_t(g_buffers.size() + 1);
+		buffer->thread_name = thread_name != nullptr ? thread_name
+		                                             : "Thread " + std::to_string(buffer->thread_id);
+		g_buffers.push_back(std::move(buffer));
+		return g_buffers.back().get();
+	}
+
+	TraceThreadBuffer* threadBuffer()
+	{
+		thread_local TraceThreadBuffer* buffer = createBuffer(nullptr);
+		return buffer;
+	}
+
+	TraceThreadBuffer* gpuBuffer()
+	{
+		static TraceThreadBuffer* buffer = createBuffer("GPU");
+		return buffer;
+	}
+
+	void writeEscaped(std::ostream& out, const char* s)
+	{
+		for(; *s != 0; s++)
+		{
+			if(*s == '"' || *s == '\\')
+			{
+				out << '\\';
+			}
+			out << *s;
+		}
+	}
+} // namespace
+
+uint64_t traceNow()
+{
+	return uint64_t(
+	    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_epoch).count());
+}
+
+void traceSetEnabled(bool enabled)
+{
+	g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool traceIsEnabled()
+{
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+void traceSetThreadName(const char* name)
+{
+	TraceThreadBuffer* buffer = threadBuffer();
+	std::lock_guard<std::mutex> lock(g_buffers_mutex);
+	buffer->thread_name = name;
+}
+
+void traceRecord(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+	threadBuffer()->write(name, begin_ns, end_ns);
+}
+
+void traceGpuEvent(const char* name, uint64_t begin_ns, uint64_t end_ns)
+{
+	if(traceIsEnabled())
+	{
+		gpuBuffer()->write(name, begin_ns, end_ns);
+	}
+}
+
+bool traceExport(std::string filename)
+{
+	if(filename.empty())
+	{
+		auto tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+		std::ostringstream name;
+		name << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << "_trace.json";
+		filename = name.str();
+	}
+	std::ofstream file(filename);
+	if(!file)
+	{
+		return false;
+	}
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+	std::lock_guard<std::mutex> lock(g_buffers_mutex);
+	bool first = true;
+	for(const auto& buffer : g_buffers)
+	{
+		file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+		     << buffer->thread_id << ",\"args\":{\"name\":\"";
+		writeEscaped(file, buffer->thread_name.c_str());
+		file << "\"}}";
+		first = false;
+
+		uint64_t written = buffer->written.load(std::memory_order_acquire);
+		uint64_t begin = written > TRACE_BUFFER_CAPACITY ? written - TRACE_BUFFER_CAPACITY : 0;
+		for(uint64_t i = begin; i < written; i++)
+		{
+			const TraceEvent& event = buffer->events[i & (TRACE_BUFFER_CAPACITY - 1)];
+			file << ",\n{\"name\":\"";
+			writeEscaped(file, event.name);
+			file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+			     << ",\"ts\":" << double(event.begin_ns) * 1e-3
+			     << ",\"dur\":" << double(event.end_ns - event.begin_ns) * 1e-3 << "}";
+		}
+	}
+	file << "\n]}\n";
+	return true;
+}
+} // namespace labhelper
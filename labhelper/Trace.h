@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////////////////
+/// CPU tracing. Place TRACE_SCOPE("name") at the start of a block (or
+/// TRACE_FUNCTION() at the start of a function) to record how long it took.
+/// Names must be string literals, only the pointer is stored.
+///
+/// Every thread writes into its own fixed size ring buffer without locks,
+/// once it is full the oldest events are overwritten. traceExport() writes
+/// everything still in the buffers as Chrome trace-event JSON, which can be
+/// opened in chrome://tracing or ui.perfetto.dev.
+///////////////////////////////////////////////////////////////////////////
+#define LABHELPER_TRACE_CONCAT_IMPL(a, b) a##b
+#define LABHELPER_TRACE_CONCAT(a, b) LABHELPER_TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) labhelper::TraceScope LABHELPER_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// Nanoseconds since the first call, on a steady clock.
+///////////////////////////////////////////////////////////////////////////
+uint64_t traceNow();
+
+///////////////////////////////////////////////////////////////////////////
+/// Tracing is enabled by default. When disabled scopes cost one branch.
+///////////////////////////////////////////////////////////////////////////
+void traceSetEnabled(bool enabled);
+bool traceIsEnabled();
+
+///////////////////////////////////////////////////////////////////////////
+/// Names the calling thread in the exported trace.
+///////////////////////////////////////////////////////////////////////////
+void traceSetThreadName(const char* name);
+
+///////////////////////////////////////////////////////////////////////////
+/// Records a finished event on the calling thread. Times are from traceNow().
+///////////////////////////////////////////////////////////////////////////
+void traceRecord(const char* name, uint64_t begin_ns, uint64_t end_ns);
+
+///////////////////////////////////////////////////////////////////////////
+/// Records an event on the separate "GPU" track, with times converted to the
+/// traceNow() clock. Must only be called from the thread owning the GL context.
+///////////////////////////////////////////////////////////////////////////
+void traceGpuEvent(const char* name, uint64_t begin_ns, uint64_t end_ns);
+
+///////////////////////////////////////////////////////////////////////////
+/// Writes all recorded events as trace-event JSON. An empty filename writes to
+/// <timestamp>_trace.json. Events recorded while exporting may be missing or,
+/// if a thread wraps its buffer during the export, be garbled.
+///////////////////////////////////////////////////////////////////////////
+bool traceExport(std::string filename = std::string());
+
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* name) : m_name(traceIsEnabled() ? name : nullptr)
+	{
+		if(m_name != nullptr)
+		{
+			m_begin = traceNow();
+		}
+	}
+	~TraceScope()
+	{
+		if(m_name != nullptr)
+		{
+			traceRecord(m_name, m_begin, traceNow());
+		}
+	}
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+	const char* m_name;
+	uint64_t m_begin = 0;
+};
+} // namespace labhelper
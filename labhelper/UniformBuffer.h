@@ -0,0 +1,105 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstring>
+
+#include "FramePacer.h"
+
+namespace labhelper
+{
+///////////////////////////////////////////////////////////////////////////
+/// A uniform buffer object together with a CPU side mirror of its contents.
+/// Write to `data` as often as you like; upload() only talks to the driver
+/// when the mirror differs from what was uploaded last time.
+///
+/// T must be a plain struct that matches the std140 layout of the uniform
+/// block, i.e. vec3s padded to 16 bytes and matrices as glm::mat4.
+///
+/// Given a StreamBuffer, upload() instead writes the mirror into the current
+/// frame's part of the ring every frame and binds that range, so a block
+/// that changes never makes the driver wait for, or copy around, a buffer
+/// that queued frames still read.
+///////////////////////////////////////////////////////////////////////////
+template<typename T>
+class UniformBuffer
+{
+public:
+	// CPU side mirror of the block
+	T data;
+
+	///////////////////////////////////////////////////////////////////////
+	/// Creates the buffer, uploads the current mirror and binds it to the
+	/// given uniform block binding point.
+	///////////////////////////////////////////////////////////////////////
+	void init(GLuint binding, StreamBuffer* stream = nullptr)
+	{
+		m_binding = binding;
+		m_stream = stream;
+		if(m_stream != nullptr)
+		{
+			GLint alignment = 256;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			m_alignment = size_t(alignment);
+		}
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &data, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+		std::memcpy(&m_uploaded, &data, sizeof(T));
+	}
+
+	///////////////////////////////////////////////////////////////////////
+	/// Uploads the mirror if it changed, every frame when streamed. Returns
+	/// true if it changed.
+	///////////////////////////////////////////////////////////////////////
+	bool upload()
+	{
+		const bool changed = std::memcmp(&m_uploaded, &data, sizeof(T)) != 0;
+		std::memcpy(&m_uploaded, &data, sizeof(T));
+		if(m_stream != nullptr)
+		{
+			// Every frame, the range bound last frame is in a slot that will be reused
+			GLintptr offset = m_stream->write(&data, sizeof(T), m_alignment);
+			if(offset >= 0)
+			{
+				glBindBufferRange(GL_UNIFORM_BUFFER, m_binding, m_stream->buffer(), offset, sizeof(T));
+				return changed;
+			}
+			// The ring is full this frame, the own buffer may be stale
+			glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+		}
+		else if(!changed)
+		{
+			return false;
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		return changed;
+	}
+
+	void free()
+	{
+		glDeleteBuffers(1, &m_buffer);
+		m_buffer = 0;
+	}
+
+	GLuint buffer() const
+	{
+		return m_buffer;
+	}
+
+	GLuint binding() const
+	{
+		return m_binding;
+	}
+
+private:
+	T m_uploaded;
+	GLuint m_buffer = 0;
+	GLuint m_binding = 0;
+	StreamBuffer* m_stream = nullptr;
+	size_t m_alignment = 256;
+};
+} // namespace labhelper
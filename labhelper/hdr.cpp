@@ -1,4 +1,6 @@
 #include "hdr.h"
+#include "GLState.h"
+#include "Trace.h"
 #include <iostream>
 #include <stb_image.h>
 #include <stb_image_write.h>
@@ -27,32 +29,46 @@ struct HDRImage
 	};
 };
 
-GLuint loadHdrTexture(const std::string& filename)
+GLuint createHdrTexture()
 {
 	GLuint texId;
 	glGenTextures(1, &texId);
-	glBindTexture(GL_TEXTURE_2D, texId);
+	getGLState().bindTexture(GL_TEXTURE_2D, texId);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-
-	HDRImage image(filename);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, image.width, image.height, 0, GL_RGB, GL_FLOAT, image.data);
-
 	return texId;
 }
 
-GLuint loadHdrMipmapTexture(const std::vector<std::string>& filenames)
+GLuint createHdrMipmapTexture()
 {
 	GLuint texId;
 	glGenTextures(1, &texId);
-	glBindTexture(GL_TEXTURE_2D, texId);
+	getGLState().bindTexture(GL_TEXTURE_2D, texId);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	return texId;
+}
+
+GLuint loadHdrTexture(const std::string& filename)
+{
+	TRACE_FUNCTION();
+	GLuint texId = createHdrTexture();
+
+	HDRImage image(filename);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, image.width, image.height, 0, GL_RGB, GL_FLOAT, image.data);
+
+	return texId;
+}
+
+GLuint loadHdrMipmapTexture(const std::vector<std::string>& filenames)
+{
+	TRACE_FUNCTION();
+	GLuint texId = createHdrMipmapTexture();
 
 	HDRImage image(filenames[0]);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, image.width, image.height, 0, GL_RGB, GL_FLOAT, image.data);
@@ -77,7 +93,7 @@ void saveHdrTexture(const std::string& filename, GLuint texture)
 	std::vector<float> img;
 	std::vector<uint8_t> img_png;
 
-	glBindTexture(GL_TEXTURE_2D, texture);
+	getGLState().bindTexture(GL_TEXTURE_2D, texture);
 
 	GLint lwidth, lheight;
 	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &lwidth);
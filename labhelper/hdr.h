@@ -6,5 +6,9 @@ namespace labhelper {
 	GLuint loadHdrTexture(const std::string &filename);
 	GLuint loadHdrMipmapTexture(const std::vector<std::string> &filenames);
 
+	// The texture objects the functions above make, set up but without an image yet
+	GLuint createHdrTexture();
+	GLuint createHdrMipmapTexture();
+
 	void saveHdrTexture(const std::string &filename, GLuint texture);
 }
\ No newline at end of file
@@ -14,6 +14,8 @@
 #include <SDL_syswm.h>
 #include <GL/glew.h>
 
+#include "FramePacer.h"
+
 // Data
 static double g_Time = 0.0f;
 static bool g_MousePressed[3] = { false, false, false };
@@ -23,6 +25,27 @@ static int g_ShaderHandle = 0, g_VertHandle = 0, g_FragHandle = 0;
 static int g_AttribLocationTex = 0, g_AttribLocationProjMtx = 0;
 static int g_AttribLocationPosition = 0, g_AttribLocationUV = 0, g_AttribLocationColor = 0;
 static unsigned int g_VboHandle = 0, g_VaoHandle = 0, g_ElementsHandle = 0;
+// Vertices and indices go through a ring buffer guarded by the frame pacer; g_VboHandle is the fallback when it is full
+static labhelper::StreamBuffer g_StreamBuffer;
+static const size_t g_StreamBytesPerFrame = 1 << 20;
+static unsigned int g_AttribBuffer = 0; // Buffer the VAO's attribute pointers refer to
+
+// Points the attributes of the (bound) VAO at the given vertex buffer
+static void ImGui_ImplSdlGL3_SetAttribBuffer(unsigned int buffer)
+{
+	if(g_AttribBuffer == buffer)
+		return;
+	g_AttribBuffer = buffer;
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+#define OFFSETOF(TYPE, ELEMENT) ((size_t) & (((TYPE*)0)->ELEMENT))
+	glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert),
+	                      (GLvoid*)OFFSETOF(ImDrawVert, pos));
+	glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert),
+	                      (GLvoid*)OFFSETOF(ImDrawVert, uv));
+	glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert),
+	                      (GLvoid*)OFFSETOF(ImDrawVert, col));
+#undef OFFSETOF
+}
 
 // This is the main rendering function that you have to implement and provide to ImGui (via setting up 'RenderDrawListsFn' in the ImGuiIO structure)
 // Note that this implementation is little overcomplicated because we are saving/setting up/restoring every OpenGL state explicitly, in order to be able to run within any OpenGL engine that doesn't do so.
@@ -103,14 +126,28 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
 	{
 		const ImDrawList* cmd_list = draw_data->CmdLists[n];
 		const ImDrawIdx* idx_buffer_offset = 0;
+		GLint base_vertex = 0;
 
-		glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
-		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert),
-		             (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
+		const size_t vtx_size = (size_t)cmd_list->VtxBuffer.Size * sizeof(ImDrawVert);
+		const size_t idx_size = (size_t)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx);
+		GLintptr vtx_offset = g_StreamBuffer.write(cmd_list->VtxBuffer.Data, vtx_size, sizeof(ImDrawVert));
+		GLintptr idx_offset = vtx_offset >= 0 ? g_StreamBuffer.write(cmd_list->IdxBuffer.Data, idx_size, sizeof(ImDrawIdx)) : -1;
+		if(idx_offset >= 0)
+		{
+			ImGui_ImplSdlGL3_SetAttribBuffer(g_StreamBuffer.buffer());
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_StreamBuffer.buffer());
+			base_vertex = (GLint)(vtx_offset / sizeof(ImDrawVert));
+			idx_buffer_offset = (const ImDrawIdx*)idx_offset;
+		}
+		else
+		{
+			ImGui_ImplSdlGL3_SetAttribBuffer(g_VboHandle);
+			glBindBuffer(GL_ARRAY_BUFFER, g_VboHandle);
+			glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vtx_size, (const GLvoid*)cmd_list->VtxBuffer.Data, GL_STREAM_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ElementsHandle);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)cmd_list->IdxBuffer.Size * sizeof(ImDrawIdx),
-		             (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ElementsHandle);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)idx_size, (const GLvoid*)cmd_list->IdxBuffer.Data, GL_STREAM_DRAW);
+		}
 
 		for(int cmd_i = 0; cmd_i < cmd_list->CmdBuffer.Size; cmd_i++)
 		{
@@ -125,9 +162,9 @@ void ImGui_ImplSdlGL3_RenderDrawLists(ImDrawData* draw_data)
 				glScissor((int)pcmd->ClipRect.x, (int)(fb_height - pcmd->ClipRect.w),
 				          (int)(pcmd->ClipRect.z - pcmd->ClipRect.x),
 				          (int)(pcmd->ClipRect.w - pcmd->ClipRect.y));
-				glDrawElements(GL_TRIANGLES, (GLsizei)pcmd->ElemCount,
-				               sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
-				               idx_buffer_offset);
+				glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)pcmd->ElemCount,
+				                         sizeof(ImDrawIdx) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+				                         idx_buffer_offset, base_vertex);
 			}
 			idx_buffer_offset += pcmd->ElemCount;
 		}
@@ -296,6 +333,7 @@ bool ImGui_ImplSdlGL3_CreateDeviceObjects()
 
 	glGenBuffers(1, &g_VboHandle);
 	glGenBuffers(1, &g_ElementsHandle);
+	g_StreamBuffer.init(g_StreamBytesPerFrame);
 
 	glGenVertexArrays(1, &g_VaoHandle);
 	glBindVertexArray(g_VaoHandle);
@@ -303,15 +341,8 @@ bool ImGui_ImplSdlGL3_CreateDeviceObjects()
 	glEnableVertexAttribArray(g_AttribLocationPosition);
 	glEnableVertexAttribArray(g_AttribLocationUV);
 	glEnableVertexAttribArray(g_AttribLocationColor);
-
-#define OFFSETOF(TYPE, ELEMENT) ((size_t) & (((TYPE*)0)->ELEMENT))
-	glVertexAttribPointer(g_AttribLocationPosition, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert),
-	                      (GLvoid*)OFFSETOF(ImDrawVert, pos));
-	glVertexAttribPointer(g_AttribLocationUV, 2, GL_FLOAT, GL_FALSE, sizeof(ImDrawVert),
-	                      (GLvoid*)OFFSETOF(ImDrawVert, uv));
-	glVertexAttribPointer(g_AttribLocationColor, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(ImDrawVert),
-	                      (GLvoid*)OFFSETOF(ImDrawVert, col));
-#undef OFFSETOF
+	g_AttribBuffer = 0;
+	ImGui_ImplSdlGL3_SetAttribBuffer(g_VboHandle);
 
 	ImGui_ImplSdlGL3_CreateFontsTexture();
 
@@ -332,6 +363,7 @@ void ImGui_ImplSdlGL3_InvalidateDeviceObjects()
 	if(g_ElementsHandle)
 		glDeleteBuffers(1, &g_ElementsHandle);
 	g_VaoHandle = g_VboHandle = g_ElementsHandle = 0;
+	g_StreamBuffer.free();
 
 	if(g_ShaderHandle && g_VertHandle)
 		glDetachShader(g_ShaderHandle, g_VertHandle);
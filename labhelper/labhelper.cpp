@@ -11,6 +11,11 @@
 
 #include <GL/glew.h>
 
+#if LABHELPER_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 // STB_IMAGE for loading images of many filetypes
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
@@ -18,6 +23,10 @@
 #include <stb_image_write.h>
 
 #include "labhelper.h"
+#include "ShaderProgram.h"
+#include "Trace.h"
+#include "FrameCapture.h"
+#include "GLState.h"
 
 #include <cmath>
 #include <cstring>
@@ -49,6 +58,16 @@ namespace labhelper
 namespace
 {
 	SDL_Window* g_window;
+
+	// Set by init_headless_GL
+	bool g_headless = false;
+	int g_headless_width = 0;
+	int g_headless_height = 0;
+#if LABHELPER_HAS_EGL
+	EGLDisplay g_egl_display = EGL_NO_DISPLAY;
+	EGLContext g_egl_context = EGL_NO_CONTEXT;
+	EGLSurface g_egl_surface = EGL_NO_SURFACE;
+#endif
 }
 
 SDL_Window* init_window_SDL(std::string caption, int width, int height)
@@ -123,8 +142,152 @@ SDL_Window* init_window_SDL(std::string caption, int width, int height)
 	return window;
 }
 
+bool init_headless_GL(int width, int height)
+{
+#if LABHELPER_HAS_EGL
+	///////////////////////////////////////////////////////////////////////////
+	// Prefer Mesa's surfaceless platform, it needs neither X nor a GPU
+	///////////////////////////////////////////////////////////////////////////
+	EGLDisplay display = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+	    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay != nullptr)
+	{
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+#endif
+	if(display == EGL_NO_DISPLAY)
+	{
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if(display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+	{
+		fprintf(stderr, "%s: 0x%x\n", "Couldn't initialize EGL", eglGetError());
+		return false;
+	}
+	if(!eglBindAPI(EGL_OPENGL_API))
+	{
+		fprintf(stderr, "%s\n", "EGL implementation does not support desktop OpenGL");
+		eglTerminate(display);
+		return false;
+	}
+
+	const EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		                              EGL_RED_SIZE,     8,               EGL_GREEN_SIZE,      8,
+		                              EGL_BLUE_SIZE,    8,               EGL_ALPHA_SIZE,      8,
+		                              EGL_DEPTH_SIZE,   24,              EGL_NONE };
+	EGLConfig config;
+	EGLint nof_configs = 0;
+	if(!eglChooseConfig(display, config_attribs, &config, 1, &nof_configs) || nof_configs == 0)
+	{
+		fprintf(stderr, "%s: 0x%x\n", "No suitable EGL config", eglGetError());
+		eglTerminate(display);
+		return false;
+	}
+
+	// Same version and flags as the windowed context
+	const EGLint context_attribs[] = { EGL_CONTEXT_MAJOR_VERSION_KHR,
+		                               4,
+		                               EGL_CONTEXT_MINOR_VERSION_KHR,
+		                               1,
+		                               EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+		                               EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+		                               EGL_CONTEXT_FLAGS_KHR,
+		                               EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR,
+		                               EGL_NONE };
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	if(context == EGL_NO_CONTEXT)
+	{
+		fprintf(stderr, "%s: 0x%x\n", "Failed to create OpenGL context", eglGetError());
+		eglTerminate(display);
+		return false;
+	}
+
+	// All rendering goes to FBOs, a surface is only created if the driver insists on one
+	EGLSurface surface = EGL_NO_SURFACE;
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if(extensions == nullptr || strstr(extensions, "EGL_KHR_surfaceless_context") == nullptr)
+	{
+		const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+	}
+	if(!eglMakeCurrent(display, surface, surface, context))
+	{
+		fprintf(stderr, "%s: 0x%x\n", "Failed to make OpenGL context current", eglGetError());
+		if(surface != EGL_NO_SURFACE)
+			eglDestroySurface(display, surface);
+		eglDestroyContext(display, context);
+		eglTerminate(display);
+		return false;
+	}
+	g_egl_display = display;
+	g_egl_context = context;
+	g_egl_surface = surface;
+
+	// A GLEW built for GLX complains about the missing GLX display, but has
+	// loaded all GL entry points by then.
+	GLenum glew_result = glewInit();
+	if(glew_result != GLEW_OK && glew_result != GLEW_ERROR_NO_GLX_DISPLAY)
+	{
+		fprintf(stderr, "%s: %s\n", "Couldn't initialize GLEW", glewGetErrorString(glew_result));
+		return false;
+	}
+
+	g_headless = true;
+	g_headless_width = width;
+	g_headless_height = height;
+
+	// Check OpenGL properties
+	labhelper::startupGLDiagnostics();
+	labhelper::setupGLDebugMessages();
+
+	// Flip textures vertically so they don't end up upside-down.
+	stbi_set_flip_vertically_on_load(true);
+	return true;
+#else
+	fprintf(stderr, "%s\n", "Headless rendering needs labhelper to be built with EGL");
+	return false;
+#endif
+}
+
+bool isHeadless()
+{
+	return g_headless;
+}
+
+void getWindowSize(int* width, int* height)
+{
+	if(g_headless)
+	{
+		*width = g_headless_width;
+		*height = g_headless_height;
+	}
+	else
+	{
+		SDL_GetWindowSize(g_window, width, height);
+	}
+}
+
 void shutDown(SDL_Window* window)
 {
+	// Finish writing screenshots while the context is still there
+	getFrameCapture().free();
+
+	if(g_headless)
+	{
+#if LABHELPER_HAS_EGL
+		eglMakeCurrent(g_egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if(g_egl_surface != EGL_NO_SURFACE)
+			eglDestroySurface(g_egl_display, g_egl_surface);
+		eglDestroyContext(g_egl_display, g_egl_context);
+		eglTerminate(g_egl_display);
+#endif
+		g_headless = false;
+		return;
+	}
+
 	// If newframe is not ever run before shut down we crash
 	ImGui_ImplSdlGL3_NewFrame(window);
 
@@ -175,7 +338,7 @@ GLuint loadCubeMap(const char* facePosX,
 	///////////////////////////////////////////////////////////////////////////
 	//	 Load the faces into the cube map texture
 	///////////////////////////////////////////////////////////////////////////
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	getGLState().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
 	tempTexHelper::loadCubeMapFace(facePosX, GL_TEXTURE_CUBE_MAP_POSITIVE_X);
 	tempTexHelper::loadCubeMapFace(faceNegX, GL_TEXTURE_CUBE_MAP_NEGATIVE_X);
@@ -508,16 +671,52 @@ std::string GetShaderProgramInfoLog(GLuint obj)
 }
 
 
-GLuint loadShaderProgram(const std::string& vertexShader, const std::string& fragmentShader, bool allow_errors)
+namespace
 {
+	///////////////////////////////////////////////////////////////////////////
+	/// Inserts the given defines after the #version directive (which must stay
+	/// the first statement of a GLSL source).
+	///////////////////////////////////////////////////////////////////////////
+	std::string injectDefines(const std::string& src, const std::string& defines)
+	{
+		if(defines.empty())
+		{
+			return src;
+		}
+		size_t version = src.find("#version");
+		if(version == std::string::npos)
+		{
+			return defines + "\n#line 1\n" + src;
+		}
+		size_t insert_at = src.find('\n', version);
+		if(insert_at == std::string::npos)
+		{
+			return src + "\n" + defines;
+		}
+		insert_at += 1;
+		// Keep compiler messages pointing at the right line of the file.
+		const long next_line = long(std::count(src.begin(), src.begin() + insert_at, '\n')) + 1;
+		return src.substr(0, insert_at) + defines + "\n#line " + std::to_string(next_line) + "\n"
+		       + src.substr(insert_at);
+	}
+} // namespace
+
+GLuint loadShaderProgram(const std::string& vertexShader,
+                         const std::string& fragmentShader,
+                         bool allow_errors,
+                         const std::string& defines)
+{
+	TRACE_FUNCTION();
 	GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
 
 	std::ifstream vs_file(vertexShader);
 	std::string vs_src((std::istreambuf_iterator<char>(vs_file)), std::istreambuf_iterator<char>());
+	vs_src = injectDefines(vs_src, defines);
 
 	std::ifstream fs_file(fragmentShader);
 	std::string fs_src((std::istreambuf_iterator<char>(fs_file)), std::istreambuf_iterator<char>());
+	fs_src = injectDefines(fs_src, defines);
 
 	const char* vs = vs_src.c_str();
 	const char* fs = fs_src.c_str();
@@ -592,6 +791,7 @@ bool linkShaderProgram(GLuint shaderProgram, bool allow_errors)
 		}
 		return false;
 	}
+	reflectShaderProgram(shaderProgram);
 	return true;
 }
 
@@ -611,11 +811,11 @@ GLuint createAddAttribBuffer(GLuint vertexArrayObject,
 	CHECK_GL_ERROR();
 
 	// Now attach buffer to vertex array object.
-	glBindVertexArray(vertexArrayObject);
+	getGLState().bindVertexArray(vertexArrayObject);
 	glVertexAttribPointer(attributeIndex, attributeSize, type, false, 0, 0);
 	glEnableVertexAttribArray(attributeIndex);
 	CHECK_GL_ERROR();
-	glBindVertexArray(0);
+	getGLState().bindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	return buffer;
@@ -626,48 +826,85 @@ GLuint createAddIndexBuffer(GLuint vertexArrayObject,
                             const size_t dataSize,
                             GLenum bufferUsage)
 {
-	glBindVertexArray(vertexArrayObject);
+	getGLState().bindVertexArray(vertexArrayObject);
 	GLuint buffer = 0;
 	glGenBuffers(1, &buffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, dataSize, data, bufferUsage);
 	CHECK_GL_ERROR();
-	glBindVertexArray(0);
+	getGLState().bindVertexArray(0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	return buffer;
 }
 
 
+namespace
+{
+	///////////////////////////////////////////////////////////////////////////
+	/// Sets the uniform through the program's reflection table if it has one,
+	/// which avoids querying the location from the driver.
+	///////////////////////////////////////////////////////////////////////////
+	template<typename T>
+	bool setReflectedUniform(GLuint shaderProgram, const char* name, const T& value)
+	{
+		ProgramReflection* reflection = getProgramReflection(shaderProgram);
+		if(reflection == nullptr)
+		{
+			return false;
+		}
+		reflection->set(reflection->find(name), value);
+		return true;
+	}
+} // namespace
+
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::mat4& matrix)
 {
+	if(setReflectedUniform(shaderProgram, name, matrix))
+		return;
 	glUniformMatrix4fv(glGetUniformLocation(shaderProgram, name), 1, false, &matrix[0].x);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const float value)
 {
+	if(setReflectedUniform(shaderProgram, name, value))
+		return;
 	glUniform1f(glGetUniformLocation(shaderProgram, name), value);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const GLint value)
 {
+	if(setReflectedUniform(shaderProgram, name, value))
+		return;
 	int loc = glGetUniformLocation(shaderProgram, name);
 	glUniform1i(loc, value);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const GLuint value)
 {
+	if(setReflectedUniform(shaderProgram, name, value))
+		return;
 	int loc = glGetUniformLocation(shaderProgram, name);
 	glUniform1ui(loc, value);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const bool value)
 {
+	if(setReflectedUniform(shaderProgram, name, value))
+		return;
 	int loc = glGetUniformLocation(shaderProgram, name);
 	glUniform1i(loc, value ? 1 : 0);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& value)
 {
+	if(setReflectedUniform(shaderProgram, name, value))
+		return;
 	glUniform3fv(glGetUniformLocation(shaderProgram, name), 1, &value.x);
 }
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values)
 {
+	ProgramReflection* reflection = getProgramReflection(shaderProgram);
+	if(reflection != nullptr)
+	{
+		reflection->set(reflection->find(name), nof_values, values);
+		return;
+	}
 	glUniform3fv(glGetUniformLocation(shaderProgram, name), nof_values, (float*)values);
 }
 
@@ -708,13 +945,11 @@ void debugDrawArrow(const glm::mat4& viewMat, const glm::mat4& projMat, glm::vec
 	mat3 r(d, up, right);
 	modelMat = translate(start) * mat4(r) * scale(vec3(l));
 
-	GLint shader;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &shader);
+	GLuint shader = getGLState().program();
 	labhelper::setUniformSlow(shader, "modelViewProjectionMatrix", projMat * viewMat * modelMat);
 
-	glBindVertexArray(vao);
+	getGLState().bindVertexArray(vao);
 	glDrawArrays(GL_LINES, 0, nverts);
-	glBindVertexArray(0);
 }
 
 void debugDrawSphere()
@@ -775,9 +1010,8 @@ void debugDrawSphere()
 		nindices = indices.size();
 	}
 
-	glBindVertexArray(vao);
+	getGLState().bindVertexArray(vao);
 	glDrawElements(GL_TRIANGLES, nindices, GL_UNSIGNED_SHORT, 0);
-	glBindVertexArray(0);
 }
 
 void debugDrawDisc()
@@ -802,49 +1036,67 @@ void debugDrawDisc()
 		nverts = positions.size();
 	}
 
-	glBindVertexArray(vao);
+	getGLState().bindVertexArray(vao);
 	glDrawArrays(GL_TRIANGLE_FAN, 0, nverts);
-	glBindVertexArray(0);
 }
 
 void saveScreenshot()
 {
-	std::vector<uint8_t> img;
+	GLint lwidth, lheight;
+	getWindowSize(&lwidth, &lheight);
+
+	std::time_t tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::stringstream fname;
+	fname << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S");
 
+	// Read back and encoded in the background, the file appears a few frames later
+	FrameCapture& capture = getFrameCapture();
+	capture.update();
+	capture.capture(0, lwidth, lheight, fname.str(), FrameCapture::PNG);
+}
 
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+std::vector<uint8_t> readFramebuffer(GLuint framebuffer, int width, int height)
+{
+	std::vector<uint8_t> img;
 
-	GLint lwidth, lheight;
-	SDL_GetWindowSize(g_window, &lwidth, &lheight);
+
+	GLint previous_framebuffer;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_framebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
 
 	const int n_channels = 3;
-	img.resize(lwidth * lheight * n_channels);
+	img.resize(width * height * n_channels);
 
-	glReadPixels(0, 0, lwidth, lheight, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, img.data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, previous_framebuffer);
 
-	for(int r = 0; r < lheight / 2; ++r)
+	for(int r = 0; r < height / 2; ++r)
 	{
-		int a = r * lwidth * n_channels;
-		int b = (lheight - 1 - r) * lwidth * n_channels;
-		for(int c = 0; c < lwidth * n_channels; ++c)
+		int a = r * width * n_channels;
+		int b = (height - 1 - r) * width * n_channels;
+		for(int c = 0; c < width * n_channels; ++c)
 		{
 			std::swap(img[a + c], img[b + c]);
 		}
 	}
+	return img;
+}
 
-
-	std::time_t tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-	std::stringstream fname;
-	fname << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << ".png";
-
-	stbi_write_png(fname.str().c_str(), lwidth, lheight, n_channels, img.data(), 0);
+void saveFramebuffer(GLuint framebuffer, int width, int height, const std::string& filename)
+{
+	std::vector<uint8_t> img = readFramebuffer(framebuffer, width, height);
+	stbi_write_png(filename.c_str(), width, height, 3, img.data(), 0);
 }
 
-void drawFullScreenQuad()
+void drawFullScreenQuad(bool depthTest)
 {
-	GLboolean previous_depth_state;
-	glGetBooleanv(GL_DEPTH_TEST, &previous_depth_state);
-	glDisable(GL_DEPTH_TEST);
+	GLStateCache& gl = getGLState();
+	// From the shadow, not glGetBooleanv, which would wait for the driver
+	const bool previous_depth_state = gl.depthTest();
+	if(!depthTest)
+		gl.setDepthTest(false);
 	static GLuint vertexArrayObject = 0;
 	static int nofVertices = 6;
 	// do this initialization first time the function is called...
@@ -856,12 +1108,10 @@ void drawFullScreenQuad()
 		labhelper::createAddAttribBuffer(vertexArrayObject, positions,
 		                                 array_length(positions) * sizeof(glm::vec2), 0, 2, GL_FLOAT);
 	}
-	glBindVertexArray(vertexArrayObject);
+	gl.bindVertexArray(vertexArrayObject);
 	glDrawArrays(GL_TRIANGLES, 0, nofVertices);
-	if(previous_depth_state)
-		glEnable(GL_DEPTH_TEST);
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(previous_depth_state && !depthTest)
+		gl.setDepthTest(true);
 }
 
 float uniform_randf(const float from, const float to)
@@ -6,6 +6,8 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <cassert>
 
 #include <SDL.h>
@@ -93,7 +95,26 @@ void non_fatal_error(std::string errorString, std::string title = std::string())
 SDL_Window* init_window_SDL(std::string caption, int width = 1280, int height = 720);
 
 ///////////////////////////////////////////////////////////////////////////
-/// Destroys that which have been initialized.
+/// Creates an OpenGL context without a window, through EGL. Works with Mesa's
+/// llvmpipe, so neither a display nor a GPU is needed. There is no default
+/// framebuffer: render into an FBO of the given size. ImGui is not set up.
+/// Returns false if no context could be created, or if labhelper was built
+/// without EGL (LABHELPER_HAS_EGL).
+///////////////////////////////////////////////////////////////////////////
+bool init_headless_GL(int width = 1280, int height = 720);
+
+///////////////////////////////////////////////////////////////////////////
+/// True if the context was created by init_headless_GL.
+///////////////////////////////////////////////////////////////////////////
+bool isHeadless();
+
+///////////////////////////////////////////////////////////////////////////
+/// Size of the window, or the size given to init_headless_GL.
+///////////////////////////////////////////////////////////////////////////
+void getWindowSize(int* width, int* height);
+
+///////////////////////////////////////////////////////////////////////////
+/// Destroys that which have been initialized. Pass nullptr when headless.
 ///////////////////////////////////////////////////////////////////////////
 void shutDown(SDL_Window* window);
 
@@ -117,10 +138,13 @@ std::string GetShaderInfoLog(GLuint obj);
 /// and attaches the shaders. Does NOT link the program, this is done with  linkShaderProgram()
 /// The reason for this is that before linking we need to bind attribute locations, using
 /// glBindAttribLocation and fragment data lications, using glBindFragDataLocation.
+/// Any `defines` (e.g. "#define FOO\n") are inserted right after the #version
+/// line of both shaders, which lets one source file produce several permutations.
 ///////////////////////////////////////////////////////////////////////////
 GLuint loadShaderProgram(const std::string& vertexShader,
                          const std::string& fragmentShader,
-                         bool allow_errors = false);
+                         bool allow_errors = false,
+                         const std::string& defines = std::string());
 
 ///////////////////////////////////////////////////////////////////////////
 /// Call to link a shader program prevoiusly loaded using loadShaderProgram.
@@ -154,6 +178,9 @@ GLuint createAddIndexBuffer(GLuint vertexArrayObject,
 /// In OpenGL (and similarly in other APIs) it is much more efficient (in terms of CPU time) to keep the uniform
 /// location, and use that. Or even better, use uniform buffers!
 /// However, in the simple tutorial samples, performance is not an issue.
+/// Programs linked with linkShaderProgram are reflected at link time (see ShaderProgram.h),
+/// for those the location comes from a hashed table and unchanged values are not re-sent,
+/// but the name is still hashed on every call. Prefer labhelper::Uniform handles in hot code.
 /// Overloaded to set many types.
 ///////////////////////////////////////////////////////////////////////////
 void setUniformSlow(GLuint shaderProgram, const char* name, const glm::mat4& matrix);
@@ -165,9 +192,11 @@ void setUniformSlow(GLuint shaderProgram, const char* name, const glm::vec3& val
 void setUniformSlow(GLuint shaderProgram, const char* name, const uint32_t nof_values, const glm::vec3* values);
 
 ///////////////////////////////////////////////////////////////////////////
-/// Draws a single quad (two triangles) that cover the entire screen
+/// Draws a single quad (two triangles) that cover the entire screen.
+/// Depth testing is turned off while drawing, unless `depthTest` is set
+/// (e.g. for a quad the vertex shader places at the far plane).
 ///////////////////////////////////////////////////////////////////////////
-void drawFullScreenQuad();
+void drawFullScreenQuad(bool depthTest = false);
 
 ///////////////////////////////////////////////////////////////////////////
 /// Draws an arrow going from start to the point
@@ -186,10 +215,21 @@ void debugDrawDisc();
 
 
 ///////////////////////////////////////////////////////////////////////////
-/// Takes the image in the default framebuffer and stores it in a file
+/// Takes the image in the default framebuffer and stores it in a file.
+/// Asynchronous, see getFrameCapture() in FrameCapture.h.
 ///////////////////////////////////////////////////////////////////////////
 void saveScreenshot();
 
+///////////////////////////////////////////////////////////////////////////
+/// Reads the first color attachment of a framebuffer as 8 bit RGB, top row first
+///////////////////////////////////////////////////////////////////////////
+std::vector<uint8_t> readFramebuffer(GLuint framebuffer, int width, int height);
+
+///////////////////////////////////////////////////////////////////////////
+/// Stores the first color attachment of a framebuffer as a PNG file
+///////////////////////////////////////////////////////////////////////////
+void saveFramebuffer(GLuint framebuffer, int width, int height, const std::string& filename);
+
 ///////////////////////////////////////////////////////////////////////////
 /// Generates random, uniformly distributed floating point
 /// numbers in the interval [from, to].
@@ -0,0 +1,143 @@
+#include "benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+namespace {
+	struct Summary {
+		double mean, p50, p95, p99, worst;
+		size_t count;
+	};
+
+	Summary summarize(std::vector<double> values) {
+		Summary s = {};
+		s.count = values.size();
+		if (values.empty()) {
+			return s;
+		}
+		std::sort(values.begin(), values.end());
+		double sum = 0.0;
+		for (double v : values) {
+			sum += v;
+		}
+		auto percentile = [&](double p) { return values[size_t(std::ceil(p * values.size())) - 1]; };
+		s.mean = sum / values.size();
+		s.p50 = percentile(0.50);
+		s.p95 = percentile(0.95);
+		s.p99 = percentile(0.99);
+		s.worst = values.back();
+		return s;
+	}
+
+	void writeSummary(std::ostream& out, const std::string& name, const Summary& s) {
+		out << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3)
+		    << std::setw(10) << s.mean << std::setw(10) << s.p50 << std::setw(10) << s.p95 << std::setw(10)
+		    << s.p99 << std::setw(10) << s.worst << std::setw(8) << s.count << "\n";
+	}
+}
+
+Benchmark::Benchmark(const CameraPath& path, float timestep, int warmupFrames)
+    : path(path), step(timestep), warmupFrames(warmupFrames), frame(0)
+{
+	totalFrames = warmupFrames + int(std::floor(path.duration() / step)) + 1;
+}
+
+float Benchmark::time() const {
+	return frame < warmupFrames ? 0.0f : float(frame - warmupFrames) * step;
+}
+
+void Benchmark::endFrame(double cpuMs, uint64_t gpuFrame) {
+	if (frame >= warmupFrames) {
+		cpuTimes.push_back(cpuMs);
+		gpuFrames.push_back(gpuFrame);
+	}
+	frame++;
+}
+
+bool Benchmark::writeReport(const labhelper::GpuProfiler& profiler, std::string basename) const {
+	if (basename.empty()) {
+		auto tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+		std::ostringstream name;
+		name << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << "_benchmark";
+		basename = name.str();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Gather GPU pass times per measured frame, NaN where a sample is missing
+	///////////////////////////////////////////////////////////////////////////
+	const auto& passes = profiler.passes();
+	std::map<uint64_t, size_t> rowOfFrame;
+	for (size_t i = 0; i < gpuFrames.size(); i++) {
+		rowOfFrame[gpuFrames[i]] = i;
+	}
+	std::vector<std::vector<double>> gpuTimes(passes.size(), std::vector<double>(cpuTimes.size(), NAN));
+	for (const auto& sample : profiler.recordedSamples()) {
+		auto row = rowOfFrame.find(sample.frame);
+		if (row != rowOfFrame.end()) {
+			gpuTimes[sample.pass][row->second] = sample.ms;
+		}
+	}
+	std::vector<double> gpuTotal(cpuTimes.size(), 0.0);
+	for (size_t row = 0; row < cpuTimes.size(); row++) {
+		for (size_t pass = 0; pass < passes.size(); pass++) {
+			if (!std::isnan(gpuTimes[pass][row])) {
+				gpuTotal[row] += gpuTimes[pass][row];
+			}
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Raw samples
+	///////////////////////////////////////////////////////////////////////////
+	std::ofstream csv(basename + ".csv");
+	if (!csv) {
+		return false;
+	}
+	csv << "frame,time,cpu_ms";
+	for (const auto& pass : passes) {
+		csv << "," << pass.name << "_ms";
+	}
+	csv << ",gpu_total_ms\n";
+	for (size_t row = 0; row < cpuTimes.size(); row++) {
+		csv << row << "," << float(row) * step << "," << cpuTimes[row];
+		for (size_t pass = 0; pass < passes.size(); pass++) {
+			csv << ",";
+			if (!std::isnan(gpuTimes[pass][row])) {
+				csv << gpuTimes[pass][row];
+			}
+		}
+		csv << "," << gpuTotal[row] << "\n";
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	// Summary
+	///////////////////////////////////////////////////////////////////////////
+	std::ostringstream summary;
+	summary << "frames " << cpuTimes.size() << ", timestep " << step << " s, warmup " << warmupFrames
+	        << " frames, dropped gpu frames " << profiler.droppedFrames() << "\n";
+	summary << std::left << std::setw(20) << "ms" << std::right << std::setw(10) << "mean" << std::setw(10)
+	        << "p50" << std::setw(10) << "p95" << std::setw(10) << "p99" << std::setw(10) << "worst"
+	        << std::setw(8) << "n" << "\n";
+	writeSummary(summary, "cpu frame", summarize(cpuTimes));
+	for (size_t pass = 0; pass < passes.size(); pass++) {
+		std::vector<double> values;
+		for (double v : gpuTimes[pass]) {
+			if (!std::isnan(v)) {
+				values.push_back(v);
+			}
+		}
+		writeSummary(summary, "gpu " + passes[pass].name, summarize(values));
+	}
+	writeSummary(summary, "gpu total", summarize(gpuTotal));
+
+	std::ofstream txt(basename + ".txt");
+	txt << summary.str();
+	std::cout << summary.str();
+	return bool(txt);
+}
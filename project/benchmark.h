@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <Profiler.h>
+#include "cameraPath.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// Replays a camera path with a fixed timestep, so that the camera, the sun
+/// and the cloud animation are identical in every run, and collects the CPU
+/// time and GPU pass times of every frame.
+///
+/// The first `warmupFrames` frames are rendered at time 0 and not measured.
+///////////////////////////////////////////////////////////////////////////////
+class Benchmark {
+
+public:
+	Benchmark(const CameraPath& path, float timestep = 1.0f / 60.0f, int warmupFrames = 10);
+
+	/// Simulated time of the current frame
+	float time() const;
+	float timestep() const { return step; }
+
+	/// Camera and sun of the current frame
+	CameraKeyframe camera() const { return path.sample(time()); }
+
+	bool finished() const { return frame >= totalFrames; }
+
+	/// Records the frame's CPU time and the GpuProfiler frame number it was
+	/// profiled under, then advances to the next frame.
+	void endFrame(double cpuMs, uint64_t gpuFrame);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Writes the summary (mean, p50, p95, p99 and worst of every measurement)
+	/// to <basename>.txt and stdout, and all frames to <basename>.csv. Flush
+	/// the profiler first. An empty basename uses <timestamp>_benchmark.
+	///////////////////////////////////////////////////////////////////////////
+	bool writeReport(const labhelper::GpuProfiler& profiler, std::string basename = std::string()) const;
+
+private:
+	CameraPath path;
+	float step;
+	int warmupFrames;
+	int totalFrames;
+	int frame;
+	std::vector<double> cpuTimes;
+	std::vector<uint64_t> gpuFrames;
+};
@@ -0,0 +1,95 @@
+#include "cameraPath.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+float CameraPath::duration() const {
+	return keyframes.empty() ? 0.0f : keyframes.back().time;
+}
+
+CameraKeyframe CameraPath::sample(float time) const {
+	if (keyframes.empty()) {
+		return CameraKeyframe{ time, vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f) };
+	}
+	auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time,
+	                             [](float t, const CameraKeyframe& k) { return t < k.time; });
+	if (next == keyframes.begin()) {
+		return keyframes.front();
+	}
+	if (next == keyframes.end()) {
+		return keyframes.back();
+	}
+	const CameraKeyframe& a = *(next - 1);
+	const CameraKeyframe& b = *next;
+	float t = (time - a.time) / std::max(b.time - a.time, 1e-6f);
+
+	CameraKeyframe result;
+	result.time = time;
+	result.position = mix(a.position, b.position, t);
+	result.direction = normalize(mix(a.direction, b.direction, t));
+	result.lightDirection = normalize(mix(a.lightDirection, b.lightDirection, t));
+	return result;
+}
+
+void CameraPath::record(const CameraKeyframe& keyframe, float minInterval) {
+	if (keyframes.empty() || keyframe.time - keyframes.back().time >= minInterval) {
+		keyframes.push_back(keyframe);
+	}
+}
+
+bool CameraPath::load(const std::string& filename) {
+	std::ifstream file(filename);
+	if (!file) {
+		return false;
+	}
+	keyframes.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream in(line);
+		CameraKeyframe k;
+		in >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.direction.x >> k.direction.y
+		    >> k.direction.z >> k.lightDirection.x >> k.lightDirection.y >> k.lightDirection.z;
+		if (in) {
+			keyframes.push_back(k);
+		}
+	}
+	std::stable_sort(keyframes.begin(), keyframes.end(),
+	                 [](const CameraKeyframe& a, const CameraKeyframe& b) { return a.time < b.time; });
+	return !keyframes.empty();
+}
+
+bool CameraPath::save(const std::string& filename) const {
+	std::ofstream file(filename);
+	if (!file) {
+		return false;
+	}
+	file << "# time position.xyz direction.xyz lightDirection.xyz\n";
+	for (const CameraKeyframe& k : keyframes) {
+		file << k.time << " " << k.position.x << " " << k.position.y << " " << k.position.z << " "
+		     << k.direction.x << " " << k.direction.y << " " << k.direction.z << " " << k.lightDirection.x
+		     << " " << k.lightDirection.y << " " << k.lightDirection.z << "\n";
+	}
+	return true;
+}
+
+CameraPath CameraPath::orbit(vec3 center, float radius, float height, float duration) {
+	CameraPath path;
+	const int steps = 64;
+	for (int i = 0; i <= steps; i++) {
+		float f = float(i) / float(steps);
+		float angle = f * 2.0f * 3.14159265f;
+		float sunAngle = (0.25f + 0.5f * f) * 3.14159265f;
+
+		CameraKeyframe k;
+		k.time = f * duration;
+		k.position = center + vec3(radius * cos(angle), height, radius * sin(angle));
+		// Look past the center and slightly up, so both the scene and the clouds are in view
+		k.direction = normalize(center + vec3(0.0f, height * 0.5f, 0.0f) - k.position);
+		k.lightDirection = normalize(vec3(cos(sunAngle), 0.15f, sin(sunAngle)));
+		path.keyframes.push_back(k);
+	}
+	return path;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+using namespace glm;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Camera and sun keyframes over time, used to replay the same flythrough in
+/// every benchmark run. Stored as text, one keyframe per line:
+///   time  position.xyz  direction.xyz  lightDirection.xyz
+///////////////////////////////////////////////////////////////////////////////
+struct CameraKeyframe {
+	float time;
+	vec3 position;
+	vec3 direction;
+	vec3 lightDirection;
+};
+
+class CameraPath {
+
+public:
+	std::vector<CameraKeyframe> keyframes;
+
+	/// Time of the last keyframe
+	float duration() const;
+
+	/// Interpolates linearly between the keyframes around `time`
+	CameraKeyframe sample(float time) const;
+
+	/// Appends a keyframe, ignoring ones that are less than `minInterval` after the last
+	void record(const CameraKeyframe& keyframe, float minInterval = 0.1f);
+
+	bool load(const std::string& filename);
+	bool save(const std::string& filename) const;
+
+	/// Scripted default: one orbit around `center` while the sun turns a quarter circle
+	static CameraPath orbit(vec3 center, float radius, float height, float duration);
+};
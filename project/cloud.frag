@@ -1,39 +1,53 @@
 #version 420
 
+#ifdef CLOUD_INSTRUMENTATION
+#extension GL_ARB_shader_atomic_counter_ops : require
+#endif
+
 // required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
 precision highp float;
 
-// Matrices
-uniform mat4 proj_inverse;
-uniform mat4 pv;
-uniform mat4 view_inverse;
-uniform mat4 view;
-
-// Container Dimensions
-uniform vec3 container_min;
-uniform vec3 container_max;
-
-// Parameters
-uniform float density_threshold;
-uniform float density_multiplier;
-uniform float light_absorption;
-uniform float light_absorption_sun;
-uniform float darkness_threshold;
-uniform float step_size_sun;
-uniform float step_size;
-uniform float step_size_incr;
-uniform float step_size_incr_sun;
-uniform float cloud_scale;
-uniform float cloud_speed;
-uniform float forward_scattering;
-uniform float blue_noise_offset_factor;
-
-// Light Source
-uniform vec3 light_direction;
-uniform vec3 light_color;
-
-// Time
-uniform float time;
+// Shared uniform blocks, see uniformBlocks.h
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 view;
+	mat4 view_inverse;
+	mat4 proj_inverse;
+	mat4 pv;
+	mat4 pv_inverse;
+	vec3 camera_pos;
+	float time;
+};
+
+layout(std140, binding = 1) uniform SkyBlock {
+	vec3 light_direction;
+	float environment_multiplier;
+	vec3 light_color;
+	float light_intensity_multiplier;
+	vec3 color_sky;
+	vec3 color_horizon;
+};
+
+layout(std140, binding = 2) uniform CloudBlock {
+	// Container Dimensions
+	vec3 container_min;
+	float density_threshold;
+	vec3 container_max;
+	float density_multiplier;
+
+	// Parameters
+	float light_absorption;
+	float light_absorption_sun;
+	float darkness_threshold;
+	float step_size_sun;
+	float step_size;
+	float step_size_incr;
+	float step_size_incr_sun;
+	float cloud_scale;
+	float cloud_speed;
+	float forward_scattering;
+	float blue_noise_offset_factor;
+	float weather_scale;
+};
 
 const float M_PI = 3.14159265358979;
 
@@ -43,9 +57,33 @@ layout(binding = 9) uniform sampler3D shapeNoise;
 layout(binding = 10) uniform sampler2D screen_color;
 layout(binding = 11) uniform sampler2D screen_depth;
 layout(binding = 13) uniform sampler2D sample_offset_texture; // Blue noise texture
+layout(binding = 14) uniform sampler2D cloud_profile;	// Density over (height, cloud type), see cloudProfile.h
+layout(binding = 15) uniform sampler2D weather_map;		// Coverage and cloud type over the xz plane
+
+const float PROFILE_TYPE_RES = 33.0;	// Rows of the profile lookup table
 
 layout(location = 0) out vec4 fragmentColor;
 
+#ifdef CLOUD_INSTRUMENTATION
+// Frame totals, summed over all pixels
+layout(binding = 0, offset = 0) uniform atomic_uint stat_total_view_steps;
+layout(binding = 0, offset = 4) uniform atomic_uint stat_total_light_steps;
+layout(binding = 0, offset = 8) uniform atomic_uint stat_total_density_fetches;
+layout(binding = 0, offset = 12) uniform atomic_uint stat_total_early_terminations;
+layout(binding = 0, offset = 16) uniform atomic_uint stat_total_marched_pixels;
+
+// Per-pixel counts: view steps, light steps, density fetches, early termination
+layout(binding = 0, rgba32ui) uniform writeonly uimage2D stat_image;
+
+uint stat_view_steps = 0u;
+uint stat_light_steps = 0u;
+uint stat_density_fetches = 0u;
+uint stat_early_termination = 0u;
+#define STAT_INCREMENT(counter) counter += 1u
+#else
+#define STAT_INCREMENT(counter)
+#endif
+
 float beersLaw(float x, float d){
 	return exp(-x * d);
 }
@@ -60,21 +98,25 @@ float remap(float value, float low1, float high1, float low2, float high2){
 }
 
 float sampleCloudDensity(vec3 pos){
-	
-	// Shape altering height function
-	float h = remap(pos.y, container_min.y, container_max.y, 0.0, 1.0);
 
-	float SA_bottom = clamp(h * remap(h, 0.0, 0.07, 0.0, 1.0), 0.0, 1.0);
-	float SA_top = clamp(remap(h, 0.3, 1.0, 1.0, 0.0), 0.0, 1.0);
+	vec3 offset = time * cloud_speed * normalize(vec3(1.0, 0.0, 2.0));
+
+	// Coverage and cloud type, skip the noise fetch where there are no clouds
+	vec2 weather = texture(weather_map, (pos.xz + offset.xz) * weather_scale * 0.0001).rg;
+	if (weather.r <= 0.0) return 0.0;
 
+	// Baked shape altering height function for this cloud type
+	float h = remap(pos.y, container_min.y, container_max.y, 0.0, 1.0);
+	float profile = texture(cloud_profile, vec2(h, (weather.g * (PROFILE_TYPE_RES - 1.0) + 0.5) / PROFILE_TYPE_RES)).r;
+	if (profile <= 0.0) return 0.0;
 
 	// Sample density
-	vec3 offset = time * cloud_speed * normalize(vec3(1.0, 0.0, 2.0));
+	STAT_INCREMENT(stat_density_fetches);
 	vec4 c = texture(shapeNoise, (pos + offset) * cloud_scale * 0.01);
 
 	// Combine shape and detail noise
 	float density = max(0.0, remap(c.r, (0.625 * c.g + 0.25 * c.b + 0.125 * c.a) - 1.0, 1.0, 0.0, 1.0) - density_threshold) * density_multiplier;
-	return density * SA_bottom * SA_top;
+	return density * profile * weather.r;
 }
 
 float marchLightRay(vec3 pos){
@@ -102,6 +144,7 @@ float marchLightRay(vec3 pos){
 			float weight = i < step_cnt ? step_size_sun * float(step_mtp) : step_last + step_size_sun * float(step_mtp - 1);
 
 			float density = sampleCloudDensity(sample_pos);
+			STAT_INCREMENT(stat_light_steps);
 		
 			transmittance *= beersLaw(density * weight, light_absorption_sun);
 
@@ -176,6 +219,7 @@ void main()
 			}
 
 			float density = sampleCloudDensity(sample_pos);	// Sample density volume
+			STAT_INCREMENT(stat_view_steps);
 
 			// Weight of current step proportional to step length
 			float weight = i < step_cnt ? step_size * float(step_mtp) : step_last + step_size * float(step_mtp - 1);
@@ -189,7 +233,10 @@ void main()
 				transmittance *= beersLaw(density * weight, light_absorption);
 			}
 
-			if (transmittance <= 0.0) break;	// Stop marching if transmittance reaches 0
+			if (transmittance <= 0.0){	// Stop marching if transmittance reaches 0
+				STAT_INCREMENT(stat_early_termination);
+				break;
+			}
 			step_mtp = min(int(floor(1.0 / pow(transmittance, step_size_incr))), max(step_cnt - i, 1)); // Skip steps if transmittance is low enough
 
 			i += step_mtp;
@@ -197,8 +244,19 @@ void main()
 	}
 
 	// Blend between screen- and cloud color
-	vec3 screen_rgb = texture(screen_color, texCoord).rgb;
+	vec3 screen_rgb = sampled_color.rgb;
 	vec3 cloud_rgb = light_color * light_energy;
 
 	fragmentColor = vec4(screen_rgb * transmittance + cloud_rgb, 1.0);
+
+#ifdef CLOUD_INSTRUMENTATION
+	imageStore(stat_image, ivec2(gl_FragCoord.xy), uvec4(stat_view_steps, stat_light_steps, stat_density_fetches, stat_early_termination));
+	if (stat_view_steps > 0u){
+		atomicCounterAddARB(stat_total_view_steps, stat_view_steps);
+		atomicCounterAddARB(stat_total_light_steps, stat_light_steps);
+		atomicCounterAddARB(stat_total_density_fetches, stat_density_fetches);
+		atomicCounterAddARB(stat_total_early_terminations, stat_early_termination);
+		atomicCounterIncrement(stat_total_marched_pixels);
+	}
+#endif
 }
@@ -0,0 +1,39 @@
+#version 420
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// Per-pixel cost counters written by the instrumented cloud shader
+layout(binding = 12) uniform usampler2D stat_counts;
+
+uniform int metric;			// 0: view steps, 1: light steps, 2: density fetches, 3: early terminations
+uniform float max_value;	// Count that maps to the hot end of the colour ramp
+uniform float opacity;
+
+in vec2 texCoord;
+
+layout(location = 0) out vec4 fragmentColor;
+
+// Polynomial fit of the "turbo" colour map
+vec3 falseColor(float x){
+	x = clamp(x, 0.0, 1.0);
+	const vec4 kr = vec4(0.13572138, 4.61539260, -42.66032258, 132.13108234);
+	const vec4 kg = vec4(0.09140261, 2.19418839, 4.84296658, -14.18503333);
+	const vec4 kb = vec4(0.10667330, 12.64194608, -60.58204836, 110.36276771);
+	const vec2 kr2 = vec2(-152.94239396, 59.28637943);
+	const vec2 kg2 = vec2(4.27729857, 2.82956604);
+	const vec2 kb2 = vec2(-89.90310912, 27.34824973);
+	vec4 v4 = vec4(1.0, x, x * x, x * x * x);
+	vec2 v2 = v4.zw * v4.z;
+	return vec3(dot(v4, kr) + dot(v2, kr2), dot(v4, kg) + dot(v2, kg2), dot(v4, kb) + dot(v2, kb2));
+}
+
+void main()
+{
+	uvec4 counts = texelFetch(stat_counts, ivec2(gl_FragCoord.xy), 0);
+	float value = float(counts[metric]);
+
+	if (value <= 0.0) discard;	// Leave pixels that did no work untouched
+
+	fragmentColor = vec4(falseColor(value / max(max_value, 1.0)), opacity);
+}
@@ -0,0 +1,157 @@
+#include "cloudInstrumentation.h"
+#include <GL/glew.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#include <labhelper.h>
+#include <GLState.h>
+
+CloudInstrumentation::CloudInstrumentation()
+    : supported(false), width(0), height(0), frame(0), statImage(0), heatmapShader(0)
+{
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		totals[i] = 0;
+	}
+	for (int i = 0; i < NUM_COUNTER_BUFFERS; i++) {
+		counterBuffers[i] = 0;
+	}
+
+	// Image load/store and atomic counters are core in 4.2, adding arbitrary values to a counter is not
+	supported = GLEW_VERSION_4_2 && glewIsExtensionSupported("GL_ARB_shader_atomic_counter_ops");
+	if (!supported) {
+		std::cout << "Cloud instrumentation disabled: GL_ARB_shader_atomic_counter_ops not supported.\n";
+		return;
+	}
+
+	// Ring of counter buffers. Totals are read from the oldest one, which the GPU is done with by then.
+	const uint32_t zeros[COUNTER_COUNT] = {};
+	glGenBuffers(NUM_COUNTER_BUFFERS, counterBuffers);
+	for (int i = 0; i < NUM_COUNTER_BUFFERS; i++) {
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffers[i]);
+		glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(zeros), zeros, GL_DYNAMIC_READ);
+	}
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+	heatmapShader = labhelper::loadShaderProgram("../project/fullscreenQuad.vert", "../project/cloudHeatmap.frag");
+}
+
+CloudInstrumentation::~CloudInstrumentation()
+{
+	if (!supported) return;
+	glDeleteBuffers(NUM_COUNTER_BUFFERS, counterBuffers);
+	labhelper::getGLState().deleteTextures(1, &statImage);
+	glDeleteProgram(heatmapShader);
+}
+
+void CloudInstrumentation::resize(int w, int h) {
+	if (!supported || (w == width && h == height && statImage != 0)) return;
+
+	width = w;
+	height = h;
+
+	if (statImage == 0) {
+		glGenTextures(1, &statImage);
+	}
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, statImage);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, width, height, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, 0);
+}
+
+void CloudInstrumentation::bind() {
+	if (!supported) return;
+
+	// The image needs no clearing, the full screen cloud pass writes every pixel
+	const uint32_t zeros[COUNTER_COUNT] = {};
+	GLuint buffer = counterBuffers[frame % NUM_COUNTER_BUFFERS];
+	glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, buffer);
+	glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(zeros), zeros);
+	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, buffer);
+
+	glBindImageTexture(0, statImage, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+}
+
+void CloudInstrumentation::endFrame() {
+	if (!supported) return;
+
+	// Readers of the per-pixel image issue their own barrier (the render graph, dump())
+	glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, 0);
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+
+	frame++;
+
+	// The buffer that will be reused next frame was written NUM_COUNTER_BUFFERS - 1 frames ago
+	if (frame >= NUM_COUNTER_BUFFERS) {
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counterBuffers[frame % NUM_COUNTER_BUFFERS]);
+		glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, COUNTER_COUNT * sizeof(uint32_t), totals);
+		glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+	}
+}
+
+void CloudInstrumentation::drawHeatmap(int metric, float maxValue, float opacity) {
+	if (!supported) return;
+
+	labhelper::GLStateCache& gl = labhelper::getGLState();
+	gl.setBlend(true);
+	gl.setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	gl.useProgram(heatmapShader);
+	labhelper::setUniformSlow(heatmapShader, "metric", metric);
+	labhelper::setUniformSlow(heatmapShader, "max_value", maxValue);
+	labhelper::setUniformSlow(heatmapShader, "opacity", opacity);
+	labhelper::drawFullScreenQuad();
+
+	gl.setBlend(false);
+}
+
+void CloudInstrumentation::dump(const vec3& cameraPosition, const vec3& cameraDirection) {
+	if (!supported) return;
+
+	std::vector<uint32_t> counts(size_t(width) * height * 4);
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, statImage);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, counts.data());
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, 0);
+
+	// Totals straight from the image, so they belong to the same frame as the raw dump
+	uint64_t sums[4] = { 0, 0, 0, 0 };
+	uint32_t maxima[4] = { 0, 0, 0, 0 };
+	uint64_t marchedPixels = 0;
+	for (size_t i = 0; i < counts.size(); i += 4) {
+		for (int c = 0; c < 4; c++) {
+			sums[c] += counts[i + c];
+			maxima[c] = std::max(maxima[c], counts[i + c]);
+		}
+		if (counts[i + VIEW_STEPS] > 0) marchedPixels++;
+	}
+
+	std::time_t tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::stringstream base;
+	base << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S") << "_cloudstats";
+
+	std::ofstream summary(base.str() + ".txt");
+	summary << "camera_position " << cameraPosition.x << " " << cameraPosition.y << " " << cameraPosition.z << "\n";
+	summary << "camera_direction " << cameraDirection.x << " " << cameraDirection.y << " " << cameraDirection.z << "\n";
+	summary << "resolution " << width << " " << height << "\n";
+	summary << "marched_pixels " << marchedPixels << "\n";
+	const char* names[4] = { "view_steps", "light_steps", "density_fetches", "early_terminations" };
+	for (int c = 0; c < 4; c++) {
+		summary << names[c] << " total " << sums[c] << " max " << maxima[c] << " mean_per_marched_pixel "
+		        << (marchedPixels > 0 ? double(sums[c]) / double(marchedPixels) : 0.0) << "\n";
+	}
+	summary << "# " << base.str() << ".raw: " << width << "x" << height
+	        << " pixels, bottom row first, 4 x uint32 per pixel in the order above\n";
+
+	std::ofstream raw(base.str() + ".raw", std::ios::binary);
+	raw.write(reinterpret_cast<const char*>(counts.data()), counts.size() * sizeof(uint32_t));
+
+	std::cout << "Wrote cloud statistics to " << base.str() << ".txt/.raw\n";
+}
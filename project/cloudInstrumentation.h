@@ -0,0 +1,68 @@
+#pragma once
+#include <GL/glew.h>
+#include <string>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+using namespace glm;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Collects per-pixel and per-frame cost statistics of the cloud ray marcher.
+/// Used together with the CLOUD_INSTRUMENTATION permutation of cloud.frag,
+/// which writes into the buffers bound by bind().
+///////////////////////////////////////////////////////////////////////////////
+class CloudInstrumentation {
+
+public:
+	enum Counter {
+		VIEW_STEPS = 0,
+		LIGHT_STEPS,
+		DENSITY_FETCHES,
+		EARLY_TERMINATIONS,
+		MARCHED_PIXELS,
+		COUNTER_COUNT
+	};
+
+	CloudInstrumentation(void);
+	~CloudInstrumentation();
+
+	/// True if the driver supports the extensions the instrumented shader needs
+	bool isSupported() const { return supported; }
+
+	/// (Re)allocates the per-pixel statistics image if the size changed
+	void resize(int w, int h);
+
+	/// Binds the counter buffer for this frame (after resetting it) and the
+	/// per-pixel image. Call before drawing with the instrumented cloud shader.
+	void bind();
+
+	/// Makes this frame's counter writes visible and picks up the totals of an older
+	/// frame, so reading them back never waits for the GPU.
+	void endFrame();
+
+	/// Draws the per-pixel counts of `metric` as a false-colour overlay.
+	/// Expects statTexture() on texture unit 12.
+	void drawHeatmap(int metric, float maxValue, float opacity);
+
+	/// Writes a summary and the raw per-pixel counts to disk, named after the
+	/// current time and tagged with the given camera.
+	void dump(const vec3& cameraPosition, const vec3& cameraDirection);
+
+	/// The per-pixel image written through image unit 0, 0 before the first resize()
+	GLuint statTexture() const { return statImage; }
+
+	/// Totals of the most recent frame that has been read back
+	uint32_t totals[COUNTER_COUNT];
+
+private:
+	static const int NUM_COUNTER_BUFFERS = 3;
+
+	bool supported;
+	int width;
+	int height;
+	int frame;
+
+	GLuint counterBuffers[NUM_COUNTER_BUFFERS];
+	GLuint statImage;
+	GLuint heatmapShader;
+};
@@ -0,0 +1,125 @@
+#include "cloudProfile.h"
+#include <GL/glew.h>
+#include <vector>
+#include <cstdint>
+#include <GLState.h>
+
+float CloudLayerProfile::evaluate(float h) const {
+	float b = max(h - base, 0.0f);
+	float bottom = clamp(b * b / bottomRamp, 0.0f, 1.0f);
+	float top = clamp((topEnd - h) / (topEnd - topStart), 0.0f, 1.0f);
+	return bottom * top;
+}
+
+namespace {
+	// Hashed lattice value in [0,1], wrapping with `period` so the weather map tiles
+	float latticeValue(int x, int y, int period, uint32_t seed) {
+		uint32_t h = uint32_t((x % period + period) % period) * 73856093u
+		             ^ uint32_t((y % period + period) % period) * 19349663u ^ seed * 83492791u;
+		h ^= h >> 13;
+		h *= 0x5bd1e995u;
+		h ^= h >> 15;
+		return float(h & 0xffffu) / 65535.0f;
+	}
+
+	float valueNoise(vec2 p, int period, uint32_t seed) {
+		vec2 cell = floor(p);
+		vec2 f = p - cell;
+		vec2 u = f * f * (3.0f - 2.0f * f);
+		int x = int(cell.x), y = int(cell.y);
+		float a = latticeValue(x, y, period, seed);
+		float b = latticeValue(x + 1, y, period, seed);
+		float c = latticeValue(x, y + 1, period, seed);
+		float d = latticeValue(x + 1, y + 1, period, seed);
+		return mix(mix(a, b, u.x), mix(c, d, u.x), u.y);
+	}
+
+	// Tileable fractal noise over the unit square
+	float fbm(vec2 uv, uint32_t seed) {
+		float sum = 0.0f, amplitude = 0.5f, norm = 0.0f;
+		int period = 4;
+		for (int octave = 0; octave < 4; octave++) {
+			sum += amplitude * valueNoise(uv * float(period), period, seed + octave);
+			norm += amplitude;
+			amplitude *= 0.5f;
+			period *= 2;
+		}
+		return sum / norm;
+	}
+}
+
+CloudProfile::CloudProfile()
+    : coverage(1.0f), patchiness(0.0f), cloudType(0.5f), typeVariation(0.0f)
+{
+	// The cumulus profile reproduces the original hard-coded shape-altering function
+	profiles[STRATUS] = { 0.0f, 0.02f, 0.1f, 0.25f };
+	profiles[CUMULUS] = { 0.0f, 0.07f, 0.3f, 1.0f };
+	profiles[CUMULONIMBUS] = { 0.0f, 0.1f, 0.7f, 1.0f };
+
+	glGenTextures(1, &profileTexture);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, profileTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, PROFILE_HEIGHT_RES, PROFILE_TYPE_RES, 0, GL_RED, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenTextures(1, &weatherTexture);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, weatherTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, WEATHER_RES, WEATHER_RES, 0, GL_RG, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, 0);
+
+	bakeProfiles();
+	bakeWeatherMap();
+}
+
+CloudProfile::~CloudProfile()
+{
+	labhelper::getGLState().deleteTextures(1, &profileTexture);
+	labhelper::getGLState().deleteTextures(1, &weatherTexture);
+}
+
+void CloudProfile::bakeProfiles() {
+	std::vector<float> lut(PROFILE_HEIGHT_RES * PROFILE_TYPE_RES);
+
+	for (int t = 0; t < PROFILE_TYPE_RES; t++) {
+		// Blend between the two neighbouring presets
+		float type = float(t) / float(PROFILE_TYPE_RES - 1) * float(TYPE_COUNT - 1);
+		int lower = min(int(type), TYPE_COUNT - 2);
+		float blend = type - float(lower);
+
+		for (int i = 0; i < PROFILE_HEIGHT_RES; i++) {
+			float h = (float(i) + 0.5f) / float(PROFILE_HEIGHT_RES);
+			lut[t * PROFILE_HEIGHT_RES + i] = mix(profiles[lower].evaluate(h), profiles[lower + 1].evaluate(h), blend);
+		}
+	}
+
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, profileTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PROFILE_HEIGHT_RES, PROFILE_TYPE_RES, GL_RED, GL_FLOAT, lut.data());
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, 0);
+}
+
+void CloudProfile::bakeWeatherMap() {
+	std::vector<float> weather(WEATHER_RES * WEATHER_RES * 2);
+
+	for (int y = 0; y < WEATHER_RES; y++) {
+		for (int x = 0; x < WEATHER_RES; x++) {
+			vec2 uv = (vec2(x, y) + 0.5f) / float(WEATHER_RES);
+
+			float patches = smoothstep(0.9f - coverage, 1.1f - coverage, fbm(uv, 1u));
+			float c = mix(coverage, patches, patchiness);
+			float type = mix(cloudType, fbm(uv, 7u), typeVariation);
+
+			weather[(y * WEATHER_RES + x) * 2 + 0] = clamp(c, 0.0f, 1.0f);
+			weather[(y * WEATHER_RES + x) * 2 + 1] = clamp(type, 0.0f, 1.0f);
+		}
+	}
+
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, weatherTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WEATHER_RES, WEATHER_RES, GL_RG, GL_FLOAT, weather.data());
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, 0);
+}
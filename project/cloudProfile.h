@@ -0,0 +1,63 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+using namespace glm;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Vertical density profile of one cloud type, in normalized container height.
+/// Density fades in quadratically from `base` over `bottomRamp`, and fades out
+/// linearly between `topStart` and `topEnd`.
+///////////////////////////////////////////////////////////////////////////////
+struct CloudLayerProfile {
+	float base;
+	float bottomRamp;
+	float topStart;
+	float topEnd;
+
+	float evaluate(float h) const;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Bakes the vertical cloud profiles and a horizontal weather map into small
+/// lookup textures, so the ray marcher fetches its shape once per step instead
+/// of evaluating the height function, and can skip uncovered regions.
+///
+/// profileTexture: R = density scale, x = normalized height, y = cloud type
+///                 (0 stratus, 0.5 cumulus, 1 cumulonimbus)
+/// weatherTexture: R = coverage, G = cloud type, tiled over the xz plane
+///////////////////////////////////////////////////////////////////////////////
+class CloudProfile {
+
+public:
+	enum Type {
+		STRATUS = 0,
+		CUMULUS,
+		CUMULONIMBUS,
+		TYPE_COUNT
+	};
+
+	CloudProfile(void);
+	~CloudProfile();
+
+	/// Re-bakes the profile lookup table from `profiles`
+	void bakeProfiles();
+
+	/// Re-bakes the weather map from the coverage and type settings
+	void bakeWeatherMap();
+
+	CloudLayerProfile profiles[TYPE_COUNT];
+
+	float coverage;			// Fraction of the sky covered by clouds
+	float patchiness;		// 0 spreads the coverage evenly, 1 concentrates it into patches
+	float cloudType;		// Dominant cloud type, 0 stratus to 1 cumulonimbus
+	float typeVariation;	// How much the cloud type varies across the weather map
+
+	GLuint profileTexture;
+	GLuint weatherTexture;
+
+private:
+	static const int PROFILE_HEIGHT_RES = 128;
+	static const int PROFILE_TYPE_RES = 33;	// Odd, so every preset lands exactly on a row
+	static const int WEATHER_RES = 256;
+};
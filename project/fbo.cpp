@@ -1,6 +1,7 @@
 #include "fbo.h"
 #include <cstdint>
 #include <labhelper.h>
+#include <GLState.h>
 
 FboInfo::FboInfo(int numberOfColorBuffers)
     : isComplete(false), framebufferId(0), depthBuffer(0), width(0), height(0)
@@ -8,81 +9,75 @@ FboInfo::FboInfo(int numberOfColorBuffers)
 	colorTextureTargets.resize(numberOfColorBuffers, 0);
 };
 
+void FboInfo::createTexture(GLuint& texture, GLenum internalFormat)
+{
+	// Immutable storage can't be resized, so a new size means a new texture
+	if(texture != 0)
+	{
+		labhelper::getGLState().deleteTextures(1, &texture);
+	}
+	glGenTextures(1, &texture);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, texture);
+	glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
 void FboInfo::resize(int w, int h)
 {
+	// Minimized windows report a size of zero, which immutable storage does not accept
+	w = w > 0 ? w : 1;
+	h = h > 0 ? h : 1;
+
+	if(isComplete && w == width && h == height)
+	{
+		return;
+	}
+
 	width = w;
 	height = h;
 
 	///////////////////////////////////////////////////////////////////////
-	// if no texture indices yet, allocate
+	// Allocate textures with immutable storage of the new size
 	///////////////////////////////////////////////////////////////////////
 	for(auto& colorTextureTarget : colorTextureTargets)
 	{
-		if(colorTextureTarget == 0)
-		{
-			glGenTextures(1, &colorTextureTarget);
-			glBindTexture(GL_TEXTURE_2D, colorTextureTarget);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		}
-	}
-
-	if(depthBuffer == 0)
-	{
-		glGenTextures(1, &depthBuffer);
-		glBindTexture(GL_TEXTURE_2D, depthBuffer);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		createTexture(colorTextureTarget, colorTargetType);
 	}
+	createTexture(depthBuffer, depthTargetType);
+	labhelper::getGLState().bindTexture(GL_TEXTURE_2D, 0);
 
 	///////////////////////////////////////////////////////////////////////
-	// Allocate / Resize textures
+	// Generate framebuffer (if not already done)
 	///////////////////////////////////////////////////////////////////////
-	for(auto& colorTextureTarget : colorTextureTargets)
+	if(framebufferId == 0)
 	{
-		glBindTexture(GL_TEXTURE_2D, colorTextureTarget);
-		glTexImage2D(GL_TEXTURE_2D, 0, colorTargetType, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glGenFramebuffers(1, &framebufferId);
 	}
-
-	glBindTexture(GL_TEXTURE_2D, depthBuffer);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
-	             nullptr);
+	labhelper::getGLState().bindFramebuffer(framebufferId);
 
 	///////////////////////////////////////////////////////////////////////
-	// Bind textures to framebuffer (if not already done)
+	// Bind textures to framebuffer, the textures are new after every resize
 	///////////////////////////////////////////////////////////////////////
-	if(!isComplete)
+	for(int i = 0; i < int(colorTextureTargets.size()); i++)
 	{
-		///////////////////////////////////////////////////////////////////////
-		// Generate and bind framebuffer
-		///////////////////////////////////////////////////////////////////////
-		glGenFramebuffers(1, &framebufferId);
-		glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
-
-		// Bind the color textures as color attachments
-		for(int i = 0; i < int(colorTextureTargets.size()); i++)
-		{
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
-			                       colorTextureTargets[i], 0);
-		}
-		GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
-			                     GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5,
-			                     GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7 };
-		glDrawBuffers(int(colorTextureTargets.size()), attachments);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorTextureTargets[i], 0);
+	}
+	GLenum attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
+		                     GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5,
+		                     GL_COLOR_ATTACHMENT6, GL_COLOR_ATTACHMENT7 };
+	glDrawBuffers(int(colorTextureTargets.size()), attachments);
 
-		// bind the texture as depth attachment (to the currently bound framebuffer)
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
+	// bind the texture as depth attachment (to the currently bound framebuffer)
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthBuffer, 0);
 
-		// check if framebuffer is complete
-		isComplete = checkFramebufferComplete();
-	}
+	// check if framebuffer is complete
+	isComplete = checkFramebufferComplete();
 
 	// bind default framebuffer, just in case.
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	labhelper::getGLState().bindFramebuffer(0);
 }
 
 bool FboInfo::checkFramebufferComplete(void)
@@ -90,7 +85,7 @@ bool FboInfo::checkFramebufferComplete(void)
 	// Check that our FBO is correctly set up, this can fail if we have
 	// incompatible formats in a buffer, or for example if we specify an
 	// invalid drawbuffer, among things.
-	glBindFramebuffer(GL_FRAMEBUFFER, framebufferId);
+	labhelper::getGLState().bindFramebuffer(framebufferId);
 	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if(status != GL_FRAMEBUFFER_COMPLETE)
 	{
@@ -99,3 +94,88 @@ bool FboInfo::checkFramebufferComplete(void)
 
 	return (status == GL_FRAMEBUFFER_COMPLETE);
 }
+
+void FboInfo::free()
+{
+	for(auto& colorTextureTarget : colorTextureTargets)
+	{
+		labhelper::getGLState().deleteTextures(1, &colorTextureTarget);
+		colorTextureTarget = 0;
+	}
+	labhelper::getGLState().deleteTextures(1, &depthBuffer);
+	labhelper::getGLState().deleteFramebuffers(1, &framebufferId);
+	depthBuffer = 0;
+	framebufferId = 0;
+	isComplete = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Render target pool
+///////////////////////////////////////////////////////////////////////////////
+FboInfo* RenderTargetPool::acquire(int w, int h, GLenum colorFormat, int numberOfColorBuffers, GLenum depthFormat)
+{
+	// As in FboInfo::resize(), or a minimized window would never match a pooled target
+	w = w > 0 ? w : 1;
+	h = h > 0 ? h : 1;
+
+	for(auto& entry : entries)
+	{
+		FboInfo* fbo = entry.fbo;
+		if(!entry.inUse && fbo->width == w && fbo->height == h && fbo->colorTargetType == colorFormat
+		   && fbo->depthTargetType == depthFormat && int(fbo->colorTextureTargets.size()) == numberOfColorBuffers)
+		{
+			entry.inUse = true;
+			entry.unusedFrames = 0;
+			return fbo;
+		}
+	}
+
+	FboInfo* fbo = new FboInfo(numberOfColorBuffers);
+	fbo->colorTargetType = colorFormat;
+	fbo->depthTargetType = depthFormat;
+	fbo->resize(w, h);
+	entries.push_back({ fbo, true, 0 });
+	numAllocations++;
+	return fbo;
+}
+
+void RenderTargetPool::release(FboInfo* fbo)
+{
+	for(auto& entry : entries)
+	{
+		if(entry.fbo == fbo)
+		{
+			entry.inUse = false;
+			return;
+		}
+	}
+}
+
+void RenderTargetPool::endFrame(int maxUnusedFrames)
+{
+	for(size_t i = 0; i < entries.size();)
+	{
+		Entry& entry = entries[i];
+		if(!entry.inUse && ++entry.unusedFrames > maxUnusedFrames)
+		{
+			entry.fbo->free();
+			delete entry.fbo;
+			entries[i] = entries.back();
+			entries.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+void RenderTargetPool::clear()
+{
+	for(auto& entry : entries)
+	{
+		entry.fbo->free();
+		delete entry.fbo;
+	}
+	entries.clear();
+}
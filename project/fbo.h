@@ -1,3 +1,4 @@
+#pragma once
 #include <GL/glew.h>
 #include <vector>
 
@@ -10,9 +11,53 @@ public:
 	int height;
 	bool isComplete;
 	GLenum colorTargetType = GL_RGBA16F;
+	GLenum depthTargetType = GL_DEPTH_COMPONENT32;
 
 	FboInfo(int numberOfColorBuffers = 1);
 		
+	/// (Re)allocates the attachments as immutable textures. Does nothing if the
+	/// size did not change, so it is cheap to call every frame.
 	void resize(int w, int h);
 	bool checkFramebufferComplete(void);
+
+	/// Deletes the textures and the framebuffer
+	void free();
+
+private:
+	void createTexture(GLuint& texture, GLenum internalFormat);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Keeps render targets alive between frames so that passes needing a
+/// temporary target reuse an existing one of the same format and size instead
+/// of allocating a new one. Targets that have not been acquired for a few
+/// frames (e.g. after a window resize) are freed in endFrame().
+///////////////////////////////////////////////////////////////////////////////
+class RenderTargetPool {
+public:
+	/// Returns an unused target with the given size and formats, creating one if needed
+	FboInfo* acquire(int w, int h, GLenum colorFormat, int numberOfColorBuffers = 1,
+	                 GLenum depthFormat = GL_DEPTH_COMPONENT32);
+
+	/// Hands a target back to the pool. Its contents are undefined once acquired again.
+	void release(FboInfo* fbo);
+
+	/// Frees targets that have not been used for `maxUnusedFrames` frames
+	void endFrame(int maxUnusedFrames = 3);
+
+	/// Frees every target, also the ones in use. Call before the GL context goes away.
+	void clear();
+
+	/// Number of live targets, and of allocations since start (for profiling)
+	int size() const { return int(entries.size()); }
+	int allocations() const { return numAllocations; }
+
+private:
+	struct Entry {
+		FboInfo* fbo;
+		bool inUse;
+		int unusedFrames;
+	};
+	std::vector<Entry> entries;
+	int numAllocations = 0;
 };
@@ -6,6 +6,11 @@ out vec2 texCoord;
 
 void main()
 {
+#ifdef FAR_PLANE
+	// Depth 1, so with GL_LEQUAL only pixels no geometry was drawn to pass
+	gl_Position = vec4(position, 1.0, 1.0);
+#else
 	gl_Position = vec4(position, 0.0, 1.0);
+#endif
 	texCoord = 0.5 * (position + vec2(1, 1));
 }
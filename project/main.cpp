@@ -7,8 +7,13 @@ extern "C" _declspec(dllexport) unsigned int NvOptimusEnablement = 0x00000001;
 #include <GL/glew.h>
 #include <cmath>
 #include <cstdlib>
+#include <cstdio>
+#include <iostream>
 #include <algorithm>
 #include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
 
 #include <labhelper.h>
 #include <imgui.h>
@@ -23,6 +28,23 @@ using namespace glm;
 #include "fbo.h"
 
 #include "noiseGenerator.h"
+#include "cloudInstrumentation.h"
+#include "cloudProfile.h"
+#include "uniformBlocks.h"
+#include "cameraPath.h"
+#include "benchmark.h"
+#include "regression.h"
+#include "renderGraph.h"
+#include <UniformBuffer.h>
+#include <ShaderProgram.h>
+#include <Profiler.h>
+#include <Trace.h>
+#include <FrameCapture.h>
+#include <FramePacer.h>
+#include <GLState.h>
+#include <ObjParser.h>
+#include <AssetLoader.h>
+#include <SceneBatcher.h>
 
 
 
@@ -40,23 +62,83 @@ float deltaTime = 0.0f;
 bool showUI = false;
 int windowWidth, windowHeight;
 
+// Headless mode (--headless) renders a fixed number of frames into outputTarget
+bool headless = false;
+int headlessFrames = 100;
+int headlessWidth = 1280, headlessHeight = 720;
+bool saveHeadlessFrames = false;
+FboInfo* outputTarget = nullptr;
+GLuint outputFramebuffer = 0; // Where display() puts the final image, 0 is the window
+
+// Benchmark mode (--benchmark [path]) replays a camera path with a fixed timestep
+bool benchmarkMode = false;
+std::string benchmarkPathFile;
+float benchmarkTimestep = 1.0f / 60.0f;
+int benchmarkWarmup = 10;
+Benchmark* benchmark = nullptr;
+// --record-path writes the camera and sun of an interactive session for later replay
+std::string recordPathFile;
+CameraPath recordedPath;
+
+// Regression mode (--regression [dir]) compares presets against golden images
+bool regressionMode = false;
+bool updateGoldenImages = false;
+std::string regressionDir = "../scenes/regression";
+RegressionTolerances regressionTolerances;
+
 // Mouse input
 ivec2 g_prevMouseCoords = { -1, -1 };
 bool g_isMouseDragging = false;
 
-// Screen Buffer
-unsigned int screenbuffer;
-unsigned int screenColorTexture;
-unsigned int screenDepthTexture;
+// GPU time of every render pass
+labhelper::GpuProfiler gpuProfiler;
+// Write the CPU/GPU trace when the program exits (--trace), F9 writes it at any time
+bool exportTraceAtExit = false;
+
+// Frame sequence capture (F10 or the GUI), without the GUI overlay
+int captureFormat = labhelper::FrameCapture::PNG;
+
+// Frame pacing, set with --vsync off|on|adaptive and --frames-in-flight N
+int swapMode = labhelper::FramePacer::VSYNC_ON;
+int framesInFlight = 2;
+
+// Render targets, reused between frames and only reallocated when the window size changes
+RenderTargetPool renderTargets;
+// Passes of the frame, declared anew by every display()
+RenderGraph renderGraph(renderTargets);
+
+// Order of the opaque passes. SKY_FIRST shades the sky behind every pixel and
+// copies the screen buffer to the output before the clouds; SKY_LAST draws the
+// geometry first, the sky only where no geometry is (at the far plane), and lets
+// the cloud pass write the composite directly.
+enum FramePipeline {
+	SKY_FIRST = 0,
+	SKY_LAST
+};
+int framePipeline = SKY_LAST;
+bool depthPrepass = false;		// Lay down scene depth first, so the scene is shaded once per pixel
+bool packedVertices = false;	// Load models with the 16 byte quantized vertex format
+bool multiDraw = true;			// Submit the scene with glMultiDrawElementsIndirect, where supported
 
 ///////////////////////////////////////////////////////////////////////////////
 // Shader programs
 ///////////////////////////////////////////////////////////////////////////////
-GLuint shaderProgram;       // Shader for rendering geometry
+labhelper::ShaderProgram shaderProgram;	// Shader for rendering geometry
 GLuint backgroundProgram;	// Shader for rendering environment map as background
+GLuint skyProgram;			// Background permutation drawn at the far plane, for SKY_LAST
+labhelper::ShaderProgram depthProgram;	// Position-only shader for the depth prepass
+labhelper::ShaderProgram batchedShaderProgram;	// Permutations of the two above for sceneBatcher
+labhelper::ShaderProgram batchedDepthProgram;
 GLuint cloudProgram;		// Shader for rendering clouds
+GLuint cloudInstrumentedProgram;	// Cloud shader permutation that records step counts
 GLuint screenProgram;		// Shader for rendering screen buffer to screen
 
+// Per-object uniforms of the geometry shader, resolved once per (re)link
+labhelper::Uniform<mat4> modelViewProjectionUniform = shaderProgram.uniform<mat4>("modelViewProjectionMatrix");
+labhelper::Uniform<mat4> modelViewUniform = shaderProgram.uniform<mat4>("modelViewMatrix");
+labhelper::Uniform<mat4> normalMatrixUniform = shaderProgram.uniform<mat4>("normalMatrix");
+labhelper::Uniform<mat4> depthModelViewProjectionUniform = depthProgram.uniform<mat4>("modelViewProjectionMatrix");
+
 ///////////////////////////////////////////////////////////////////////////////
 // Environment
 ///////////////////////////////////////////////////////////////////////////////
@@ -70,7 +152,7 @@ const std::string envmap_base_name = "001";
 
 // TODO: change to directional light source
 
-vec3 lightDirection;
+vec3 lightDirection = normalize(vec3(1.0f, 0.15f, 1.0f));
 vec3 lightColor = vec3(0.984f, 0.871f, 0.698f);
 
 float light_intensity_multiplier = 1.0f;
@@ -97,6 +179,9 @@ vec3 worldUp(0.0f, 1.0f, 0.0f);
 labhelper::Model* fighterModel = nullptr;
 labhelper::Model* landingpadModel = nullptr;
 
+// Both models in shared buffers, drawn with a few multi-draws when multiDraw is on
+labhelper::SceneBatcher sceneBatcher;
+
 mat4 roomModelMatrix;
 mat4 landingPadModelMatrix;
 mat4 fighterModelMatrix;
@@ -106,6 +191,11 @@ vec3 cloudContainerMax;
 
 float shipSpeed = 50;
 
+// Time each frame may spend uploading assets that finished loading in the background
+float assetUploadBudget = 2.0f;
+// From launch to the end of the first frame, shown with the asset timings
+float firstFrameMs = 0.0f;
+
 ///////////////////////////////////////////////////////////////////////
 // Cloud Rendering
 ///////////////////////////////////////////////////////////////////////
@@ -128,19 +218,53 @@ float cloudScale = 0.22f;				// Scaling factor from world to noise-texture space
 float cloudSpeed = 10.0f;				// Cloud movement speed
 float forwardScattering = 0.684f;		// Forward-scattering input to the Henyey-Greenstein function
 float blueNoiseOffsetFactor = 0.7f;		// Defines how much samples should be offset randomly along view ray to trade banding artifacts for noise
+float weatherScale = 2.5f;				// Scaling factor from world to weather-map space
+
+CloudProfile* cloudProfile = nullptr;	// Baked vertical profiles and weather map
+int editedProfile = CloudProfile::CUMULUS;
+
+///////////////////////////////////////////////////////////////////////
+// Uniform blocks shared by the cloud, background and scene shaders.
+// Filled every frame, but only uploaded when their contents change.
+///////////////////////////////////////////////////////////////////////
+labhelper::UniformBuffer<CameraUniforms> cameraUniforms;
+labhelper::UniformBuffer<SkyUniforms> skyUniforms;
+labhelper::UniformBuffer<CloudUniforms> cloudUniforms;
+labhelper::StreamBuffer uniformStream;	// Per-frame copies of the blocks above
+
+///////////////////////////////////////////////////////////////////////
+// Cloud Instrumentation
+///////////////////////////////////////////////////////////////////////
+CloudInstrumentation* cloudStats = nullptr;
+bool instrumentClouds = false;			// Render clouds with the instrumented shader permutation
+bool showCostHeatmap = false;			// Overlay the per-pixel cost of the cloud pass
+int heatmapMetric = CloudInstrumentation::VIEW_STEPS;
+float heatmapMaxValue = 128.0f;			// Count that maps to the hot end of the heatmap
+float heatmapOpacity = 0.8f;
 
 void loadShaders(bool is_reload)
 {
+	TRACE_FUNCTION();
 	GLuint shader = labhelper::loadShaderProgram("../project/fullscreenQuad.vert", "../project/background.frag", is_reload);
 	if(shader != 0)
 	{
 		backgroundProgram = shader;
 	}
 
-	shader = labhelper::loadShaderProgram("../project/shading.vert", "../project/shading.frag", is_reload);
+	shader = labhelper::loadShaderProgram("../project/fullscreenQuad.vert", "../project/background.frag", is_reload,
+	                                      "#define FAR_PLANE");
 	if(shader != 0)
 	{
-		shaderProgram = shader;
+		skyProgram = shader;
+	}
+
+	const std::string vertexDefines = packedVertices ? "#define PACKED_VERTICES" : "";
+	shaderProgram.load("../project/shading.vert", "../project/shading.frag", is_reload, vertexDefines);
+	depthProgram.load("../project/simple.vert", "../project/simple.frag", is_reload, vertexDefines);
+	if (labhelper::SceneBatcher::supported()) {
+		const std::string batchedDefines = vertexDefines + "\n#define MULTI_DRAW";
+		batchedShaderProgram.load("../project/shading.vert", "../project/shading.frag", is_reload, batchedDefines);
+		batchedDepthProgram.load("../project/simple.vert", "../project/simple.frag", is_reload, batchedDefines);
 	}
 
 	shader = labhelper::loadShaderProgram("../project/fullscreenQuad.vert", "../project/cloud.frag", is_reload);
@@ -149,6 +273,16 @@ void loadShaders(bool is_reload)
 		cloudProgram = shader;
 	}
 
+	if (cloudStats != nullptr && cloudStats->isSupported())
+	{
+		shader = labhelper::loadShaderProgram("../project/fullscreenQuad.vert", "../project/cloud.frag", is_reload,
+		                                      "#define CLOUD_INSTRUMENTATION");
+		if (shader != 0)
+		{
+			cloudInstrumentedProgram = shader;
+		}
+	}
+
 	shader = labhelper::loadShaderProgram("../project/fullScreenQuad.vert", "../project/screen.frag", is_reload);
 	if (shader != 0)
 	{
@@ -163,50 +297,24 @@ void loadShaders(bool is_reload)
 ///////////////////////////////////////////////////////////////////////////////
 void initialize()
 {
+	TRACE_FUNCTION();
 	ENSURE_INITIALIZE_ONLY_ONCE();
 
+	// Needed before loading shaders, decides whether the instrumented permutation is built
+	cloudStats = new CloudInstrumentation();
+
 	///////////////////////////////////////////////////////////////////////
 	//		Load Shaders
 	///////////////////////////////////////////////////////////////////////
 	loadShaders(false);
 
-	///////////////////////////////////////////////////////////////////////
-	//		Screen Buffer
-	///////////////////////////////////////////////////////////////////////
-	int w, h;
-	SDL_GetWindowSize(g_window, &w, &h);
-	if (w != windowWidth || h != windowHeight)
-	{
-		windowWidth = w;
-		windowHeight = h;
-	}
-	
-	
-	glGenTextures(1, &screenColorTexture);
-	glBindTexture(GL_TEXTURE_2D, screenColorTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, windowWidth, windowHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glGenTextures(1, &screenDepthTexture);
-	glBindTexture(GL_TEXTURE_2D, screenDepthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, windowWidth, windowHeight, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	glGenFramebuffers(1, &screenbuffer);
-	glBindFramebuffer(GL_FRAMEBUFFER, screenbuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screenColorTexture, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, screenDepthTexture, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
 	///////////////////////////////////////////////////////////////////////
 	// Load models and set up model matrices
 	///////////////////////////////////////////////////////////////////////
-	fighterModel = labhelper::loadModelFromOBJ("../scenes/space-ship.obj");
-	landingpadModel = labhelper::loadModelFromOBJ("../scenes/city.obj");
+	// Loaded in the background, the models are not drawn until they are there
+	labhelper::AssetLoader& loader = labhelper::getAssetLoader();
+	loader.loadModel(&fighterModel, "../scenes/space-ship.obj", packedVertices);
+	loader.loadModel(&landingpadModel, "../scenes/city.obj", packedVertices);
 
 	roomModelMatrix = mat4(1.0f);
 	fighterModelMatrix = translate(15.0f * worldUp);
@@ -224,14 +332,14 @@ void initialize()
 	for(int i = 0; i < roughnesses; i++)
 		filenames.push_back("../scenes/envmaps/" + envmap_base_name + "_dl_" + std::to_string(i) + ".hdr");
 
-	environmentMap = labhelper::loadHdrTexture("../scenes/envmaps/" + envmap_base_name + ".hdr");
-	irradianceMap = labhelper::loadHdrTexture("../scenes/envmaps/" + envmap_base_name + "_irradiance.hdr");
-	reflectionMap = labhelper::loadHdrMipmapTexture(filenames);
+	loader.loadHdrTexture(&environmentMap, "../scenes/envmaps/" + envmap_base_name + ".hdr");
+	loader.loadHdrTexture(&irradianceMap, "../scenes/envmaps/" + envmap_base_name + "_irradiance.hdr");
+	loader.loadHdrMipmapTexture(&reflectionMap, filenames);
 
 
 
-	glEnable(GL_DEPTH_TEST); // enable Z-buffering
-	glEnable(GL_CULL_FACE);  // enables backface culling
+	labhelper::getGLState().setDepthTest(true); // enable Z-buffering
+	labhelper::getGLState().setCullFace(true);  // enables backface culling
 	
 	///////////////////////////////////////////////////////////////////////
 	// Cloud Rendering
@@ -239,27 +347,89 @@ void initialize()
 	noiseGen = new NoiseGenerator();
 	noiseGen->renderNoise();
 
-	blueNoiseTexture = labhelper::loadHdrTexture("../scenes/blueNoise.png");
+	loader.loadHdrTexture(&blueNoiseTexture, "../scenes/blueNoise.png");
+
+	cloudProfile = new CloudProfile();
+
+	///////////////////////////////////////////////////////////////////////
+	// Uniform blocks
+	///////////////////////////////////////////////////////////////////////
+	uniformStream.init(64 * 1024);
+	cameraUniforms.init(CAMERA_BLOCK_BINDING, &uniformStream);
+	skyUniforms.init(SKY_BLOCK_BINDING, &uniformStream);
+	cloudUniforms.init(CLOUD_BLOCK_BINDING, &uniformStream);
 
+}
 
+///////////////////////////////////////////////////////////////////////////////
+/// Copies the current camera, sky and cloud state into the uniform block
+/// mirrors, which are written to this frame's part of the uniform stream
+/// buffer and bound, every block every frame.
+///////////////////////////////////////////////////////////////////////////////
+void updateUniformBlocks(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	TRACE_FUNCTION();
+	CameraUniforms& camera = cameraUniforms.data;
+	camera.view = viewMatrix;
+	camera.view_inverse = inverse(viewMatrix);
+	camera.proj_inverse = inverse(projectionMatrix);
+	camera.pv = projectionMatrix * viewMatrix;
+	camera.pv_inverse = inverse(camera.pv);
+	camera.camera_pos = cameraPosition;
+	camera.time = currentTime;
+	cameraUniforms.upload();
+
+	SkyUniforms& sky = skyUniforms.data;
+	sky.light_direction = lightDirection;
+	sky.environment_multiplier = environment_multiplier;
+	sky.light_color = lightColor;
+	sky.light_intensity_multiplier = light_intensity_multiplier;
+	sky.color_sky = skyColor;
+	sky.color_horizon = horizonColor;
+	skyUniforms.upload();
+
+	CloudUniforms& cloud = cloudUniforms.data;
+	cloud.container_min = cloudContainerMin;
+	cloud.container_max = cloudContainerMax;
+	cloud.density_threshold = densityThreshold;
+	cloud.density_multiplier = densityMultiplier;
+	cloud.light_absorption = lightAbsorption;
+	cloud.light_absorption_sun = lightAbsorptionSun;
+	cloud.darkness_threshold = darknessThreshold;
+	cloud.step_size_sun = stepSizeSun;
+	cloud.step_size = stepSize;
+	cloud.step_size_incr = stepSizeIncr;
+	cloud.step_size_incr_sun = stepSizeIncrSun;
+	cloud.cloud_scale = cloudScale;
+	cloud.cloud_speed = cloudSpeed;
+	cloud.forward_scattering = forwardScattering;
+	cloud.blue_noise_offset_factor = blueNoiseOffsetFactor;
+	cloud.weather_scale = weatherScale;
+	cloudUniforms.upload();
 }
 
-void drawBackground(const mat4& viewMatrix, const mat4& projectionMatrix)
+void drawBackground()
 {
-	glUseProgram(backgroundProgram);
-	labhelper::setUniformSlow(backgroundProgram, "environment_multiplier", environment_multiplier);
-	labhelper::setUniformSlow(backgroundProgram, "inv_PV", inverse(projectionMatrix * viewMatrix));
-	labhelper::setUniformSlow(backgroundProgram, "camera_pos", cameraPosition);
-
-	labhelper::setUniformSlow(backgroundProgram, "light_direction", lightDirection);
-	labhelper::setUniformSlow(backgroundProgram, "color_sun", lightColor);
-	labhelper::setUniformSlow(backgroundProgram, "color_sky", skyColor);
-	labhelper::setUniformSlow(backgroundProgram, "color_horizon", horizonColor);
+	labhelper::getGLState().useProgram(backgroundProgram);
 	labhelper::drawFullScreenQuad();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Draws the sky behind the geometry already in the depth buffer
+///////////////////////////////////////////////////////////////////////////////
+void drawSky()
+{
+	labhelper::GLStateCache& gl = labhelper::getGLState();
+	gl.useProgram(skyProgram);
+	gl.setDepthFunc(GL_LEQUAL);
+	gl.setDepthWrite(false);
+	labhelper::drawFullScreenQuad(true);
+	gl.setDepthWrite(true);
+	gl.setDepthFunc(GL_LESS);
+}
+
 void drawScreenBuffer() {
-	glUseProgram(screenProgram);
+	labhelper::getGLState().useProgram(screenProgram);
 	labhelper::drawFullScreenQuad();
 }
 
@@ -267,80 +437,78 @@ void drawScreenBuffer() {
 ///////////////////////////////////////////////////////////////////////////////
 /// This function is used to draw the main objects on the scene
 ///////////////////////////////////////////////////////////////////////////////
-void drawScene(GLuint currentShaderProgram,
-               const mat4& viewMatrix,
-               const mat4& projectionMatrix)
+bool useMultiDraw()
 {
-	glUseProgram(currentShaderProgram);
-	// Light source
-	vec4 viewSpaceLightDirection = viewMatrix * vec4(lightDirection, 0.0f);
-	labhelper::setUniformSlow(currentShaderProgram, "point_light_color", lightColor);
-	labhelper::setUniformSlow(currentShaderProgram, "point_light_intensity_multiplier",
-	                          light_intensity_multiplier);
-	labhelper::setUniformSlow(currentShaderProgram, "viewSpaceLightDirection", vec3(viewSpaceLightDirection));
-	//labhelper::setUniformSlow(currentShaderProgram, "viewSpaceLightDir",
-	                          //normalize(vec3(viewMatrix * vec4(-lightDirection, 0.0f))));
-
-
-	// Environment
-	labhelper::setUniformSlow(currentShaderProgram, "environment_multiplier", environment_multiplier);
+	return multiDraw && labhelper::SceneBatcher::supported();
+}
 
-	// camera
-	labhelper::setUniformSlow(currentShaderProgram, "viewInverse", inverse(viewMatrix));
+void drawScene(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	if (useMultiDraw()) {
+		// Transforms are per draw, the camera comes from the camera block
+		labhelper::getGLState().useProgram(batchedShaderProgram.id);
+		sceneBatcher.draw(true);
+		return;
+	}
+	labhelper::getGLState().useProgram(shaderProgram.id);
+	// Light source, environment and camera come from the shared uniform blocks
 
 	// landing pad
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * landingPadModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewMatrix", viewMatrix * landingPadModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
-	                          inverse(transpose(viewMatrix * landingPadModelMatrix)));
+	modelViewProjectionUniform.set(projectionMatrix * viewMatrix * landingPadModelMatrix);
+	modelViewUniform.set(viewMatrix * landingPadModelMatrix);
+	normalMatrixUniform.set(inverse(transpose(viewMatrix * landingPadModelMatrix)));
 
-	labhelper::render(landingpadModel);
+	if (landingpadModel != nullptr) {
+		labhelper::render(landingpadModel);
+	}
 
 	// Fighter
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewProjectionMatrix",
-	                          projectionMatrix * viewMatrix * fighterModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "modelViewMatrix", viewMatrix * fighterModelMatrix);
-	labhelper::setUniformSlow(currentShaderProgram, "normalMatrix",
-	                          inverse(transpose(viewMatrix * fighterModelMatrix)));
+	modelViewProjectionUniform.set(projectionMatrix * viewMatrix * fighterModelMatrix);
+	modelViewUniform.set(viewMatrix * fighterModelMatrix);
+	normalMatrixUniform.set(inverse(transpose(viewMatrix * fighterModelMatrix)));
 
-	labhelper::render(fighterModel);
+	if (fighterModel != nullptr) {
+		labhelper::render(fighterModel);
+	}
 }
 
-void drawCloudContainer(const mat4& viewMatrix, const mat4& projectionMatrix) {
+///////////////////////////////////////////////////////////////////////////////
+/// Depth prepass: the scene's depth only, no colour writes and no materials
+///////////////////////////////////////////////////////////////////////////////
+void drawSceneDepth(const mat4& viewMatrix, const mat4& projectionMatrix)
+{
+	labhelper::GLStateCache& gl = labhelper::getGLState();
+	gl.setColorWrite(false);
+	if (useMultiDraw()) {
+		gl.useProgram(batchedDepthProgram.id);
+		sceneBatcher.draw(false);
+		gl.setColorWrite(true);
+		return;
+	}
+	gl.useProgram(depthProgram.id);
 
-	GLuint shaderProgram;
+	depthModelViewProjectionUniform.set(projectionMatrix * viewMatrix * landingPadModelMatrix);
+	if (landingpadModel != nullptr) {
+		labhelper::render(landingpadModel, false);
+	}
 
+	depthModelViewProjectionUniform.set(projectionMatrix * viewMatrix * fighterModelMatrix);
+	if (fighterModel != nullptr) {
+		labhelper::render(fighterModel, false);
+	}
+
+	gl.setColorWrite(true);
+}
 
-	shaderProgram = cloudProgram;
-	glUseProgram(shaderProgram);
+void drawCloudContainer() {
 
-	// Fragment shader uniforms
-	labhelper::setUniformSlow(shaderProgram, "pv", projectionMatrix * viewMatrix);
-	labhelper::setUniformSlow(shaderProgram, "proj_inverse", inverse(projectionMatrix));
-	labhelper::setUniformSlow(shaderProgram, "view_inverse", inverse(viewMatrix));
-	labhelper::setUniformSlow(shaderProgram, "view", viewMatrix);
-	
-	labhelper::setUniformSlow(shaderProgram, "container_min", cloudContainerMin);
-	labhelper::setUniformSlow(shaderProgram, "container_max", cloudContainerMax);
-
-	labhelper::setUniformSlow(shaderProgram, "light_direction", lightDirection);
-	labhelper::setUniformSlow(shaderProgram, "light_color", lightColor);
-	labhelper::setUniformSlow(shaderProgram, "density_threshold", densityThreshold);
-	labhelper::setUniformSlow(shaderProgram, "density_multiplier", densityMultiplier);
-	labhelper::setUniformSlow(shaderProgram, "light_absorption", lightAbsorption);
-	labhelper::setUniformSlow(shaderProgram, "light_absorption_sun", lightAbsorptionSun);
-	labhelper::setUniformSlow(shaderProgram, "darkness_threshold", darknessThreshold);
-	labhelper::setUniformSlow(shaderProgram, "cloud_scale", cloudScale);
-	labhelper::setUniformSlow(shaderProgram, "cloud_speed", cloudSpeed);
-	labhelper::setUniformSlow(shaderProgram, "step_size_sun", stepSizeSun);
-	labhelper::setUniformSlow(shaderProgram, "step_size", stepSize);
-	labhelper::setUniformSlow(shaderProgram, "step_size_incr", stepSizeIncr);
-	labhelper::setUniformSlow(shaderProgram, "step_size_incr_sun", stepSizeIncrSun);
-	labhelper::setUniformSlow(shaderProgram, "time", currentTime);
-	labhelper::setUniformSlow(shaderProgram, "forward_scattering", forwardScattering);
-	labhelper::setUniformSlow(shaderProgram, "blue_noise_offset_factor", blueNoiseOffsetFactor);
+	GLuint shaderProgram;
+
+
+	shaderProgram = instrumentClouds ? cloudInstrumentedProgram : cloudProgram;
+	labhelper::getGLState().useProgram(shaderProgram);
 
+	// All parameters come from the camera, sky and cloud uniform blocks
 	labhelper::drawFullScreenQuad();
 	
 }
@@ -352,12 +520,13 @@ void drawCloudContainer(const mat4& viewMatrix, const mat4& projectionMatrix) {
 ///////////////////////////////////////////////////////////////////////////////
 void display(void)
 {
+	TRACE_FUNCTION();
 	///////////////////////////////////////////////////////////////////////////
 	// Check if window size has changed and resize buffers as needed
 	///////////////////////////////////////////////////////////////////////////
 	{
 		int w, h;
-		SDL_GetWindowSize(g_window, &w, &h);
+		labhelper::getWindowSize(&w, &h);
 		if(w != windowWidth || h != windowHeight)
 		{
 			windowWidth = w;
@@ -365,84 +534,139 @@ void display(void)
 		}
 	}
 	
-	glBindTexture(GL_TEXTURE_2D, screenColorTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, windowWidth, windowHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-	glBindTexture(GL_TEXTURE_2D, screenDepthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, windowWidth, windowHeight, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, nullptr);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-
-
 	///////////////////////////////////////////////////////////////////////////
 	// setup matrices
 	///////////////////////////////////////////////////////////////////////////
 	mat4 projMatrix = perspective(radians(45.0f), float(windowWidth) / float(windowHeight), 5.0f, 4096.0f);
 	mat4 viewMatrix = lookAt(cameraPosition, cameraPosition + cameraDirection, worldUp);
 
-	lightDirection = normalize(vec3(1.0f, 0.15f, 1.0f));
+	updateUniformBlocks(viewMatrix, projMatrix);
 
-	///////////////////////////////////////////////////////////////////////////
-	// Bind the environment map(s) to unused texture units
-	///////////////////////////////////////////////////////////////////////////
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, environmentMap);
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, irradianceMap);
-	glActiveTexture(GL_TEXTURE8);
-	glBindTexture(GL_TEXTURE_2D, reflectionMap);
-	glActiveTexture(GL_TEXTURE0);
+	if (useMultiDraw()) {
+		sceneBatcher.update({ { landingpadModel, landingPadModelMatrix }, { fighterModel, fighterModelMatrix } });
+	}
 
+	if (instrumentClouds) {
+		cloudStats->resize(windowWidth, windowHeight);
+	}
 
 	///////////////////////////////////////////////////////////////////////////
-	// Draw scene to screen buffer
+	// Declare the frame. Texture units are the ones the shaders expect.
 	///////////////////////////////////////////////////////////////////////////
-	glBindFramebuffer(GL_FRAMEBUFFER, screenbuffer);
-
-	glViewport(0, 0, windowWidth, windowHeight);
-	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	drawBackground(viewMatrix, projMatrix);
-	drawScene(shaderProgram, viewMatrix, projMatrix);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	typedef RenderGraph::Resource Resource;
+	renderGraph.reset();
+
+	RenderGraph::TargetDesc screenDesc = { windowWidth, windowHeight, GL_RGBA8, GL_DEPTH_COMPONENT32 };
+	Resource screen = renderGraph.createTarget("Screen Buffer", screenDesc);
+	Resource output = renderGraph.importFramebuffer("Output", outputFramebuffer, windowWidth, windowHeight);
+
+	Resource environment = renderGraph.importTexture("Environment", GL_TEXTURE_2D, environmentMap);
+	Resource irradiance = renderGraph.importTexture("Irradiance", GL_TEXTURE_2D, irradianceMap);
+	Resource reflection = renderGraph.importTexture("Reflection", GL_TEXTURE_2D, reflectionMap);
+	Resource noise = renderGraph.importTexture("Noise", GL_TEXTURE_3D, noiseGen->noiseTexture);
+	Resource blueNoise = renderGraph.importTexture("Blue Noise", GL_TEXTURE_2D, blueNoiseTexture);
+	Resource profiles = renderGraph.importTexture("Cloud Profiles", GL_TEXTURE_2D, cloudProfile->profileTexture);
+	Resource weather = renderGraph.importTexture("Weather Map", GL_TEXTURE_2D, cloudProfile->weatherTexture);
+	Resource stats = renderGraph.importTexture("Cloud Stats", GL_TEXTURE_2D, cloudStats->statTexture());
+
+	const bool skyLast = framePipeline == SKY_LAST;
+	const bool prepass = skyLast && depthPrepass;
+
+	renderGraph.addPass("Background", [&]() { drawBackground(); }, !skyLast)
+	    .write(screen)
+	    .clear(vec4(0.2f, 0.2f, 0.8f, 1.0f))
+	    .read(environment, 6);
+
+	renderGraph.addPass("Depth Prepass", [&]() { drawSceneDepth(viewMatrix, projMatrix); }, prepass)
+	    .write(screen)
+	    .clear(vec4(0.2f, 0.2f, 0.8f, 1.0f));
+
+	RenderGraph::PassBuilder scene = renderGraph.addPass("Scene", [&]() {
+		labhelper::GLStateCache& gl = labhelper::getGLState();
+		if (prepass) {
+			// Only the front-most fragment of every pixel passes
+			gl.setDepthFunc(GL_LEQUAL);
+			gl.setDepthWrite(false);
+		}
+		drawScene(viewMatrix, projMatrix);
+		gl.setDepthFunc(GL_LESS);
+		gl.setDepthWrite(true);
+	});
+	scene.write(screen)
+	    .read(environment, 6)
+	    .read(irradiance, 7)
+	    .read(reflection, 8);
+	if (skyLast && !prepass) {
+		scene.clear(vec4(0.2f, 0.2f, 0.8f, 1.0f));
+	}
 
+	renderGraph.addPass("Sky", [&]() { drawSky(); }, skyLast)
+	    .write(screen)
+	    .read(environment, 6);
+
+	// With SKY_LAST the cloud pass, which writes every pixel, does the composite alone
+	renderGraph.addPass("Screen Buffer", [&]() { drawScreenBuffer(); }, !skyLast)
+	    .write(output)
+	    .clear(vec4(0.2f, 0.2f, 0.8f, 1.0f))
+	    .read(screen, 10);
+
+	RenderGraph::PassBuilder clouds = renderGraph.addPass("Clouds", [&]() {
+		if (instrumentClouds) cloudStats->bind();
+		drawCloudContainer();
+		if (instrumentClouds) cloudStats->endFrame();
+	});
+	clouds.write(output)
+	    .read(noise, 9)
+	    .read(screen, 10)
+	    .read(screen, 11, RenderGraph::DEPTH)
+	    .read(blueNoise, 13)
+	    .read(profiles, 14)
+	    .read(weather, 15);
+	if (instrumentClouds) {
+		clouds.writeStorage(stats);
+	}
 
-	///////////////////////////////////////////////////////////////////////////
-	// Draw screen buffer and render cloud container
-	///////////////////////////////////////////////////////////////////////////
-	glActiveTexture(GL_TEXTURE9);
-	glBindTexture(GL_TEXTURE_3D, noiseGen->noiseTexture);
-	glActiveTexture(GL_TEXTURE10);
-	glBindTexture(GL_TEXTURE_2D, screenColorTexture);
-	glActiveTexture(GL_TEXTURE11);
-	glBindTexture(GL_TEXTURE_2D, screenDepthTexture);
-	glActiveTexture(GL_TEXTURE13);
-	glBindTexture(GL_TEXTURE_2D, blueNoiseTexture);
-	glActiveTexture(GL_TEXTURE0);
-
-	glViewport(0, 0, windowWidth, windowHeight);
-	glClearColor(0.2f, 0.2f, 0.8f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	drawScreenBuffer();
-	
-	drawCloudContainer(viewMatrix, projMatrix);
+	renderGraph.addPass("Cost Heatmap", [&]() {
+		cloudStats->drawHeatmap(heatmapMetric, heatmapMaxValue, heatmapOpacity);
+	}, instrumentClouds && showCostHeatmap)
+	    .write(output)
+	    .read(stats, 12);
 
-	if (displayPreview) {
+	renderGraph.addPass("Noise Preview", [&]() {
 		noiseGen->debugDraw(previewLayer, (float)windowWidth / (float)windowHeight, previewChannel);
-	}
+	}, displayPreview)
+	    .write(output)
+	    .read(noise, 9);
 
+	renderGraph.execute(&gpuProfiler);
+	renderTargets.endFrame();
 
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+/// Starts or stops writing every frame to <timestamp>_NNNNN.<format>
+///////////////////////////////////////////////////////////////////////////////
+void toggleSequenceCapture()
+{
+	labhelper::FrameCapture& capture = labhelper::getFrameCapture();
+	if(capture.isRecording())
+	{
+		capture.stopSequence();
+		return;
+	}
+	auto tt = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+	std::ostringstream prefix;
+	prefix << std::put_time(std::localtime(&tt), "%Y-%m-%d_%H-%M-%S");
+	capture.startSequence(prefix.str(), labhelper::FrameCapture::Format(captureFormat));
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// This function is used to update the scene according to user input
 ///////////////////////////////////////////////////////////////////////////////
 bool handleEvents(void)
 {
+	TRACE_FUNCTION();
 	// Allow ImGui to capture events.
 	ImGuiIO& io = ImGui::GetIO();
 
@@ -465,6 +689,14 @@ bool handleEvents(void)
 		{
 			labhelper::saveScreenshot();
 		}
+		else if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_F9)
+		{
+			labhelper::traceExport();
+		}
+		else if(event.type == SDL_KEYUP && event.key.keysym.sym == SDLK_F10)
+		{
+			toggleSequenceCapture();
+		}
 		if(event.type == SDL_MOUSEBUTTONDOWN && event.button.button == SDL_BUTTON_LEFT
 		   && (!showUI || !io.WantCaptureMouse))
 		{
@@ -546,6 +778,7 @@ bool handleEvents(void)
 ///////////////////////////////////////////////////////////////////////////////
 void gui()
 {
+	TRACE_FUNCTION();
 	// ----------------- Set variables --------------------------
 	ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate,
 	            ImGui::GetIO().Framerate);
@@ -568,6 +801,105 @@ void gui()
 	ImGui::SliderFloat("Forward-Scattering", &forwardScattering, 0.0, 1.0);
 	ImGui::SliderFloat("Offset Factor", &blueNoiseOffsetFactor, 0.0, 16.0);
 
+	// Shape
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Cloud Shape:");
+
+	ImGui::SliderFloat("Weather Scale", &weatherScale, 0.1, 20.0);
+	bool weatherChanged = false;
+	weatherChanged |= ImGui::SliderFloat("Coverage", &cloudProfile->coverage, 0.0, 1.0);
+	weatherChanged |= ImGui::SliderFloat("Patchiness", &cloudProfile->patchiness, 0.0, 1.0);
+	weatherChanged |= ImGui::SliderFloat("Cloud Type", &cloudProfile->cloudType, 0.0, 1.0);
+	weatherChanged |= ImGui::SliderFloat("Type Variation", &cloudProfile->typeVariation, 0.0, 1.0);
+	if (weatherChanged) {
+		cloudProfile->bakeWeatherMap();
+	}
+
+	ImGui::Combo("Edit Profile", &editedProfile, "Stratus\0Cumulus\0Cumulonimbus\0\0");
+	CloudLayerProfile& profile = cloudProfile->profiles[editedProfile];
+	bool profileChanged = false;
+	profileChanged |= ImGui::SliderFloat("Profile Base", &profile.base, 0.0, 1.0);
+	profileChanged |= ImGui::SliderFloat("Profile Bottom Ramp", &profile.bottomRamp, 0.001, 0.5);
+	profileChanged |= ImGui::SliderFloat("Profile Top Start", &profile.topStart, 0.0, 1.0);
+	profileChanged |= ImGui::SliderFloat("Profile Top End", &profile.topEnd, 0.0, 1.0);
+	if (profileChanged) {
+		profile.topStart = std::min(profile.topStart, profile.topEnd - 0.001f);
+		cloudProfile->bakeProfiles();
+	}
+
+	// Instrumentation
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Cloud Instrumentation:");
+
+	if (!cloudStats->isSupported()) {
+		ImGui::Text("Not supported (needs GL_ARB_shader_atomic_counter_ops)");
+	}
+	else {
+		ImGui::Checkbox("Instrument Cloud Pass", &instrumentClouds);
+		if (instrumentClouds) {
+			const uint32_t* t = cloudStats->totals;
+			float pixels = float(std::max<uint32_t>(t[CloudInstrumentation::MARCHED_PIXELS], 1));
+			ImGui::Text("Marched pixels: %u", t[CloudInstrumentation::MARCHED_PIXELS]);
+			ImGui::Text("View steps: %u (%.1f / px)", t[CloudInstrumentation::VIEW_STEPS],
+			            t[CloudInstrumentation::VIEW_STEPS] / pixels);
+			ImGui::Text("Light steps: %u (%.1f / px)", t[CloudInstrumentation::LIGHT_STEPS],
+			            t[CloudInstrumentation::LIGHT_STEPS] / pixels);
+			ImGui::Text("Density fetches: %u (%.1f / px)", t[CloudInstrumentation::DENSITY_FETCHES],
+			            t[CloudInstrumentation::DENSITY_FETCHES] / pixels);
+			ImGui::Text("Early terminations: %u (%.1f%%)", t[CloudInstrumentation::EARLY_TERMINATIONS],
+			            100.0f * t[CloudInstrumentation::EARLY_TERMINATIONS] / pixels);
+
+			ImGui::Checkbox("Cost Heatmap", &showCostHeatmap);
+			ImGui::Combo("Heatmap Metric", &heatmapMetric, "View Steps\0Light Steps\0Density Fetches\0Early Terminations\0\0");
+			ImGui::SliderFloat("Heatmap Max", &heatmapMaxValue, 1.0, 4096.0, "%.0f", 3.0f);
+			ImGui::SliderFloat("Heatmap Opacity", &heatmapOpacity, 0.0, 1.0);
+			if (ImGui::Button("Dump Statistics")) {
+				cloudStats->dump(cameraPosition, cameraDirection);
+			}
+		}
+	}
+
+	// Capture
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Capture:");
+
+	labhelper::FrameCapture& capture = labhelper::getFrameCapture();
+	ImGui::Combo("Capture Format", &captureFormat, "PNG\0EXR\0Raw (PPM)\0\0");
+	if (ImGui::Button(capture.isRecording() ? "Stop Recording (F10)" : "Record Frames (F10)")) {
+		toggleSequenceCapture();
+	}
+	ImGui::Text("Frames: %d, pending: %d, stalls: %llu", capture.sequenceFrames(), int(capture.pendingEncodes()),
+	            (unsigned long long)capture.stalls());
+
+	// Asset loading
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Assets:");
+
+	ImGui::SliderFloat("Upload Budget (ms)", &assetUploadBudget, 0.0, 16.0);
+	ImGui::Text("First frame after %.1f ms", firstFrameMs);
+	labhelper::getAssetLoader().drawGui();
+
+	// Frame pacing
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Frame Pacing:");
+
+	labhelper::getFramePacer().drawGui();
+
+	// Profiling
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "GPU Timings:");
+
+	gpuProfiler.drawGui();
+	labhelper::getGLState().drawGui();
+
+	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Render Graph:");
+
+	ImGui::Combo("Pipeline", &framePipeline, "Sky first\0Sky last\0\0");
+	ImGui::Checkbox("Depth Prepass", &depthPrepass);
+	if (labhelper::SceneBatcher::supported()) {
+		ImGui::Checkbox("Multi-Draw Indirect", &multiDraw);
+		sceneBatcher.drawGui();
+	}
+	bool countFragments = renderGraph.countsFragments();
+	if (ImGui::Checkbox("Show Overdraw", &countFragments)) {
+		renderGraph.setCountFragments(countFragments);
+	}
+	renderGraph.drawGui();
+
 	// Noise
 	ImGui::TextColored(ImVec4(1, 1, 0, 1), "Noise Generation:");
 
@@ -577,49 +909,441 @@ void gui()
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// Parameters that regression presets may override, by name
+///////////////////////////////////////////////////////////////////////////////
+float* findParameter(const std::string& name)
+{
+	static const std::pair<const char*, float*> parameters[] = {
+		{ "densityThreshold", &densityThreshold },
+		{ "densityMultiplier", &densityMultiplier },
+		{ "lightAbsorption", &lightAbsorption },
+		{ "lightAbsorptionSun", &lightAbsorptionSun },
+		{ "darknessThreshold", &darknessThreshold },
+		{ "stepSize", &stepSize },
+		{ "stepSizeSun", &stepSizeSun },
+		{ "stepSizeIncr", &stepSizeIncr },
+		{ "stepSizeIncrSun", &stepSizeIncrSun },
+		{ "cloudScale", &cloudScale },
+		{ "cloudSpeed", &cloudSpeed },
+		{ "forwardScattering", &forwardScattering },
+		{ "blueNoiseOffsetFactor", &blueNoiseOffsetFactor },
+		{ "weatherScale", &weatherScale },
+		{ "environmentMultiplier", &environment_multiplier },
+		{ "coverage", &cloudProfile->coverage },
+		{ "patchiness", &cloudProfile->patchiness },
+		{ "cloudType", &cloudProfile->cloudType },
+		{ "typeVariation", &cloudProfile->typeVariation },
+	};
+	for(const auto& parameter : parameters)
+	{
+		if(name == parameter.first)
+		{
+			return parameter.second;
+		}
+	}
+	return nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Renders every preset and compares it against its golden image (or replaces
+/// the golden image with --update-golden). Returns true if all passed.
+///////////////////////////////////////////////////////////////////////////////
+bool runRegression()
+{
+	std::vector<RegressionPreset> presets;
+	if(!loadRegressionPresets(regressionDir + "/presets.txt", presets))
+	{
+		labhelper::fatal_error("Could not load " + regressionDir + "/presets.txt");
+	}
+
+	// Every preset starts from the defaults
+	std::vector<std::pair<float*, float>> defaults;
+	for(const auto& preset : presets)
+	{
+		for(const auto& parameter : preset.parameters)
+		{
+			float* value = findParameter(parameter.first);
+			if(value != nullptr)
+			{
+				defaults.push_back(std::make_pair(value, *value));
+			}
+		}
+	}
+
+	int failed = 0;
+	for(const auto& preset : presets)
+	{
+		for(auto it = defaults.rbegin(); it != defaults.rend(); ++it)
+		{
+			*it->first = it->second;
+		}
+		for(const auto& parameter : preset.parameters)
+		{
+			float* value = findParameter(parameter.first);
+			if(value == nullptr)
+			{
+				std::cout << "Unknown parameter " << parameter.first << " in preset " << preset.name << std::endl;
+				continue;
+			}
+			*value = parameter.second;
+		}
+		cloudProfile->bakeWeatherMap();
+
+		cameraPosition = preset.camera.position;
+		cameraDirection = preset.camera.direction;
+		lightDirection = preset.camera.lightDirection;
+		previousTime = currentTime = preset.camera.time;
+		deltaTime = 0.0f;
+
+		labhelper::getFramePacer().beginFrame();
+		labhelper::getGLState().beginFrame();
+		display();
+		labhelper::getFramePacer().endFrame();
+
+		int width, height;
+		labhelper::getWindowSize(&width, &height);
+		std::vector<uint8_t> image = labhelper::readFramebuffer(outputFramebuffer, width, height);
+		if(!checkAgainstGolden(preset.name, image, width, height, regressionDir, regressionTolerances,
+		                       updateGoldenImages))
+		{
+			failed++;
+		}
+	}
+	std::cout << presets.size() - failed << " of " << presets.size() << " presets passed" << std::endl;
+	return failed == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// In benchmark mode the camera and sun follow the path instead of the input
+///////////////////////////////////////////////////////////////////////////////
+void applyBenchmarkCamera()
+{
+	if(benchmark == nullptr)
+	{
+		return;
+	}
+	CameraKeyframe keyframe = benchmark->camera();
+	cameraPosition = keyframe.position;
+	cameraDirection = keyframe.direction;
+	lightDirection = keyframe.lightDirection;
+}
+
 int main(int argc, char* argv[])
 {
-	g_window = labhelper::init_window_SDL("OpenGL Project");
+	auto launchTime = std::chrono::steady_clock::now();
+	labhelper::traceSetThreadName("Main");
+	for(int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if(arg == "--trace")
+		{
+			exportTraceAtExit = true;
+		}
+		else if(arg == "--headless")
+		{
+			headless = true;
+		}
+		else if(arg == "--frames" && hasValue)
+		{
+			headlessFrames = std::atoi(argv[++i]);
+		}
+		else if(arg == "--size" && hasValue)
+		{
+			if(sscanf(argv[++i], "%dx%d", &headlessWidth, &headlessHeight) != 2)
+			{
+				labhelper::fatal_error("--size expects WIDTHxHEIGHT, e.g. 1280x720");
+			}
+		}
+		else if(arg == "--save-frames")
+		{
+			saveHeadlessFrames = true;
+		}
+		else if(arg == "--capture-format" && hasValue)
+		{
+			std::string format = argv[++i];
+			captureFormat = format == "exr" ? labhelper::FrameCapture::EXR
+			                                : format == "raw" ? labhelper::FrameCapture::RAW
+			                                                  : labhelper::FrameCapture::PNG;
+		}
+		else if(arg == "--benchmark")
+		{
+			benchmarkMode = true;
+			// Optional camera path file, the scripted orbit otherwise
+			if(hasValue && argv[i + 1][0] != '-')
+			{
+				benchmarkPathFile = argv[++i];
+			}
+		}
+		else if(arg == "--timestep" && hasValue)
+		{
+			benchmarkTimestep = float(std::atof(argv[++i]));
+		}
+		else if(arg == "--warmup" && hasValue)
+		{
+			benchmarkWarmup = std::atoi(argv[++i]);
+		}
+		else if(arg == "--record-path" && hasValue)
+		{
+			recordPathFile = argv[++i];
+		}
+		else if(arg == "--regression" || arg == "--update-golden")
+		{
+			regressionMode = true;
+			updateGoldenImages = updateGoldenImages || arg == "--update-golden";
+			// Optional directory with presets.txt and the golden images
+			if(hasValue && argv[i + 1][0] != '-')
+			{
+				regressionDir = argv[++i];
+			}
+		}
+		else if(arg == "--pixel-threshold" && hasValue)
+		{
+			regressionTolerances.pixelThreshold = std::atoi(argv[++i]);
+		}
+		else if(arg == "--max-different" && hasValue)
+		{
+			regressionTolerances.maxDifferentFraction = float(std::atof(argv[++i]));
+		}
+		else if(arg == "--min-ssim" && hasValue)
+		{
+			regressionTolerances.minSsim = float(std::atof(argv[++i]));
+		}
+		else if(arg == "--pipeline" && hasValue)
+		{
+			std::string pipeline = argv[++i];
+			framePipeline = pipeline == "sky-first" ? SKY_FIRST : SKY_LAST;
+		}
+		else if(arg == "--depth-prepass")
+		{
+			depthPrepass = true;
+		}
+		else if(arg == "--no-multi-draw")
+		{
+			multiDraw = false;
+		}
+		else if(arg == "--packed-vertices")
+		{
+			packedVertices = true;
+		}
+		else if(arg == "--obj-benchmark")
+		{
+			// Compares the OBJ parser with tinyobj on the shipped scenes, no window needed
+			int repetitions = hasValue && argv[i + 1][0] != '-' ? std::atoi(argv[++i]) : 5;
+			labhelper::benchmarkObjParser({ "../scenes/space-ship.obj", "../scenes/city.obj", "../scenes/wheatley.obj",
+			                                "../scenes/sphere.obj", "../scenes/car.obj", "../scenes/landingpad.obj",
+			                                "../scenes/cube.obj", "../scenes/ground_plane.obj",
+			                                "../scenes/peter-panning-plane.obj" },
+			                              std::max(1, repetitions));
+			return 0;
+		}
+		else if(arg == "--vsync" && hasValue)
+		{
+			std::string mode = argv[++i];
+			swapMode = mode == "off" ? labhelper::FramePacer::VSYNC_OFF
+			           : mode == "adaptive" ? labhelper::FramePacer::VSYNC_ADAPTIVE : labhelper::FramePacer::VSYNC_ON;
+		}
+		else if(arg == "--frames-in-flight" && hasValue)
+		{
+			framesInFlight = std::atoi(argv[++i]);
+		}
+		else
+		{
+			std::cout << "Unknown argument: " << arg << std::endl;
+		}
+	}
+
+	if(headless)
+	{
+		if(!labhelper::init_headless_GL(headlessWidth, headlessHeight))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		g_window = labhelper::init_window_SDL("OpenGL Project");
+	}
+
+	labhelper::FramePacer& pacer = labhelper::getFramePacer();
+	pacer.setSwapMode(labhelper::FramePacer::SwapMode(swapMode));
+	pacer.setMaxQueuedFrames(framesInFlight);
 
 	initialize();
+	// Setup (e.g. the noise generator) changes state directly, later frames
+	// and the background loads go through the cache
+	labhelper::getGLState().invalidate();
 
-	bool stopRendering = false;
-	auto startTime = std::chrono::system_clock::now();
+	// Frames compared or timed between runs must not depend on how far loading got
+	if(headless || benchmarkMode || regressionMode)
+	{
+		labhelper::getAssetLoader().finish();
+	}
 
-	while(!stopRendering)
+	if(headless)
 	{
-		//update currentTime
-		std::chrono::duration<float> timeSinceStart = std::chrono::system_clock::now() - startTime;
-		previousTime = currentTime;
-		currentTime = timeSinceStart.count();
-		deltaTime = currentTime - previousTime;
+		outputTarget = renderTargets.acquire(headlessWidth, headlessHeight, GL_RGBA8);
+		outputFramebuffer = outputTarget->framebufferId;
+	}
 
-		// Inform imgui of new frame
-		ImGui_ImplSdlGL3_NewFrame(g_window);
+	if(benchmarkMode)
+	{
+		CameraPath path = CameraPath::orbit(vec3(0.0f), 150.0f, 40.0f, 20.0f);
+		if(!benchmarkPathFile.empty() && !path.load(benchmarkPathFile))
+		{
+			labhelper::fatal_error("Could not load camera path " + benchmarkPathFile);
+		}
+		benchmark = new Benchmark(path, benchmarkTimestep, benchmarkWarmup);
+		gpuProfiler.record = true;
+	}
 
-		// check events (keyboard among other)
-		stopRendering = handleEvents();
+	int exitCode = 0;
+	if(regressionMode)
+	{
+		exitCode = runRegression() ? 0 : 1;
+	}
 
-		// render to window
-		display();
+	bool stopRendering = regressionMode;
+	int frameNumber = 0;
+	auto startTime = std::chrono::system_clock::now();
 
-		// Render overlay GUI.
-		if(showUI)
+	while(!stopRendering)
+	{
+		TRACE_SCOPE("Frame");
+		// Before reading input, so waiting for the GPU does not add to the latency
+		pacer.beginFrame();
+		labhelper::getGLState().beginFrame();
+		labhelper::getAssetLoader().update(assetUploadBudget);
+		auto frameStart = std::chrono::steady_clock::now();
+		uint64_t gpuFrame = gpuProfiler.frameNumber();
+
+		//update currentTime
+		previousTime = currentTime;
+		if(benchmark != nullptr)
+		{
+			// Fixed timestep, so the clouds animate identically in every run
+			currentTime = benchmark->time();
+			deltaTime = benchmark->timestep();
+		}
+		else
 		{
-			gui();
+			std::chrono::duration<float> timeSinceStart = std::chrono::system_clock::now() - startTime;
+			currentTime = timeSinceStart.count();
+			deltaTime = currentTime - previousTime;
 		}
 
-		// Render the GUI.
-		ImGui::Render();
+		if(headless)
+		{
+			applyBenchmarkCamera();
+
+			gpuProfiler.beginFrame();
+			display();
+			gpuProfiler.endFrame();
+
+			if(saveHeadlessFrames)
+			{
+				char basename[64];
+				snprintf(basename, sizeof(basename), "frame_%05d", frameNumber);
+				labhelper::getFrameCapture().capture(outputFramebuffer, headlessWidth, headlessHeight, basename,
+				                                     labhelper::FrameCapture::Format(captureFormat));
+			}
+			labhelper::getFrameCapture().update();
+			stopRendering = benchmark == nullptr && frameNumber + 1 >= headlessFrames;
+		}
+		else
+		{
+			// Inform imgui of new frame
+			ImGui_ImplSdlGL3_NewFrame(g_window);
+
+			// check events (keyboard among other)
+			stopRendering = handleEvents();
+
+			applyBenchmarkCamera();
+			if(!recordPathFile.empty())
+			{
+				recordedPath.record({ currentTime, cameraPosition, cameraDirection, lightDirection });
+			}
+
+			gpuProfiler.beginFrame();
+
+			// render to window
+			display();
+
+			// Before the GUI is drawn on top
+			labhelper::getFrameCapture().captureSequenceFrame(outputFramebuffer, windowWidth, windowHeight);
+			labhelper::getFrameCapture().update();
+
+			// Render overlay GUI.
+			if(showUI)
+			{
+				gui();
+			}
+
+			// Render the GUI.
+			{
+				TRACE_SCOPE("ImGui::Render");
+				labhelper::GpuProfileScope scope(gpuProfiler, "GUI");
+				ImGui::Render();
+			}
+
+			gpuProfiler.endFrame();
+
+			// Swap front and back buffer. This frame will now been displayed.
+			{
+				TRACE_SCOPE("SDL_GL_SwapWindow");
+				SDL_GL_SwapWindow(g_window);
+			}
+		}
+		pacer.endFrame();
+		if(frameNumber == 0)
+		{
+			std::chrono::duration<float, std::milli> sinceLaunch = std::chrono::steady_clock::now() - launchTime;
+			firstFrameMs = sinceLaunch.count();
+		}
+		frameNumber++;
 
-		// Swap front and back buffer. This frame will now been displayed.
-		SDL_GL_SwapWindow(g_window);
+		if(benchmark != nullptr)
+		{
+			std::chrono::duration<double, std::milli> cpuTime = std::chrono::steady_clock::now() - frameStart;
+			benchmark->endFrame(cpuTime.count(), gpuFrame);
+			if(benchmark->finished())
+			{
+				gpuProfiler.flush();
+				benchmark->writeReport(gpuProfiler);
+				stopRendering = true;
+			}
+		}
+	}
+	if(!recordPathFile.empty())
+	{
+		recordedPath.save(recordPathFile);
+	}
+	if(exportTraceAtExit)
+	{
+		labhelper::traceExport();
 	}
 	// Free Models
 	labhelper::freeModel(fighterModel);
 	labhelper::freeModel(landingpadModel);
+	labhelper::getAssetLoader().free();
+	delete cloudStats;
+	delete cloudProfile;
+	delete benchmark;
+	renderGraph.free();
+	renderTargets.clear();
+	pacer.free();
+	uniformStream.free();
+	cameraUniforms.free();
+	skyUniforms.free();
+	cloudUniforms.free();
+	shaderProgram.free();
+	batchedShaderProgram.free();
+	batchedDepthProgram.free();
+	sceneBatcher.free();
+	gpuProfiler.free();
 
 	// Shut down everything. This includes the window and all other subsystems.
 	labhelper::shutDown(g_window);
-	return 0;
+	return exitCode;
 }
@@ -2,6 +2,7 @@
 #include <GL/glew.h>
 #include <iostream>
 #include <labhelper.h>
+#include <GLState.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
@@ -51,10 +52,8 @@ void NoiseGenerator::renderNoise() {
 
 void NoiseGenerator::debugDraw(float layer, float screenRatio, int channel) {
 
-	glActiveTexture(GL_TEXTURE9);
-	glBindTexture(GL_TEXTURE_3D, noiseTexture);
-	glActiveTexture(GL_TEXTURE0);
-	glUseProgram(debugShader);
+	labhelper::getGLState().bindTexture(9, GL_TEXTURE_3D, noiseTexture);
+	labhelper::getGLState().useProgram(debugShader);
 	labhelper::setUniformSlow(debugShader, "layer", layer);
 	labhelper::setUniformSlow(debugShader, "screenRatio", screenRatio);
 	labhelper::setUniformSlow(debugShader, "channel", channel);
@@ -0,0 +1,166 @@
+#include "regression.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+bool loadRegressionPresets(const std::string& filename, std::vector<RegressionPreset>& presets) {
+	std::ifstream file(filename);
+	if (!file) {
+		return false;
+	}
+	presets.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::istringstream in(line);
+		RegressionPreset preset;
+		CameraKeyframe& k = preset.camera;
+		in >> preset.name >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.direction.x
+		    >> k.direction.y >> k.direction.z >> k.lightDirection.x >> k.lightDirection.y >> k.lightDirection.z;
+		if (!in) {
+			std::cout << "Skipping malformed preset: " << line << std::endl;
+			continue;
+		}
+		k.direction = normalize(k.direction);
+		k.lightDirection = normalize(k.lightDirection);
+		std::string parameter;
+		while (in >> parameter) {
+			size_t eq = parameter.find('=');
+			if (eq != std::string::npos) {
+				preset.parameters.push_back(
+				    std::make_pair(parameter.substr(0, eq), float(std::atof(parameter.c_str() + eq + 1))));
+			}
+		}
+		presets.push_back(preset);
+	}
+	return !presets.empty();
+}
+
+namespace {
+	float luminance(const uint8_t* p) {
+		return 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+	}
+
+	// Mean SSIM of the luminance over non-overlapping 8x8 blocks
+	float structuralSimilarity(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int width,
+	                           int height) {
+		const int block = 8;
+		const double c1 = (0.01 * 255) * (0.01 * 255);
+		const double c2 = (0.03 * 255) * (0.03 * 255);
+		double sum = 0.0;
+		int count = 0;
+		for (int by = 0; by + block <= height; by += block) {
+			for (int bx = 0; bx + block <= width; bx += block) {
+				double meanA = 0, meanB = 0, varA = 0, varB = 0, cov = 0;
+				for (int y = by; y < by + block; y++) {
+					for (int x = bx; x < bx + block; x++) {
+						size_t i = (size_t(y) * width + x) * 3;
+						double la = luminance(&a[i]), lb = luminance(&b[i]);
+						meanA += la;
+						meanB += lb;
+						varA += la * la;
+						varB += lb * lb;
+						cov += la * lb;
+					}
+				}
+				const double n = block * block;
+				meanA /= n;
+				meanB /= n;
+				varA = varA / n - meanA * meanA;
+				varB = varB / n - meanB * meanB;
+				cov = cov / n - meanA * meanB;
+				sum += ((2 * meanA * meanB + c1) * (2 * cov + c2))
+				       / ((meanA * meanA + meanB * meanB + c1) * (varA + varB + c2));
+				count++;
+			}
+		}
+		return count > 0 ? float(sum / count) : 1.0f;
+	}
+}
+
+ImageComparison compareImages(const std::vector<uint8_t>& actual, const std::vector<uint8_t>& golden,
+                              int width, int height, const RegressionTolerances& tolerances,
+                              std::vector<uint8_t>* diffImage) {
+	ImageComparison result = {};
+	result.sizeMatches = actual.size() == size_t(width) * height * 3 && golden.size() == actual.size();
+	if (!result.sizeMatches) {
+		return result;
+	}
+	if (diffImage != nullptr) {
+		diffImage->assign(actual.size(), 0);
+	}
+	size_t different = 0;
+	for (size_t p = 0; p < size_t(width) * height; p++) {
+		int pixelDiff = 0;
+		for (int c = 0; c < 3; c++) {
+			pixelDiff = std::max(pixelDiff, std::abs(int(actual[p * 3 + c]) - int(golden[p * 3 + c])));
+		}
+		result.maxDifference = std::max(result.maxDifference, pixelDiff);
+		bool over = pixelDiff > tolerances.pixelThreshold;
+		different += over ? 1 : 0;
+		if (diffImage != nullptr) {
+			uint8_t v = uint8_t(std::min(pixelDiff * 8, 255));
+			(*diffImage)[p * 3 + 0] = over ? 255 : v;
+			(*diffImage)[p * 3 + 1] = over ? 0 : v;
+			(*diffImage)[p * 3 + 2] = over ? 0 : v;
+		}
+	}
+	result.differentFraction = float(double(different) / (double(width) * height));
+	result.ssim = structuralSimilarity(actual, golden, width, height);
+	result.passed = result.differentFraction <= tolerances.maxDifferentFraction && result.ssim >= tolerances.minSsim;
+	return result;
+}
+
+bool checkAgainstGolden(const std::string& name, const std::vector<uint8_t>& image, int width, int height,
+                        const std::string& goldenDir, const RegressionTolerances& tolerances, bool update) {
+	std::string goldenFile = goldenDir + "/" + name + ".png";
+	if (update) {
+		bool written = stbi_write_png(goldenFile.c_str(), width, height, 3, image.data(), 0) != 0;
+		std::cout << (written ? "UPDATED " : "FAILED TO WRITE ") << goldenFile << std::endl;
+		return written;
+	}
+
+	// Rendered images are top row first, load the golden image the same way
+	stbi_set_flip_vertically_on_load(false);
+	int goldenWidth = 0, goldenHeight = 0, components = 0;
+	uint8_t* data = stbi_load(goldenFile.c_str(), &goldenWidth, &goldenHeight, &components, 3);
+	stbi_set_flip_vertically_on_load(true);
+
+	std::vector<uint8_t> golden;
+	if (data != nullptr) {
+		golden.assign(data, data + size_t(goldenWidth) * goldenHeight * 3);
+		stbi_image_free(data);
+	}
+
+	std::vector<uint8_t> diff;
+	ImageComparison result;
+	if (data == nullptr) {
+		std::cout << "FAIL " << name << ": could not load " << goldenFile << std::endl;
+		result.passed = false;
+	}
+	else if (goldenWidth != width || goldenHeight != height) {
+		std::cout << "FAIL " << name << ": size " << width << "x" << height << ", golden is " << goldenWidth
+		          << "x" << goldenHeight << std::endl;
+		result.passed = false;
+	}
+	else {
+		result = compareImages(image, golden, width, height, tolerances, &diff);
+		std::cout << (result.passed ? "PASS " : "FAIL ") << name << ": max difference " << result.maxDifference
+		          << ", " << 100.0f * result.differentFraction << "% pixels over threshold, SSIM " << result.ssim
+		          << std::endl;
+	}
+
+	if (!result.passed) {
+		stbi_write_png((name + "_actual.png").c_str(), width, height, 3, image.data(), 0);
+		if (!diff.empty()) {
+			stbi_write_png((name + "_diff.png").c_str(), width, height, 3, diff.data(), 0);
+		}
+	}
+	return result.passed;
+}
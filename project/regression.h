@@ -0,0 +1,57 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "cameraPath.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// A named view to render and compare against its golden image. Stored as text,
+/// one preset per line:
+///   name  time  position.xyz  direction.xyz  lightDirection.xyz  [param=value ...]
+///////////////////////////////////////////////////////////////////////////////
+struct RegressionPreset {
+	std::string name;
+	CameraKeyframe camera;
+	std::vector<std::pair<std::string, float>> parameters;
+};
+
+bool loadRegressionPresets(const std::string& filename, std::vector<RegressionPreset>& presets);
+
+///////////////////////////////////////////////////////////////////////////////
+/// An image passes if at most `maxDifferentFraction` of its pixels differ by
+/// more than `pixelThreshold` (0-255) in any channel, and its structural
+/// similarity (SSIM of the luminance over 8x8 blocks) is at least `minSsim`.
+/// The first catches local breakage, the second overall changes such as
+/// banding or noise that stay below the per-pixel threshold.
+///////////////////////////////////////////////////////////////////////////////
+struct RegressionTolerances {
+	int pixelThreshold = 8;
+	float maxDifferentFraction = 0.001f;
+	float minSsim = 0.98f;
+};
+
+struct ImageComparison {
+	bool sizeMatches;
+	int maxDifference;
+	float differentFraction;
+	float ssim;
+	bool passed;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// Compares two 8 bit RGB images, optionally producing a difference image
+/// (amplified absolute difference, pixels over the threshold in red).
+///////////////////////////////////////////////////////////////////////////////
+ImageComparison compareImages(const std::vector<uint8_t>& actual, const std::vector<uint8_t>& golden,
+                              int width, int height, const RegressionTolerances& tolerances,
+                              std::vector<uint8_t>* diffImage = nullptr);
+
+///////////////////////////////////////////////////////////////////////////////
+/// Compares a rendered RGB image (top row first) with <goldenDir>/<name>.png.
+/// On failure <name>_actual.png and <name>_diff.png are written to the working
+/// directory. With `update` the golden image is replaced instead.
+///////////////////////////////////////////////////////////////////////////////
+bool checkAgainstGolden(const std::string& name, const std::vector<uint8_t>& image, int width, int height,
+                        const std::string& goldenDir, const RegressionTolerances& tolerances, bool update);
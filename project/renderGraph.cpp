@@ -0,0 +1,415 @@
+#include "renderGraph.h"
+#include <algorithm>
+#include <cstdio>
+
+#include <imgui.h>
+#include <labhelper.h>
+#include <GLState.h>
+#include <Profiler.h>
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::read(Resource resource, GLuint unit, Aspect aspect) {
+	Read r = { resource, unit, aspect };
+	graph.passes[pass].reads.push_back(r);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::write(Resource resource) {
+	if (graph.resources[resource].kind == TEXTURE) {
+		labhelper::fatal_error(std::string("Pass '") + graph.passes[pass].name + "' renders into the texture '"
+		                       + graph.resources[resource].name + "', only targets and framebuffers can be written");
+	}
+	graph.passes[pass].target = resource;
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::clear(const glm::vec4& color) {
+	graph.passes[pass].clear = true;
+	graph.passes[pass].clearColor = color;
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::writeStorage(Resource resource) {
+	graph.passes[pass].storageWrites.push_back(resource);
+	return *this;
+}
+
+namespace {
+	int bytesPerPixel(GLenum colorFormat) {
+		switch (colorFormat) {
+		case GL_RGBA16F: return 8;
+		case GL_RGBA32F: return 16;
+		case GL_RGB32F: return 12;
+		case GL_RGB16F: return 6;
+		default: return 4;
+		}
+	}
+}
+
+RenderGraph::RenderGraph(RenderTargetPool& pool)
+    : pool(pool), numTransientTargets(0), countFragments(false), frame(0) {
+}
+
+void RenderGraph::setCountFragments(bool enable) {
+	countFragments = enable;
+	if (!enable) {
+		resolvedStats.clear();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Picks up the queries issued QUERY_FRAMES frames ago. They are normally
+/// done by now; if the GPU is further behind, the frame is dropped instead of
+/// waiting for it.
+///////////////////////////////////////////////////////////////////////////////
+void RenderGraph::resolveQueries(std::vector<PendingQuery>& queries) {
+	if (queries.empty()) return;
+
+	GLuint available = 0;
+	glGetQueryObjectuiv(queries.back().query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (available) {
+		resolvedStats.clear();
+	}
+	for (const PendingQuery& q : queries) {
+		if (available) {
+			GLuint64 samples = 0;
+			glGetQueryObjectui64v(q.query, GL_QUERY_RESULT, &samples);
+			FragmentStats s;
+			s.name = q.name;
+			s.fragments = double(samples);
+			s.overdraw = q.pixels > 0 ? double(samples) / q.pixels : 0.0;
+			s.colorBytes = double(samples) * q.bytesPerPixel;
+			resolvedStats.push_back(s);
+		}
+		freeQueries.push_back(q.query);
+	}
+	queries.clear();
+}
+
+void RenderGraph::free() {
+	for (std::vector<PendingQuery>& queries : pendingQueries) {
+		for (const PendingQuery& q : queries) {
+			freeQueries.push_back(q.query);
+		}
+		queries.clear();
+	}
+	if (!freeQueries.empty()) {
+		glDeleteQueries(GLsizei(freeQueries.size()), freeQueries.data());
+	}
+	freeQueries.clear();
+}
+
+void RenderGraph::reset() {
+	resources.clear();
+	passes.clear();
+}
+
+RenderGraph::Resource RenderGraph::createTarget(const char* name, const TargetDesc& desc) {
+	ResourceData r = {};
+	r.name = name;
+	r.kind = TARGET;
+	r.desc = desc;
+	resources.push_back(r);
+	return Resource(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importTexture(const char* name, GLenum target, GLuint texture) {
+	ResourceData r = {};
+	r.name = name;
+	r.kind = TEXTURE;
+	r.textureTarget = target;
+	r.texture = texture;
+	resources.push_back(r);
+	return Resource(resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::importFramebuffer(const char* name, GLuint framebuffer, int width, int height) {
+	ResourceData r = {};
+	r.name = name;
+	r.kind = FRAMEBUFFER;
+	r.framebuffer = framebuffer;
+	r.width = width;
+	r.height = height;
+	resources.push_back(r);
+	return Resource(resources.size() - 1);
+}
+
+RenderGraph::PassBuilder RenderGraph::addPass(const char* name, std::function<void()> execute, bool enabled) {
+	PassData p;
+	p.name = name;
+	p.execute = execute;
+	p.enabled = enabled;
+	p.target = -1;
+	p.clear = false;
+	p.clearColor = glm::vec4(0.0f);
+	p.live = false;
+	passes.push_back(p);
+	return PassBuilder(*this, int(passes.size()) - 1);
+}
+
+bool RenderGraph::writes(const PassData& pass, Resource resource) const {
+	return pass.target == resource
+	       || std::find(pass.storageWrites.begin(), pass.storageWrites.end(), resource) != pass.storageWrites.end();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Marks the passes that must run: enabled passes with writes visible outside
+/// the graph, and, transitively, the enabled passes declared before them that
+/// write something they read.
+///////////////////////////////////////////////////////////////////////////////
+void RenderGraph::cull() {
+	std::vector<int> work;
+	for (size_t i = 0; i < passes.size(); i++) {
+		PassData& p = passes[i];
+		p.live = false;
+		if (!p.enabled) continue;
+		bool sideEffect = p.target >= 0 && resources[p.target].kind != TARGET;
+		for (Resource r : p.storageWrites) {
+			sideEffect = sideEffect || resources[r].kind != TARGET;
+		}
+		if (sideEffect) {
+			p.live = true;
+			work.push_back(int(i));
+		}
+	}
+
+	while (!work.empty()) {
+		int reader = work.back();
+		work.pop_back();
+		for (const Read& read : passes[reader].reads) {
+			for (int writer = 0; writer < reader; writer++) {
+				PassData& p = passes[writer];
+				if (!p.live && p.enabled && writes(p, read.resource)) {
+					p.live = true;
+					work.push_back(writer);
+				}
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Orders the live passes. A reader comes after the writers declared before it,
+/// and a writer after the earlier writers and readers of the same resource.
+/// Among passes that are free to go, the one declared first goes first.
+///////////////////////////////////////////////////////////////////////////////
+std::vector<int> RenderGraph::sortPasses() const {
+	const int n = int(passes.size());
+	std::vector<std::vector<int>> successors(n);
+	std::vector<int> predecessorCount(n, 0);
+	auto addEdge = [&](int from, int to) {
+		if (from == to) return;
+		if (std::find(successors[from].begin(), successors[from].end(), to) != successors[from].end()) return;
+		successors[from].push_back(to);
+		predecessorCount[to]++;
+	};
+
+	std::vector<int> lastWriter(resources.size(), -1);
+	std::vector<std::vector<int>> readersSinceWrite(resources.size());
+	for (int i = 0; i < n; i++) {
+		const PassData& p = passes[i];
+		if (!p.live) continue;
+		for (const Read& read : p.reads) {
+			if (lastWriter[read.resource] >= 0) {
+				addEdge(lastWriter[read.resource], i);
+			}
+			readersSinceWrite[read.resource].push_back(i);
+		}
+		std::vector<Resource> written = p.storageWrites;
+		if (p.target >= 0) {
+			written.push_back(p.target);
+		}
+		for (Resource r : written) {
+			if (lastWriter[r] >= 0) {
+				addEdge(lastWriter[r], i);
+			}
+			for (int reader : readersSinceWrite[r]) {
+				addEdge(reader, i);
+			}
+			lastWriter[r] = i;
+			readersSinceWrite[r].clear();
+		}
+	}
+
+	std::vector<int> order;
+	std::vector<bool> done(n, false);
+	for (;;) {
+		int next = -1;
+		for (int i = 0; i < n; i++) {
+			if (passes[i].live && !done[i] && predecessorCount[i] == 0) {
+				next = i;
+				break;
+			}
+		}
+		if (next < 0) break;
+		done[next] = true;
+		order.push_back(next);
+		for (int s : successors[next]) {
+			predecessorCount[s]--;
+		}
+	}
+	return order;
+}
+
+GLuint RenderGraph::textureOf(const Read& read) const {
+	const ResourceData& r = resources[read.resource];
+	if (r.kind == TEXTURE) {
+		return r.texture;
+	}
+	if (r.kind == TARGET && r.fbo != nullptr) {
+		return read.aspect == DEPTH ? r.fbo->depthBuffer : r.fbo->colorTextureTargets[0];
+	}
+	labhelper::fatal_error(std::string("Texture '") + r.name + "' is read but is not a texture or a live target");
+	return 0;
+}
+
+void RenderGraph::execute(labhelper::GpuProfiler* profiler) {
+	std::vector<PendingQuery>& queries = pendingQueries[frame % QUERY_FRAMES];
+	resolveQueries(queries);
+	frame++;
+
+	cull();
+	std::vector<int> order = sortPasses();
+
+	// Lifetimes of the transient targets, in positions of `order`
+	std::vector<int> firstUse(resources.size(), -1);
+	std::vector<int> lastUse(resources.size(), -1);
+	for (int i = 0; i < int(order.size()); i++) {
+		const PassData& p = passes[order[i]];
+		std::vector<Resource> used = p.storageWrites;
+		if (p.target >= 0) {
+			used.push_back(p.target);
+		}
+		for (const Read& read : p.reads) {
+			used.push_back(read.resource);
+		}
+		for (Resource r : used) {
+			if (firstUse[r] < 0) firstUse[r] = i;
+			lastUse[r] = i;
+		}
+	}
+
+	info.clear();
+	numTransientTargets = 0;
+	labhelper::GLStateCache& gl = labhelper::getGLState();
+
+	for (int i = 0; i < int(order.size()); i++) {
+		PassData& p = passes[order[i]];
+
+		for (size_t r = 0; r < resources.size(); r++) {
+			ResourceData& res = resources[r];
+			if (res.kind == TARGET && firstUse[r] == i) {
+				res.fbo = pool.acquire(res.desc.width, res.desc.height, res.desc.colorFormat, 1, res.desc.depthFormat);
+				numTransientTargets++;
+			}
+		}
+
+		// One barrier makes every earlier image store visible to texture fetches
+		bool needsBarrier = false;
+		for (const Read& read : p.reads) {
+			needsBarrier = needsBarrier || resources[read.resource].storageWritePending;
+		}
+		if (needsBarrier) {
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+			for (ResourceData& res : resources) {
+				res.storageWritePending = false;
+			}
+		}
+
+		PendingQuery query = { p.name, 0, 0, 4 };
+		if (p.target >= 0) {
+			const ResourceData& target = resources[p.target];
+			if (target.kind == FRAMEBUFFER) {
+				gl.bindFramebuffer(target.framebuffer);
+				gl.setViewport(0, 0, target.width, target.height);
+				query.pixels = target.width * target.height;
+			} else {
+				gl.bindFramebuffer(target.fbo->framebufferId);
+				gl.setViewport(0, 0, target.fbo->width, target.fbo->height);
+				query.pixels = target.fbo->width * target.fbo->height;
+				query.bytesPerPixel = bytesPerPixel(target.desc.colorFormat);
+			}
+			if (p.clear) {
+				glClearColor(p.clearColor.r, p.clearColor.g, p.clearColor.b, p.clearColor.a);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			}
+		}
+
+		for (const Read& read : p.reads) {
+			const ResourceData& res = resources[read.resource];
+			gl.bindTexture(read.unit, res.kind == TEXTURE ? res.textureTarget : GL_TEXTURE_2D, textureOf(read));
+		}
+		gl.activeTexture(0);
+
+		if (countFragments) {
+			if (freeQueries.empty()) {
+				freeQueries.resize(1);
+				glGenQueries(1, freeQueries.data());
+			}
+			query.query = freeQueries.back();
+			freeQueries.pop_back();
+			queries.push_back(query);
+			glBeginQuery(GL_SAMPLES_PASSED, query.query);
+		}
+
+		if (profiler != nullptr) {
+			labhelper::GpuProfileScope scope(*profiler, p.name);
+			p.execute();
+		} else {
+			p.execute();
+		}
+
+		if (countFragments) {
+			glEndQuery(GL_SAMPLES_PASSED);
+		}
+
+		for (Resource r : p.storageWrites) {
+			resources[r].storageWritePending = true;
+		}
+
+		for (size_t r = 0; r < resources.size(); r++) {
+			ResourceData& res = resources[r];
+			if (res.kind == TARGET && lastUse[r] == i) {
+				pool.release(res.fbo);
+				res.fbo = nullptr;
+			}
+		}
+
+		PassInfo pi = { p.name, false };
+		info.push_back(pi);
+	}
+
+	for (const PassData& p : passes) {
+		if (!p.live) {
+			PassInfo pi = { p.name, true };
+			info.push_back(pi);
+		}
+	}
+}
+
+void RenderGraph::drawGui() const {
+	for (const PassInfo& p : info) {
+		if (p.culled) {
+			ImGui::TextDisabled("  %s (culled)", p.name);
+		} else {
+			ImGui::Text("  %s", p.name);
+		}
+	}
+	ImGui::Text("Transient targets: %d", numTransientTargets);
+
+	if (!countFragments) return;
+
+	// Overdraw of each pass as a bar, full at 4 fragments per pixel
+	double totalOverdraw = 0.0;
+	double totalBytes = 0.0;
+	for (const FragmentStats& s : resolvedStats) {
+		char label[64];
+		snprintf(label, sizeof(label), "%.2fx  %.1f MB", s.overdraw, s.colorBytes / (1024.0 * 1024.0));
+		ImGui::ProgressBar(float(s.overdraw / 4.0), ImVec2(160, 0), label);
+		ImGui::SameLine();
+		ImGui::Text("%s", s.name);
+		totalOverdraw += s.overdraw;
+		totalBytes += s.colorBytes;
+	}
+	ImGui::Text("Total: %.2f fragments per pixel, %.1f MB colour writes per frame", totalOverdraw,
+	            totalBytes / (1024.0 * 1024.0));
+}
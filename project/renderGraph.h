@@ -0,0 +1,186 @@
+#pragma once
+#include <GL/glew.h>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "fbo.h"
+
+namespace labhelper {
+class GpuProfiler;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Builds a frame out of passes that declare which textures they read and
+/// which target they write, instead of hard-coding order, texture units and
+/// framebuffer binds in display().
+///
+/// Rebuilt every frame: reset(), declare resources and passes, execute().
+/// execute() then
+///  - orders the passes so every read sees the writes declared before it,
+///  - culls disabled passes and passes whose outputs nothing live reads,
+///  - acquires transient targets from the RenderTargetPool at their first use
+///    and releases them after their last, so targets of equal size and format
+///    whose lifetimes do not overlap share memory,
+///  - binds each pass' target, clears it if asked, and binds the textures it
+///    reads (through the GL state cache, so binds already in place are free),
+///  - inserts a memory barrier before reads of image-store writes.
+///
+/// With setCountFragments() each pass also counts the samples it draws, which
+/// shows the overdraw of every pass and a rough estimate of its colour writes.
+///
+/// Writes to imported resources (the output framebuffer, textures owned by
+/// someone else) are visible outside the graph, so such passes are never
+/// culled unless disabled.
+///
+/// Names must be string literals, they are handed on to the GPU profiler.
+///////////////////////////////////////////////////////////////////////////////
+class RenderGraph {
+
+public:
+	typedef int Resource;
+
+	enum Aspect {
+		COLOR = 0,
+		DEPTH
+	};
+
+	struct TargetDesc {
+		int width;
+		int height;
+		GLenum colorFormat;
+		GLenum depthFormat;
+	};
+
+	/// Returned by addPass() to declare what the pass touches
+	class PassBuilder {
+	public:
+		/// Binds `resource` to texture `unit` while the pass runs
+		PassBuilder& read(Resource resource, GLuint unit, Aspect aspect = COLOR);
+		/// Renders into `resource` (a target or an imported framebuffer)
+		PassBuilder& write(Resource resource);
+		/// Clears color and depth of the written target before the pass
+		PassBuilder& clear(const glm::vec4& color);
+		/// Writes `resource` through image stores; later readers get a barrier
+		PassBuilder& writeStorage(Resource resource);
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, int pass) : graph(graph), pass(pass) {}
+		RenderGraph& graph;
+		int pass;
+	};
+
+	/// Per pass information of the last execute(), for the GUI
+	struct PassInfo {
+		const char* name;
+		bool culled;
+	};
+
+	/// Samples drawn by a pass, from a frame a few frames back
+	struct FragmentStats {
+		const char* name;
+		double fragments;
+		double overdraw;		// Fragments per pixel of the target
+		double colorBytes;		// Assuming every fragment writes the whole colour attachment
+	};
+
+	explicit RenderGraph(RenderTargetPool& pool);
+
+	/// Forgets the passes and resources of the previous frame
+	void reset();
+
+	/// A target owned by the graph, only alive between its first and last use
+	Resource createTarget(const char* name, const TargetDesc& desc);
+	/// A texture owned by someone else
+	Resource importTexture(const char* name, GLenum target, GLuint texture);
+	/// A framebuffer owned by someone else, e.g. 0 for the window
+	Resource importFramebuffer(const char* name, GLuint framebuffer, int width, int height);
+
+	PassBuilder addPass(const char* name, std::function<void()> execute, bool enabled = true);
+
+	/// Orders, culls and runs the passes. Each pass is timed if a profiler is given.
+	void execute(labhelper::GpuProfiler* profiler = nullptr);
+
+	/// Passes of the last execute() in execution order, culled ones last
+	const std::vector<PassInfo>& passInfo() const { return info; }
+	/// Pool targets acquired in the last execute()
+	int transientTargets() const { return numTransientTargets; }
+
+	/// Wraps every pass in a GL_SAMPLES_PASSED query. Results arrive a few frames late.
+	void setCountFragments(bool enable);
+	bool countsFragments() const { return countFragments; }
+	const std::vector<FragmentStats>& fragmentStats() const { return resolvedStats; }
+
+	/// Draws the pass list and counters, and the overdraw of every pass if counted
+	void drawGui() const;
+
+	/// Deletes the query objects. Call before the GL context goes away.
+	void free();
+
+private:
+	enum Kind {
+		TARGET = 0,
+		TEXTURE,
+		FRAMEBUFFER
+	};
+
+	struct ResourceData {
+		const char* name;
+		Kind kind;
+		TargetDesc desc;		// TARGET
+		GLenum textureTarget;	// TEXTURE
+		GLuint texture;			// TEXTURE
+		GLuint framebuffer;		// FRAMEBUFFER
+		int width, height;		// FRAMEBUFFER
+		FboInfo* fbo;			// TARGET, while acquired
+		bool storageWritePending;
+	};
+
+	struct Read {
+		Resource resource;
+		GLuint unit;
+		Aspect aspect;
+	};
+
+	struct PassData {
+		const char* name;
+		std::function<void()> execute;
+		bool enabled;
+		std::vector<Read> reads;
+		Resource target;
+		std::vector<Resource> storageWrites;
+		bool clear;
+		glm::vec4 clearColor;
+		bool live;
+	};
+
+	struct PendingQuery {
+		const char* name;
+		GLuint query;
+		int pixels;
+		int bytesPerPixel;
+	};
+
+	static const int QUERY_FRAMES = 3;
+
+	void resolveQueries(std::vector<PendingQuery>& queries);
+	void cull();
+	std::vector<int> sortPasses() const;
+	GLuint textureOf(const Read& read) const;
+	bool writes(const PassData& pass, Resource resource) const;
+
+	RenderTargetPool& pool;
+	std::vector<ResourceData> resources;
+	std::vector<PassData> passes;
+
+	std::vector<PassInfo> info;
+	int numTransientTargets;
+
+	bool countFragments;
+	int frame;
+	std::vector<PendingQuery> pendingQueries[QUERY_FRAMES];
+	std::vector<GLuint> freeQueries;
+	std::vector<FragmentStats> resolvedStats;
+};
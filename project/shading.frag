@@ -6,15 +6,38 @@ precision highp float;
 ///////////////////////////////////////////////////////////////////////////////
 // Material
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 material_color = vec3(1, 1, 1);
-uniform float material_metalness = 0;
-uniform float material_fresnel = 0;
-uniform float material_shininess = 0;
-uniform vec3 material_emission = vec3(0);
+// All materials of the model, uploaded once, see labhelper::MaterialBatch
+struct Material {
+	vec3 color;
+	float metalness;
+	vec3 emission;
+	float fresnel;
+	float shininess;
+	int has_color_texture;
+	int has_emission_texture;
+};
+
+// labhelper::MATERIAL_BLOCK_BINDING and MATERIAL_BLOCK_SIZE
+layout(std140, binding = 3) uniform MaterialBlock {
+	Material materials[256];
+};
+#ifdef MULTI_DRAW
+// Per draw, see shading.vert
+flat in int materialIndex;
+#define material_index materialIndex
+#else
+uniform int material_index = 0;
+#endif
+
+#define material_color materials[material_index].color
+#define material_metalness materials[material_index].metalness
+#define material_fresnel materials[material_index].fresnel
+#define material_shininess materials[material_index].shininess
+#define material_emission materials[material_index].emission
+#define has_color_texture materials[material_index].has_color_texture
+#define has_emission_texture materials[material_index].has_emission_texture
 
-uniform int has_color_texture = 0;
 layout(binding = 0) uniform sampler2D colorMap;
-uniform int has_emission_texture = 0;
 layout(binding = 5) uniform sampler2D emissiveMap;
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -23,13 +46,29 @@ layout(binding = 5) uniform sampler2D emissiveMap;
 layout(binding = 6) uniform sampler2D environmentMap;
 layout(binding = 7) uniform sampler2D irradianceMap;
 layout(binding = 8) uniform sampler2D reflectionMap;
-uniform float environment_multiplier;
 
 ///////////////////////////////////////////////////////////////////////////////
-// Light source
+// Shared uniform blocks (camera, light source and environment), see
+// uniformBlocks.h
 ///////////////////////////////////////////////////////////////////////////////
-uniform vec3 point_light_color = vec3(1.0, 1.0, 1.0);
-uniform float point_light_intensity_multiplier = 50.0;
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 view;
+	mat4 view_inverse;
+	mat4 proj_inverse;
+	mat4 pv;
+	mat4 pv_inverse;
+	vec3 camera_pos;
+	float time;
+};
+
+layout(std140, binding = 1) uniform SkyBlock {
+	vec3 light_direction;
+	float environment_multiplier;
+	vec3 light_color;
+	float light_intensity_multiplier;
+	vec3 color_sky;
+	vec3 color_horizon;
+};
 
 ///////////////////////////////////////////////////////////////////////////////
 // Constants
@@ -43,12 +82,6 @@ in vec2 texCoord;
 in vec3 viewSpaceNormal;
 in vec3 viewSpacePosition;
 
-///////////////////////////////////////////////////////////////////////////////
-// Input uniform variables
-///////////////////////////////////////////////////////////////////////////////
-uniform mat4 viewInverse;
-uniform vec3 viewSpaceLightDirection;
-
 ///////////////////////////////////////////////////////////////////////////////
 // Output color
 ///////////////////////////////////////////////////////////////////////////////
@@ -67,10 +100,10 @@ vec2 directionToSpherical(vec3 dir){
 
 vec3 calculateDirectIllumiunation(vec3 wo, vec3 n, vec3 base_color)
 {
-	vec3 wi = viewSpaceLightDirection;
+	vec3 wi = mat3(view) * light_direction;
 	//float distanceToLight = length(wi);
 	float distanceToLight = 1.0;
-	vec3 Li = point_light_intensity_multiplier * point_light_color * (1 / pow(distanceToLight, 2.0));
+	vec3 Li = light_intensity_multiplier * light_color * (1 / pow(distanceToLight, 2.0));
 
 	wo = normalize(wo);
 	wi = normalize(wi);
@@ -98,7 +131,7 @@ vec3 calculateIndirectIllumination(vec3 wo, vec3 n, vec3 base_color)
 {
 	vec3 wi = normalize(reflect(wo, n));
 
-	vec3 worldSpaceNormal = (viewInverse * vec4(n, 0.0)).xyz;
+	vec3 worldSpaceNormal = (view_inverse * vec4(n, 0.0)).xyz;
 	vec2 lookup = directionToSpherical(worldSpaceNormal);
 
 	vec3 diffuse_term = base_color * (1.0 / PI) * texture(irradianceMap, lookup).rgb;
@@ -107,7 +140,7 @@ vec3 calculateIndirectIllumination(vec3 wo, vec3 n, vec3 base_color)
 	vec3 wh = normalize(wo + wi);
 	float fresnel = material_fresnel + (1.0 - material_fresnel) * pow(1.0 - dot(wh, wi), 5.0);
 
-	vec3 worldSpaceWi = (viewInverse * vec4(wi, 0.0)).xyz;
+	vec3 worldSpaceWi = (view_inverse * vec4(wi, 0.0)).xyz;
 	lookup = directionToSpherical(worldSpaceWi * vec3(1.0, -1.0, 1.0));
 	vec3 Li = environment_multiplier * textureLod(reflectionMap, lookup, roughness * 7.0).rgb;
 
@@ -2,16 +2,61 @@
 ///////////////////////////////////////////////////////////////////////////////
 // Input vertex attributes
 ///////////////////////////////////////////////////////////////////////////////
+#ifdef PACKED_VERTICES
+// Positions relative to the mesh bounds, octahedral normals (see labhelper::Model)
+layout(location = 0) in vec3 packedPosition;
+layout(location = 1) in vec2 packedNormal;
+#else
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec3 normalIn;
+#endif
 layout(location = 2) in vec2 texCoordIn;
 
+#ifdef MULTI_DRAW
+///////////////////////////////////////////////////////////////////////////////
+// Per draw, fetched at the draw command's baseInstance (see
+// labhelper::SceneBatcher); the camera comes from the shared block
+///////////////////////////////////////////////////////////////////////////////
+layout(location = 3) in mat4 drawModelMatrix;
+layout(location = 7) in mat3 drawNormalMatrix;
+layout(location = 10) in vec3 meshPositionOffset;
+layout(location = 11) in vec3 meshPositionScale;
+layout(location = 12) in int drawMaterialIndex;
+
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 view;
+	mat4 view_inverse;
+	mat4 proj_inverse;
+	mat4 pv;
+	mat4 pv_inverse;
+	vec3 camera_pos;
+	float time;
+};
+
+flat out int materialIndex;
+#else
 ///////////////////////////////////////////////////////////////////////////////
 // Input uniform variables
 ///////////////////////////////////////////////////////////////////////////////
 uniform mat4 normalMatrix;
 uniform mat4 modelViewMatrix;
 uniform mat4 modelViewProjectionMatrix;
+#ifdef PACKED_VERTICES
+uniform vec3 meshPositionOffset;
+uniform vec3 meshPositionScale;
+#endif
+#endif
+
+#ifdef PACKED_VERTICES
+
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 // Output to fragment shader
@@ -21,11 +66,27 @@ out vec3 viewSpaceNormal;
 out vec3 viewSpacePosition;
 
 
+// The depth prepass (simple.vert) and shading.vert must produce identical depths
+invariant gl_Position;
+
 void main()
 {
+#ifdef PACKED_VERTICES
+	vec3 position = meshPositionOffset + meshPositionScale * packedPosition;
+	vec3 normalIn = octahedralDecode(packedNormal);
+#endif
+#ifdef MULTI_DRAW
+	vec4 worldPosition = drawModelMatrix * vec4(position, 1.0);
+	gl_Position = pv * worldPosition;
+	texCoord = texCoordIn;
+	viewSpaceNormal = mat3(view) * (drawNormalMatrix * normalIn);
+	viewSpacePosition = (view * worldPosition).xyz;
+	materialIndex = drawMaterialIndex;
+#else
 	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
 	texCoord = texCoordIn;
 	viewSpaceNormal = (normalMatrix * vec4(normalIn, 0.0)).xyz;
 	viewSpacePosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
+#endif
 
 }
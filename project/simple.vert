@@ -1,9 +1,47 @@
 #version 420
 
+#ifdef PACKED_VERTICES
+layout(location = 0) in vec3 packedPosition;
+#else
 layout(location = 0) in vec3 position;
+#endif
+
+#ifdef MULTI_DRAW
+// Per draw, as in shading.vert
+layout(location = 3) in mat4 drawModelMatrix;
+layout(location = 10) in vec3 meshPositionOffset;
+layout(location = 11) in vec3 meshPositionScale;
+
+layout(std140, binding = 0) uniform CameraBlock {
+	mat4 view;
+	mat4 view_inverse;
+	mat4 proj_inverse;
+	mat4 pv;
+	mat4 pv_inverse;
+	vec3 camera_pos;
+	float time;
+};
+#else
+#ifdef PACKED_VERTICES
+uniform vec3 meshPositionOffset;
+uniform vec3 meshPositionScale;
+#endif
 uniform mat4 modelViewProjectionMatrix;
+#endif
+
+// The depth prepass (simple.vert) and shading.vert must produce identical depths
+invariant gl_Position;
 
 void main()
 {
+#ifdef PACKED_VERTICES
+	// Decoded exactly as in shading.vert
+	vec3 position = meshPositionOffset + meshPositionScale * packedPosition;
+#endif
+#ifdef MULTI_DRAW
+	vec4 worldPosition = drawModelMatrix * vec4(position, 1.0);
+	gl_Position = pv * worldPosition;
+#else
 	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+#endif
 }
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+///////////////////////////////////////////////////////////////////////////////
+// CPU side mirrors of the std140 uniform blocks shared by cloud.frag,
+// background.frag and shading.frag. Keep these in sync with the GLSL
+// declarations; every vec3 is followed by a float so it fills 16 bytes.
+///////////////////////////////////////////////////////////////////////////////
+
+// Uniform block binding points
+enum UniformBlockBinding {
+	CAMERA_BLOCK_BINDING = 0,
+	SKY_BLOCK_BINDING = 1,
+	CLOUD_BLOCK_BINDING = 2
+	// 3 is labhelper::MATERIAL_BLOCK_BINDING, bound by labhelper::render()
+};
+
+// layout(std140, binding = 0) uniform CameraBlock
+struct CameraUniforms {
+	glm::mat4 view;
+	glm::mat4 view_inverse;
+	glm::mat4 proj_inverse;
+	glm::mat4 pv;
+	glm::mat4 pv_inverse;
+	glm::vec3 camera_pos;
+	float time;
+};
+
+// layout(std140, binding = 1) uniform SkyBlock
+struct SkyUniforms {
+	glm::vec3 light_direction;
+	float environment_multiplier;
+	glm::vec3 light_color;
+	float light_intensity_multiplier;
+	glm::vec3 color_sky;
+	float pad0;
+	glm::vec3 color_horizon;
+	float pad1;
+};
+
+// layout(std140, binding = 2) uniform CloudBlock
+struct CloudUniforms {
+	glm::vec3 container_min;
+	float density_threshold;
+	glm::vec3 container_max;
+	float density_multiplier;
+	float light_absorption;
+	float light_absorption_sun;
+	float darkness_threshold;
+	float step_size_sun;
+	float step_size;
+	float step_size_incr;
+	float step_size_incr_sun;
+	float cloud_scale;
+	float cloud_speed;
+	float forward_scattering;
+	float blue_noise_offset_factor;
+	float weather_scale;
+};
+
+static_assert(sizeof(CameraUniforms) == 5 * 64 + 16, "CameraUniforms does not match std140 layout");
+static_assert(offsetof(CameraUniforms, camera_pos) == 5 * 64, "CameraUniforms does not match std140 layout");
+static_assert(sizeof(SkyUniforms) == 4 * 16, "SkyUniforms does not match std140 layout");
+static_assert(sizeof(CloudUniforms) == 5 * 16, "CloudUniforms does not match std140 layout");
+static_assert(offsetof(CloudUniforms, light_absorption) == 2 * 16, "CloudUniforms does not match std140 layout");